@@ -0,0 +1,45 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later OR Apache-2.0 */
+
+/*
+ * Copyright (C) 2019-2021 Xilinx Inc - All rights reserved
+ * Xilinx Video Buffer Manager (Xvbm)
+ *
+ * This file is dual-licensed; you may select either the GNU
+ * Lesser General Public License version 3 or
+ * Apache License, Version 2.0.
+ *
+ */
+
+/*
+ * Types of XRT's xclhal2.h used by the XVBM interface, for emulation only
+ * builds on machines without XRT installed.
+ */
+
+#ifndef _XVBM_XRT_STUB_H_
+#define _XVBM_XRT_STUB_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void*        xclDeviceHandle;
+typedef unsigned int xclBufferHandle;
+
+#define NULLBO                0xffffffff
+#define XCL_BO_FLAGS_DEV_ONLY (1U << 28)
+
+enum xclVerbosityLevel {
+    XCL_QUIET = 0,
+    XCL_INFO,
+    XCL_WARN,
+    XCL_ERROR
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
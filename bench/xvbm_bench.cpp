@@ -0,0 +1,563 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later OR Apache-2.0 */
+
+/*
+ * Copyright (C) 2019-2021 Xilinx Inc - All rights reserved
+ * Xilinx Video Buffer Manager (Xvbm)
+ *
+ * This file is dual-licensed; you may select either the GNU
+ * Lesser General Public License version 3 or
+ * Apache License, Version 2.0.
+ *
+ */
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include "xvbm.h"
+#include "xvbm.hpp"
+
+#define BENCH_POOL_BUFFERS 64
+#define BENCH_PIPELINE_DEPTH 4
+#define BENCH_BUFFER_SIZE  (1920 * 1080 * 3 / 2)
+
+// Emulated device without latency or bandwidth limits, so the results
+// measure XVBM itself and the host copies it makes
+static xclDeviceHandle bench_device()
+{
+    XvbmEmuConfig cfg;
+
+    xvbm_emu_config_init(&cfg);
+    cfg.alloc_latency_ns = 0;
+    cfg.xfer_latency_ns = 0;
+    cfg.h2d_bytes_per_sec = 0;
+    cfg.d2h_bytes_per_sec = 0;
+    cfg.d2d_bytes_per_sec = 0;
+    return xvbm_emu_device_open(&cfg);
+}
+
+// One device and one pool shared by all benchmarks and threads, so the
+// multi-threaded runs contend on the same pool lock as an application would
+static XvbmPoolHandle bench_pool()
+{
+    static xclDeviceHandle d_handle = bench_device();
+    static XvbmPoolHandle p_handle = xvbm_buffer_pool_create(d_handle,
+                                                             BENCH_POOL_BUFFERS,
+                                                             BENCH_BUFFER_SIZE,
+                                                             0);
+    return p_handle;
+}
+
+static int bench_max_threads()
+{
+    int n = std::thread::hardware_concurrency();
+    return n < 2 ? 2 : (n > 16 ? 16 : n);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+static void BM_AllocFree(benchmark::State &state)
+{
+    XvbmPoolHandle p_handle = bench_pool();
+
+    for (auto _ : state) {
+        XvbmBufferHandle b_handle = xvbm_buffer_pool_entry_alloc(p_handle);
+        benchmark::DoNotOptimize(b_handle);
+        xvbm_buffer_pool_entry_free(b_handle);
+    }
+}
+BENCHMARK(BM_AllocFree)->ThreadRange(1, bench_max_threads())->UseRealTime();
+
+static void BM_RefcntInc(benchmark::State &state)
+{
+    XvbmBufferHandle b_handle = xvbm_buffer_pool_entry_alloc(bench_pool());
+
+    for (auto _ : state)
+        xvbm_buffer_refcnt_inc(b_handle);
+
+    // Drop the references taken above outside of the timed loop
+    for (int64_t i = 0; i <= state.iterations(); i++)
+        xvbm_buffer_pool_entry_free(b_handle);
+}
+BENCHMARK(BM_RefcntInc)->ThreadRange(1, bench_max_threads())->UseRealTime();
+
+static void BM_GetHandleByPaddr(benchmark::State &state)
+{
+    XvbmPoolHandle p_handle = bench_pool();
+    std::vector<uint64_t> paddrs;
+    size_t i = 0;
+
+    for (uint32_t idx = 0; idx < BENCH_POOL_BUFFERS; idx++)
+        paddrs.push_back(xvbm_buffer_get_paddr(xvbm_get_buffer_handle(p_handle, idx)));
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(xvbm_buffer_get_handle(p_handle, paddrs[i]));
+        i = (i + 1) % paddrs.size();
+    }
+}
+BENCHMARK(BM_GetHandleByPaddr)->ThreadRange(1, bench_max_threads())->UseRealTime();
+
+//////////////////////////////////////////////////////////////////////////////
+// Transfers, range(0) is the size and range(1) is 1 for a user buffer that
+// is not 4K aligned and has to be staged
+//////////////////////////////////////////////////////////////////////////////
+static void BM_Write(benchmark::State &state)
+{
+    size_t size = state.range(0);
+    bool unaligned = state.range(1);
+    XvbmBufferHandle b_handle = xvbm_buffer_pool_entry_alloc(bench_pool());
+    void *mem;
+
+    if (b_handle == NULL || posix_memalign(&mem, 4096, size + 4096)) {
+        state.SkipWithError("out of buffers");
+        return;
+    }
+    uint8_t *src = (uint8_t*)mem + (unaligned ? 64 : 0);
+    memset(src, 0xa5, size);
+
+    for (auto _ : state)
+        xvbm_buffer_write(b_handle, src, size, 0);
+
+    state.SetBytesProcessed(state.iterations() * size);
+    free(mem);
+    xvbm_buffer_pool_entry_free(b_handle);
+}
+
+static void BM_Read(benchmark::State &state)
+{
+    size_t size = state.range(0);
+    bool unaligned = state.range(1);
+    XvbmBufferHandle b_handle = xvbm_buffer_pool_entry_alloc(bench_pool());
+    void *mem;
+
+    if (b_handle == NULL || posix_memalign(&mem, 4096, size + 4096)) {
+        state.SkipWithError("out of buffers");
+        return;
+    }
+    uint8_t *dst = (uint8_t*)mem + (unaligned ? 64 : 0);
+
+    for (auto _ : state)
+        xvbm_buffer_read(b_handle, dst, size, 0);
+
+    state.SetBytesProcessed(state.iterations() * size);
+    free(mem);
+    xvbm_buffer_pool_entry_free(b_handle);
+}
+
+static void transfer_args(benchmark::internal::Benchmark *b)
+{
+    b->ArgNames({"size", "unaligned"});
+    for (int64_t size : {4096, 64 * 1024, 1024 * 1024, BENCH_BUFFER_SIZE})
+        for (int64_t unaligned : {0, 1})
+            b->Args({size, unaligned});
+    b->ThreadRange(1, bench_max_threads())->UseRealTime();
+}
+BENCHMARK(BM_Write)->Apply(transfer_args);
+BENCHMARK(BM_Read)->Apply(transfer_args);
+
+//////////////////////////////////////////////////////////////////////////////
+// Reuse policies, range(0) is the XvbmReusePolicy and range(1) the frame
+// size. The pool is striped over both banks. A producer keeps a few frames
+// in flight and writes each new one through the host shadow, as a decoder
+// feeding a scaler would. The touched counter is the number of distinct
+// buffers the pool handed out.
+//////////////////////////////////////////////////////////////////////////////
+static void BM_ReusePolicy(benchmark::State &state)
+{
+    static xclDeviceHandle d_handle = bench_device();
+    size_t size = state.range(1);
+    XvbmPoolHandle p_handle = xvbm_buffer_pool_create(d_handle, BENCH_POOL_BUFFERS,
+                                                      size, XVBM_POOL_STRIPE | 0x3);
+    std::deque<XvbmBufferHandle> in_flight;
+    XvbmPoolStats st;
+    void *src;
+
+    if (p_handle == NULL || posix_memalign(&src, 4096, size)) {
+        state.SkipWithError("pool creation failed");
+        return;
+    }
+    memset(src, 0x5a, size);
+    xvbm_buffer_pool_read_cache_set(p_handle, true);
+    xvbm_buffer_pool_reuse_policy_set(p_handle, (XvbmReusePolicy)state.range(0));
+
+    for (auto _ : state) {
+        XvbmBufferHandle b_handle = xvbm_buffer_pool_entry_alloc(p_handle);
+        xvbm_buffer_write(b_handle, src, size, 0);
+        in_flight.push_back(b_handle);
+        if (in_flight.size() > BENCH_PIPELINE_DEPTH) {
+            xvbm_buffer_pool_entry_free(in_flight.front());
+            in_flight.pop_front();
+        }
+    }
+
+    xvbm_buffer_pool_stats_get(p_handle, &st);
+    state.counters["touched"] = st.touched;
+    state.SetBytesProcessed(state.iterations() * size);
+    for (auto b_handle : in_flight)
+        xvbm_buffer_pool_entry_free(b_handle);
+    xvbm_buffer_pool_destroy(p_handle);
+    free(src);
+}
+BENCHMARK(BM_ReusePolicy)->ArgNames({"policy", "size"})
+    ->ArgsProduct({{XVBM_REUSE_FIFO, XVBM_REUSE_LIFO, XVBM_REUSE_BANK_RR},
+                   {352 * 288 * 3 / 2, BENCH_BUFFER_SIZE}});
+
+//////////////////////////////////////////////////////////////////////////////
+// NUMA placement, range(0) is the node of the emulated device. The thread
+// runs on node 0 and writes a frame then reads it back from the host
+// shadow, which the pool keeps on the device's node, so node 0 measures
+// local and other nodes cross socket copies.
+//////////////////////////////////////////////////////////////////////////////
+static void BM_NumaRoundTrip(benchmark::State &state)
+{
+    int32_t node = state.range(0);
+    char path[64];
+    XvbmEmuConfig cfg;
+    cpu_set_t saved;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", node);
+    if (access(path, F_OK) != 0) {
+        state.SkipWithError("no such NUMA node");
+        return;
+    }
+    xvbm_emu_config_init(&cfg);
+    cfg.alloc_latency_ns = 0;
+    cfg.xfer_latency_ns = 0;
+    cfg.h2d_bytes_per_sec = 0;
+    cfg.d2h_bytes_per_sec = 0;
+    cfg.d2d_bytes_per_sec = 0;
+    cfg.numa_node = 0;
+    xclDeviceHandle local = xvbm_emu_device_open(&cfg);
+    cfg.numa_node = node;
+    xclDeviceHandle d_handle = xvbm_emu_device_open(&cfg);
+    sched_getaffinity(0, sizeof(saved), &saved);
+    if (xvbm_thread_numa_bind(local) != 0) {
+        state.SkipWithError("can not run on node 0");
+        xvbm_emu_device_close(d_handle);
+        xvbm_emu_device_close(local);
+        return;
+    }
+
+    XvbmPoolHandle p_handle = xvbm_buffer_pool_create(d_handle, 1, BENCH_BUFFER_SIZE, 0);
+    xvbm_buffer_pool_read_cache_set(p_handle, true);
+    XvbmBufferHandle b_handle = xvbm_buffer_pool_entry_alloc(p_handle);
+    std::vector<uint8_t> src(BENCH_BUFFER_SIZE, 0x3c), dst(BENCH_BUFFER_SIZE);
+
+    for (auto _ : state) {
+        xvbm_buffer_write(b_handle, src.data(), BENCH_BUFFER_SIZE, 0);
+        xvbm_buffer_read(b_handle, dst.data(), BENCH_BUFFER_SIZE, 0);
+    }
+    state.SetBytesProcessed(state.iterations() * 2 * BENCH_BUFFER_SIZE);
+
+    xvbm_buffer_pool_entry_free(b_handle);
+    xvbm_buffer_pool_destroy(p_handle);
+    sched_setaffinity(0, sizeof(saved), &saved);
+    xvbm_emu_device_close(d_handle);
+    xvbm_emu_device_close(local);
+}
+BENCHMARK(BM_NumaRoundTrip)->ArgName("node")->DenseRange(0, 1);
+
+//////////////////////////////////////////////////////////////////////////////
+// Channel start and stop, range(0) enables the pool cache. Each iteration
+// creates a pool of 1080p frames and destroys it again, as a session does.
+//////////////////////////////////////////////////////////////////////////////
+static void BM_PoolCreateDestroy(benchmark::State &state)
+{
+    static xclDeviceHandle d_handle = bench_device();
+    XvbmPoolCacheStats before, after;
+
+    xvbm_pool_cache_config(state.range(0) ? 1ull << 30 : 0, 0);
+    xvbm_pool_cache_stats_get(&before);
+    for (auto _ : state) {
+        XvbmPoolHandle p_handle = xvbm_buffer_pool_create(d_handle, 16,
+                                                          BENCH_BUFFER_SIZE, 0);
+        if (p_handle == NULL) {
+            state.SkipWithError("pool creation failed");
+            break;
+        }
+        xvbm_buffer_pool_destroy(p_handle);
+    }
+    xvbm_pool_cache_stats_get(&after);
+    state.counters["hits"] = after.hits - before.hits;
+    xvbm_pool_cache_config(0, 0);
+}
+BENCHMARK(BM_PoolCreateDestroy)->ArgName("cache")->DenseRange(0, 1);
+
+//////////////////////////////////////////////////////////////////////////////
+// Time the thread dropping the last reference of a pool spends in it,
+// range(0) enables the reclaim thread. Creation is not timed.
+//////////////////////////////////////////////////////////////////////////////
+static void BM_PoolDestroy(benchmark::State &state)
+{
+    static xclDeviceHandle d_handle = bench_device();
+
+    xvbm_reclaim_config(state.range(0) ? 1ull << 30 : 0);
+    for (auto _ : state) {
+        state.PauseTiming();
+        XvbmPoolHandle p_handle = xvbm_buffer_pool_create(d_handle, 16,
+                                                          BENCH_BUFFER_SIZE, 0);
+        state.ResumeTiming();
+        if (p_handle == NULL) {
+            state.SkipWithError("pool creation failed");
+            break;
+        }
+        xvbm_buffer_pool_destroy(p_handle);
+    }
+    xvbm_reclaim_wait(NULL, XVBM_WAIT_FOREVER);
+    xvbm_reclaim_config(0);
+}
+BENCHMARK(BM_PoolDestroy)->ArgName("reclaim")->DenseRange(0, 1)->UseRealTime();
+
+//////////////////////////////////////////////////////////////////////////////
+// Buffer queues. range(0) selects XVBM_QUEUE_SPSC, XVBM_QUEUE_MPMC or, as
+// BENCH_QUEUE_MUTEX, the mutex and deque queue pipelines used to write.
+//////////////////////////////////////////////////////////////////////////////
+#define BENCH_QUEUE_MUTEX 2
+#define BENCH_QUEUE_DEPTH 8
+
+class BenchQueue
+{
+public:
+    explicit BenchQueue(int type)
+    {
+        if (type != BENCH_QUEUE_MUTEX)
+            m_queue = xvbm_queue_create((XvbmQueueType)type, BENCH_QUEUE_DEPTH);
+    }
+    ~BenchQueue()
+    {
+        if (m_queue)
+            xvbm_queue_destroy(m_queue);
+    }
+
+    void push(XvbmBufferHandle b_handle)
+    {
+        if (m_queue) {
+            xvbm_queue_push(m_queue, b_handle, XVBM_WAIT_FOREVER);
+            return;
+        }
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_not_full.wait(lock, [&]() { return m_deque.size() < BENCH_QUEUE_DEPTH; });
+        m_deque.push_back(b_handle);
+        m_not_empty.notify_one();
+    }
+
+    XvbmBufferHandle pop()
+    {
+        if (m_queue)
+            return xvbm_queue_pop(m_queue, XVBM_WAIT_FOREVER);
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_not_empty.wait(lock, [&]() { return !m_deque.empty() || m_closed; });
+        if (m_deque.empty())
+            return NULL;
+        XvbmBufferHandle b_handle = m_deque.front();
+        m_deque.pop_front();
+        m_not_full.notify_one();
+        return b_handle;
+    }
+
+    void close()
+    {
+        if (m_queue) {
+            xvbm_queue_close(m_queue);
+            return;
+        }
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_closed = true;
+        m_not_empty.notify_all();
+    }
+
+private:
+    XvbmQueueHandle              m_queue = NULL;
+    std::mutex                   m_lock;
+    std::condition_variable      m_not_empty;
+    std::condition_variable      m_not_full;
+    std::deque<XvbmBufferHandle> m_deque;
+    bool                         m_closed = false;
+};
+
+// Throughput: a producer thread allocates frames, blocking while the pool
+// is exhausted, and queues them; the benchmark thread consumes and frees
+static void BM_QueueThroughput(benchmark::State &state)
+{
+    static xclDeviceHandle d_handle = bench_device();
+    XvbmPoolHandle p_handle = xvbm_buffer_pool_create(d_handle, 2 * BENCH_QUEUE_DEPTH, 4096, 0);
+    BenchQueue queue(state.range(0));
+    std::atomic<bool> stop(false);
+
+    std::thread producer([&]() {
+        while (!stop.load(std::memory_order_relaxed)) {
+            XvbmBufferHandle b_handle = xvbm_buffer_pool_entry_alloc_wait(p_handle, 10);
+            if (b_handle)
+                queue.push(b_handle);
+        }
+        queue.close();
+    });
+    for (auto _ : state) {
+        XvbmBufferHandle b_handle = queue.pop();
+        xvbm_buffer_pool_entry_free(b_handle);
+    }
+    stop = true;
+    XvbmBufferHandle b_handle;
+    while ((b_handle = queue.pop()) != NULL)
+        xvbm_buffer_pool_entry_free(b_handle);
+    producer.join();
+    state.SetItemsProcessed(state.iterations());
+    xvbm_buffer_pool_destroy(p_handle);
+}
+BENCHMARK(BM_QueueThroughput)->ArgName("queue")->DenseRange(0, BENCH_QUEUE_MUTEX)->UseRealTime();
+
+// Latency: one frame travels to an echo thread and back per iteration
+static void BM_QueueRoundTrip(benchmark::State &state)
+{
+    static xclDeviceHandle d_handle = bench_device();
+    XvbmPoolHandle p_handle = xvbm_buffer_pool_create(d_handle, 1, 4096, 0);
+    BenchQueue there(state.range(0)), back(state.range(0));
+
+    std::thread echo([&]() {
+        XvbmBufferHandle b_handle;
+        while ((b_handle = there.pop()) != NULL)
+            back.push(b_handle);
+    });
+    XvbmBufferHandle b_handle = xvbm_buffer_pool_entry_alloc(p_handle);
+    for (auto _ : state) {
+        there.push(b_handle);
+        b_handle = back.pop();
+    }
+    there.close();
+    echo.join();
+    xvbm_buffer_pool_entry_free(b_handle);
+    xvbm_buffer_pool_destroy(p_handle);
+}
+BENCHMARK(BM_QueueRoundTrip)->ArgName("queue")->DenseRange(0, BENCH_QUEUE_MUTEX)->UseRealTime();
+
+//////////////////////////////////////////////////////////////////////////////
+// Frame metadata, range(0) 0 keeps it in a map keyed by device address
+// behind a mutex as applications used to, 1 in the buffer's metadata slot.
+// Each iteration allocates a frame, tags it, and a later stage reads the
+// tag back and frees the frame.
+//////////////////////////////////////////////////////////////////////////////
+struct BenchFrameMeta
+{
+    int64_t  pts;
+    uint32_t type;
+    uint32_t hdr[6];
+};
+
+static void BM_FrameMetadata(benchmark::State &state)
+{
+    static xclDeviceHandle d_handle = bench_device();
+    XvbmPoolAttr attr = {};
+    attr.meta_size = sizeof(BenchFrameMeta);
+    XvbmPoolHandle p_handle = xvbm_buffer_pool_create_ex(d_handle, BENCH_POOL_BUFFERS, 4096, 0, &attr);
+    std::map<uint64_t, BenchFrameMeta> side_map;
+    std::mutex side_lock;
+    int64_t pts = 0;
+
+    for (auto _ : state) {
+        XvbmBufferHandle b_handle = xvbm_buffer_pool_entry_alloc(p_handle);
+        BenchFrameMeta meta = {pts++, 1, {0}};
+        if (state.range(0) == 0) {
+            std::lock_guard<std::mutex> guard(side_lock);
+            side_map[xvbm_buffer_get_paddr(b_handle)] = meta;
+        } else {
+            *(BenchFrameMeta*)xvbm_buffer_get_meta(b_handle) = meta;
+        }
+
+        if (state.range(0) == 0) {
+            uint64_t paddr = xvbm_buffer_get_paddr(b_handle);
+            XvbmBufferHandle h = xvbm_buffer_get_handle(p_handle, paddr);
+            std::lock_guard<std::mutex> guard(side_lock);
+            auto it = side_map.find(paddr);
+            benchmark::DoNotOptimize(it->second.pts);
+            side_map.erase(it);
+            xvbm_buffer_pool_entry_free(h);
+        } else {
+            benchmark::DoNotOptimize(((BenchFrameMeta*)xvbm_buffer_get_meta(b_handle))->pts);
+            xvbm_buffer_pool_entry_free(b_handle);
+        }
+    }
+    xvbm_buffer_pool_destroy(p_handle);
+}
+BENCHMARK(BM_FrameMetadata)->ArgName("slot")->DenseRange(0, 1);
+
+//////////////////////////////////////////////////////////////////////////////
+// Handing a frame through a chain of stages, range(0) 0 with the raw handles
+// the way C++ callers wrapped them, each stage taking its own reference and
+// dropping the previous one, 1 moving an xvbm::BufferRef along.
+//////////////////////////////////////////////////////////////////////////////
+#define BENCH_HANDOFF_STAGES 4
+
+static void BM_BufferHandoff(benchmark::State &state)
+{
+    XvbmPoolHandle p_handle = bench_pool();
+
+    for (auto _ : state) {
+        if (state.range(0) == 0) {
+            XvbmBufferHandle stage[BENCH_HANDOFF_STAGES];
+            stage[0] = xvbm_buffer_pool_entry_alloc(p_handle);
+            for (int i = 1; i < BENCH_HANDOFF_STAGES; i++) {
+                xvbm_buffer_refcnt_inc(stage[i - 1]);
+                stage[i] = stage[i - 1];
+                xvbm_buffer_pool_entry_free(stage[i - 1]);
+            }
+            benchmark::DoNotOptimize(stage[BENCH_HANDOFF_STAGES - 1]);
+            xvbm_buffer_pool_entry_free(stage[BENCH_HANDOFF_STAGES - 1]);
+        } else {
+            xvbm::BufferRef stage[BENCH_HANDOFF_STAGES];
+            stage[0] = xvbm::BufferRef(xvbm_buffer_pool_entry_alloc(p_handle));
+            for (int i = 1; i < BENCH_HANDOFF_STAGES; i++)
+                stage[i] = std::move(stage[i - 1]);
+            benchmark::DoNotOptimize(stage[BENCH_HANDOFF_STAGES - 1].get());
+        }
+    }
+}
+BENCHMARK(BM_BufferHandoff)->ArgName("ref")->DenseRange(0, 1);
+
+//////////////////////////////////////////////////////////////////////////////
+// A background burst drains the pool before the encoder allocates its
+// frame, range(0) 0 without priority classes, 1 with two buffers reserved
+// for the encoder and the background capped at half the pool. The
+// critical_null counter is the share of encoder allocations that failed.
+//////////////////////////////////////////////////////////////////////////////
+#define BENCH_PRIO_BUFFERS 8
+
+static void BM_PriorityBurst(benchmark::State &state)
+{
+    static xclDeviceHandle d_handle = bench_device();
+    XvbmPoolHandle p_handle = xvbm_buffer_pool_create(d_handle, BENCH_PRIO_BUFFERS, 4096, 0);
+    std::vector<XvbmBufferHandle> burst;
+    uint64_t nulls = 0;
+
+    if (state.range(0)) {
+        xvbm_buffer_pool_prio_set(p_handle, XVBM_PRIO_CRITICAL, 2, 0);
+        xvbm_buffer_pool_prio_set(p_handle, XVBM_PRIO_BACKGROUND, 0, BENCH_PRIO_BUFFERS / 2);
+    }
+    for (auto _ : state) {
+        XvbmBufferHandle b_handle;
+        while ((b_handle = xvbm_buffer_pool_entry_alloc_prio(p_handle, XVBM_PRIO_BACKGROUND)) != NULL)
+            burst.push_back(b_handle);
+        while (burst.size() < BENCH_PRIO_BUFFERS / 2 &&
+               (b_handle = xvbm_buffer_pool_entry_alloc(p_handle)) != NULL)
+            burst.push_back(b_handle);
+        b_handle = xvbm_buffer_pool_entry_alloc_prio(p_handle, XVBM_PRIO_CRITICAL);
+        if (b_handle)
+            xvbm_buffer_pool_entry_free(b_handle);
+        else
+            nulls++;
+        for (auto h : burst)
+            xvbm_buffer_pool_entry_free(h);
+        burst.clear();
+    }
+    state.counters["critical_null"] = benchmark::Counter((double)nulls, benchmark::Counter::kAvgIterations);
+    xvbm_buffer_pool_destroy(p_handle);
+}
+BENCHMARK(BM_PriorityBurst)->ArgName("classes")->DenseRange(0, 1);
+
+BENCHMARK_MAIN();
@@ -23,6 +23,251 @@ extern "C" {
 
 typedef void* XvbmPoolHandle;
 typedef void* XvbmBufferHandle;
+typedef void* XvbmPoolGroupHandle;
+typedef void* XvbmQueueHandle;
+
+#define XVBM_STATS_HIST_BUCKETS 32
+
+/* Timeout of calls that block until they succeed */
+#define XVBM_WAIT_FOREVER 0xffffffffU
+
+/**
+ * Buffer pool statistics
+ *
+ * Latency histograms are log2 buckets: bucket i counts operations that took
+ * between 2^i and 2^(i+1) nanoseconds, the last bucket also counts anything
+ * slower.
+*/
+typedef struct XvbmPoolStats
+{
+    uint64_t allocs;            /* buffers handed out by entry_alloc */
+    uint64_t frees;             /* buffers returned to the free list */
+    uint64_t failed_allocs;     /* entry_alloc calls that returned NULL */
+    int32_t  num_buffers;       /* buffers allocated to the pool */
+    uint32_t inuse;             /* buffers currently in use */
+    uint32_t inuse_high_water;  /* maximum buffers in use at once */
+    uint32_t touched;           /* distinct buffers ever handed out */
+    uint64_t extends;           /* successful xvbm_buffer_pool_extend calls */
+    uint64_t lock_contentions;  /* pool lock acquisitions that had to wait */
+    uint64_t lock_wait_ns;      /* total time spent waiting for the lock */
+    uint64_t alloc_latency_hist[XVBM_STATS_HIST_BUCKETS];
+    uint64_t free_latency_hist[XVBM_STATS_HIST_BUCKETS];
+} XvbmPoolStats;
+
+typedef enum XvbmXferDir
+{
+    XVBM_XFER_TO_DEVICE = 0,    /* xvbm_buffer_write */
+    XVBM_XFER_FROM_DEVICE,      /* xvbm_buffer_read */
+    XVBM_XFER_DEVICE_COPY,      /* device side xvbm_buffer_copy */
+    XVBM_XFER_DIRS
+} XvbmXferDir;
+
+/**
+ * Buffer transfer statistics of a pool for one direction
+ *
+ * Staged transfers went through a host copy because the user buffer was not
+ * 4K aligned, direct transfers used the user buffer as is.  Latency
+ * histograms use the same log2 buckets as XvbmPoolStats.
+*/
+typedef struct XvbmXferStats
+{
+    uint64_t calls;             /* transfers that reached the device */
+    uint64_t bytes;             /* bytes moved by successful transfers */
+    uint64_t staged;            /* transfers staged through host memory */
+    uint64_t direct;            /* transfers straight from/to user memory */
+    uint64_t cached;            /* reads served from the host shadow */
+    uint64_t cached_bytes;      /* bytes served from the host shadow */
+    uint64_t errors;            /* failed transfers */
+    uint64_t remote;            /* issued from a CPU on another NUMA node than the device */
+    uint64_t dma_ns;            /* total time in xclWriteBO/xclReadBO/xclCopyBO */
+    uint64_t memcpy_ns;         /* total time copying through host memory */
+    uint64_t dma_latency_hist[XVBM_STATS_HIST_BUCKETS];
+    uint64_t memcpy_latency_hist[XVBM_STATS_HIST_BUCKETS];
+} XvbmXferStats;
+
+/**
+ * Pool creation flags
+ *
+ * The low bits select the DDR bank every buffer is allocated from.  With
+ * XVBM_POOL_STRIPE they are instead a mask of banks, and consecutive
+ * buffers of the pool are placed on the selected banks in turn so that
+ * concurrent accesses to consecutive frames use separate memory channels.
+*/
+#define XVBM_POOL_BANK_MASK 0xffffU
+#define XVBM_POOL_STRIPE    (1U << 16)
+
+/**
+ * Buffers of a pool placed on one DDR bank
+*/
+typedef struct XvbmBankUsage
+{
+    uint32_t bank;              /* DDR bank index */
+    uint32_t num_buffers;       /* buffers of the pool on the bank */
+    uint32_t inuse;             /* of which currently in use */
+    uint64_t bytes;             /* device memory taken on the bank */
+} XvbmBankUsage;
+
+/**
+ * Order in which free buffers are handed out again
+*/
+typedef enum XvbmReusePolicy
+{
+    XVBM_REUSE_FIFO = 0,        /* least recently freed first (default) */
+    XVBM_REUSE_LIFO,            /* most recently freed first, keeps the working set small */
+    XVBM_REUSE_BANK_RR          /* rotate across DDR banks, FIFO within a bank */
+} XvbmReusePolicy;
+
+/**
+ * How a pool group picks the device for an allocation
+*/
+typedef enum XvbmGroupPolicy
+{
+    XVBM_GROUP_MOST_FREE = 0,   /* device with the most free buffers (default) */
+    XVBM_GROUP_LEAST_LOADED     /* device with the fewest bytes in flight */
+} XvbmGroupPolicy;
+
+/**
+ * Concurrency of a buffer queue
+*/
+typedef enum XvbmQueueType
+{
+    XVBM_QUEUE_SPSC = 0,        /* one producer and one consumer thread */
+    XVBM_QUEUE_MPMC             /* any number of producers and consumers */
+} XvbmQueueType;
+
+/**
+ * Priority class of an allocation
+ *
+ * Classes are ordered, a class may take buffers reserved for the classes
+ * below it but never those reserved for the classes above it.
+*/
+typedef enum XvbmPriority
+{
+    XVBM_PRIO_CRITICAL = 0,     /* latency critical stages, e.g. the encoder */
+    XVBM_PRIO_NORMAL,           /* xvbm_buffer_pool_entry_alloc */
+    XVBM_PRIO_BACKGROUND,       /* bursty stages that may be held back */
+    XVBM_PRIO_CLASSES
+} XvbmPriority;
+
+/**
+ * Allocation statistics of a pool for one priority class
+ *
+ * Denied allocations are failed allocations refused while the pool still
+ * had free buffers, because of the class cap or the reservations of
+ * higher classes.
+*/
+typedef struct XvbmPrioStats
+{
+    uint32_t reserved;          /* buffers reserved for the class */
+    uint32_t max_inuse;         /* cap on buffers in use, 0 for none */
+    uint32_t inuse;             /* buffers currently held by the class */
+    uint32_t inuse_high_water;  /* maximum buffers held at once */
+    uint64_t allocs;            /* buffers handed out to the class */
+    uint64_t failed_allocs;     /* allocations that returned NULL */
+    uint64_t denied;            /* failed allocations while buffers were free */
+    uint64_t waits;             /* blocking allocations that had to wait */
+    uint64_t wait_timeouts;     /* blocking allocations that timed out */
+    uint64_t wait_ns;           /* total time spent waiting */
+    uint64_t max_wait_ns;       /* longest wait */
+} XvbmPrioStats;
+
+/**
+ * Result of the last pool create or extend call of the calling thread
+*/
+typedef enum XvbmStatus
+{
+    XVBM_STATUS_OK = 0,
+    XVBM_STATUS_INVALID,        /* invalid arguments */
+    XVBM_STATUS_NO_MEMORY,      /* device or host allocation failed */
+    XVBM_STATUS_OVER_BUDGET     /* refused by a device or bank budget */
+} XvbmStatus;
+
+/**
+ * Optional pool creation attributes, zero initialise for the defaults
+*/
+typedef struct XvbmPoolAttr
+{
+    uint32_t tenant;            /* owner charged for the pool's memory, 0 by default */
+    uint32_t meta_size;         /* bytes of user metadata per buffer, at most
+                                   XVBM_META_MAX_SIZE, 0 for none */
+} XvbmPoolAttr;
+
+/* Largest metadata slot of a buffer */
+#define XVBM_META_MAX_SIZE 4096
+
+/**
+ * Reclaim thread counters, process wide
+*/
+typedef struct XvbmReclaimStats
+{
+    uint64_t queued;            /* pools handed to the reclaim thread */
+    uint64_t completed;         /* of which freed */
+    uint64_t inline_frees;      /* pools freed by the caller, the cap was reached */
+    uint32_t pending_pools;     /* pools waiting to be freed */
+    uint64_t pending_bytes;     /* device memory they hold */
+    uint64_t peak_bytes;        /* maximum of pending_bytes */
+    uint64_t teardown_ns;       /* total time spent freeing pools */
+    uint64_t max_teardown_ns;   /* longest time to free one pool */
+} XvbmReclaimStats;
+
+/* Budget scope covering all banks of a device */
+#define XVBM_BUDGET_DEVICE (-1)
+
+/**
+ * Pool cache counters, process wide
+*/
+typedef struct XvbmPoolCacheStats
+{
+    uint64_t hits;              /* creates served by a dormant pool */
+    uint64_t misses;            /* creates that allocated a new pool */
+    uint64_t evictions;         /* dormant pools freed for age or budget */
+    uint32_t dormant_pools;     /* pools currently dormant */
+    uint64_t dormant_bytes;     /* device memory held by them */
+} XvbmPoolCacheStats;
+
+typedef enum XvbmLogLevel
+{
+    XVBM_LOG_ERROR = 0,
+    XVBM_LOG_WARNING,
+    XVBM_LOG_INFO,
+    XVBM_LOG_DEBUG
+} XvbmLogLevel;
+
+typedef enum XvbmLogSink
+{
+    XVBM_LOG_SINK_STDERR = 0,
+    XVBM_LOG_SINK_SYSLOG,
+    XVBM_LOG_SINK_CALLBACK
+} XvbmLogSink;
+
+/**
+ * Emulated device model
+ *
+ * Buffers are placed first fit in the DDR bank named by the pool flags and
+ * allocation fails once that bank has no room.  Each direction of the PCIe
+ * link and the device copy engine serve one transfer at a time at their
+ * bandwidth, every transfer also pays a fixed latency.
+*/
+typedef struct XvbmEmuConfig
+{
+    uint32_t num_banks;          /* DDR banks */
+    uint64_t bank_size;          /* capacity of each bank in bytes */
+    uint64_t alloc_latency_ns;   /* cost of each buffer allocation and free */
+    uint64_t xfer_latency_ns;    /* fixed cost of each transfer */
+    uint64_t h2d_bytes_per_sec;  /* host to device bandwidth, 0 for unlimited */
+    uint64_t d2h_bytes_per_sec;  /* device to host bandwidth, 0 for unlimited */
+    uint64_t d2d_bytes_per_sec;  /* device copy bandwidth, 0 for unlimited */
+    bool     store_data;         /* false to model timing only without memory */
+    int32_t  numa_node;          /* host node the device is attached to, -1 for none */
+} XvbmEmuConfig;
+
+/**
+ * Log callback, called from the XVBM logging thread with one message
+ * without a trailing newline
+*/
+typedef void (*XvbmLogCallback)(XvbmLogLevel  level,
+                                const char   *msg,
+                                void         *user_data);
 
 /****************************************************************************/
 /* Buffer pool related functions                                            */
@@ -34,7 +279,8 @@ typedef void* XvbmBufferHandle;
  * @param [in] d_handle   Device handle return from xclOpen
  * @param [in] num_buffer Number of device buffers to allocate
  * @param [in] size       Size of each buffer
- * @param [in] flags      DDR bank to allocate buffer
+ * @param [in] flags      DDR bank to allocate buffer, or XVBM_POOL_STRIPE
+ *                        with a mask of banks
  *
  * @returns XvbmPoolHandle used for all subsequent memory pool requests
 */
@@ -49,7 +295,8 @@ XvbmPoolHandle xvbm_buffer_pool_create(xclDeviceHandle d_handle,
  * @param [in] device_id  Device ID (from 0-N) containing the buffer pool 
  * @param [in] num_buffer Number of device buffers to allocate
  * @param [in] size       Size of each buffer
- * @param [in] flags      DDR bank to allocate buffer
+ * @param [in] flags      DDR bank to allocate buffer, or XVBM_POOL_STRIPE
+ *                        with a mask of banks
  *
  * @returns XvbmPoolHandle used for all subsequent memory pool requests
 */
@@ -57,6 +304,35 @@ XvbmPoolHandle xvbm_buffer_pool_create_by_device_id(int32_t  device_id,
                                                     int32_t  num_buffers,
                                                     size_t   size,
                                                     uint32_t flags);
+
+/**
+ * Create a memory pool with creation attributes
+ *
+ * Like xvbm_buffer_pool_create, with the pool's memory charged to the
+ * tenant of attr in the device memory budgets.
+ *
+ * @param [in] d_handle   Device handle return from xclOpen
+ * @param [in] num_buffer Number of device buffers to allocate
+ * @param [in] size       Size of each buffer
+ * @param [in] flags      DDR bank to allocate buffer, or XVBM_POOL_STRIPE
+ *                        with a mask of banks
+ * @param [in] attr       Attributes, NULL for the defaults
+ *
+ * @returns XvbmPoolHandle, NULL on failure with the reason in
+ *          xvbm_last_status
+*/
+XvbmPoolHandle xvbm_buffer_pool_create_ex(xclDeviceHandle     d_handle,
+                                          int32_t             num_buffers,
+                                          size_t              size,
+                                          uint32_t            flags,
+                                          const XvbmPoolAttr *attr);
+
+/**
+ * Reason the last pool create or extend call of this thread failed
+ *
+ * @returns XVBM_STATUS_OK if it succeeded
+*/
+XvbmStatus xvbm_last_status(void);
 /**
  * Set offsets for all buffers in the pool (useful for planes of a frame) 
  *
@@ -88,7 +364,8 @@ uint32_t xvbm_buffer_pool_offset_get(XvbmBufferHandle b_handle,
  * @returns Number of buffers allocated to the pool.  If the current 
  *          number of buffers allocated is greater than the number of
  *          buffers requested, the number of buffers allocated will
- *          remain unchanged.   
+ *          remain unchanged.   0 on failure, with the reason in
+ *          xvbm_last_status
 */
 int32_t xvbm_buffer_pool_extend(XvbmBufferHandle b_handle,
                                 int32_t          num_buffers);
@@ -111,6 +388,72 @@ int32_t xvbm_buffer_pool_num_buffers_get(XvbmBufferHandle b_handle);
 */
 XvbmBufferHandle xvbm_buffer_pool_entry_alloc(XvbmPoolHandle p_handle);
 
+/**
+ * Allocate a free buffer from a memory pool, waiting for one if none is free
+ *
+ * @param [in] p_handle   Handle to an existing buffer pool
+ * @param [in] timeout_ms Time to wait, 0 does not wait, XVBM_WAIT_FOREVER
+ *                        waits until a buffer is freed
+ *
+ * @returns XvbmBufferHandle, NULL on timeout
+*/
+XvbmBufferHandle xvbm_buffer_pool_entry_alloc_wait(XvbmPoolHandle p_handle,
+                                                   uint32_t       timeout_ms);
+
+/**
+ * Allocate a free buffer on behalf of a priority class
+ *
+ * The buffer is handed out unless that would leave fewer free buffers than
+ * the higher classes have reserved and not yet taken, or the class
+ * already holds its cap.  The buffer counts against the class until its
+ * final xvbm_buffer_pool_entry_free.
+ *
+ * @param [in] p_handle   Handle to an existing buffer pool
+ * @param [in] prio       Priority class of the caller
+ *
+ * @returns XvbmBufferHandle, NULL if none is free to the class
+*/
+XvbmBufferHandle xvbm_buffer_pool_entry_alloc_prio(XvbmPoolHandle p_handle,
+                                                   XvbmPriority   prio);
+
+/**
+ * Allocate a buffer on behalf of a priority class, waiting until one is
+ * free to the class
+ *
+ * @param [in] p_handle   Handle to an existing buffer pool
+ * @param [in] prio       Priority class of the caller
+ * @param [in] timeout_ms Time to wait, 0 does not wait, XVBM_WAIT_FOREVER
+ *                        waits until a buffer is freed
+ *
+ * @returns XvbmBufferHandle, NULL on timeout
+*/
+XvbmBufferHandle xvbm_buffer_pool_entry_alloc_prio_wait(XvbmPoolHandle p_handle,
+                                                        XvbmPriority   prio,
+                                                        uint32_t       timeout_ms);
+
+/**
+ * Set the reservation and cap of a priority class
+ *
+ * Reserved buffers are held back from the lower classes while the class
+ * holds fewer than that; the class itself is never refused below its
+ * reservation as long as the higher classes leave buffers.  All classes
+ * start with no reservation and no cap.  In pools shared with other
+ * processes the classes only count the buffers this process holds, and
+ * reservations are kept out of the buffers free in all processes.
+ *
+ * @param [in] p_handle   Handle to an existing buffer pool
+ * @param [in] prio       Priority class to configure
+ * @param [in] reserved   Buffers reserved for the class
+ * @param [in] max_inuse  Most buffers the class may hold, 0 for no cap
+ *
+ * @returns 0 on success, -1 if the class is unknown, the cap is below the
+ *          reservation or the reservations exceed the pool
+*/
+int32_t xvbm_buffer_pool_prio_set(XvbmPoolHandle p_handle,
+                                  XvbmPriority   prio,
+                                  uint32_t       reserved,
+                                  uint32_t       max_inuse);
+
 /**
  * Free a buffer and return it back to the memory pool free list 
  *
@@ -119,6 +462,43 @@ XvbmBufferHandle xvbm_buffer_pool_entry_alloc(XvbmPoolHandle p_handle);
 */
 bool xvbm_buffer_pool_entry_free(XvbmBufferHandle b_handle);
 
+/**
+ * Get a buffer that can be modified without affecting other owners
+ *
+ * If the caller is the only owner of the buffer the same handle is
+ * returned.  Otherwise a new buffer is allocated from the same pool, the
+ * contents are copied device side and the caller's reference on the
+ * shared buffer is released.  Other owners keep using the original buffer.
+ *
+ * @param [in] b_handle   Handle to a buffer owned by the caller
+ *
+ * @returns a handle the caller may write to, or NULL if no buffer could be
+ *          allocated or copied or b_handle is a view, in which case the
+ *          caller's reference on b_handle is kept
+*/
+XvbmBufferHandle xvbm_buffer_make_writable(XvbmBufferHandle b_handle);
+
+/**
+ * Create a view on a region of a buffer (a plane, a tile, a crop window)
+ *
+ * The view can be used with the read, write, copy and accessor functions
+ * like any other buffer handle; offsets passed to them are relative to the
+ * start of the view.  The view holds a reference on the buffer and is
+ * released with xvbm_buffer_pool_entry_free.  No device memory is
+ * allocated for a view.
+ *
+ * @param [in] b_handle   Handle to a buffer or view owned by the caller
+ * @param [in] offset     Offset of the region into b_handle
+ * @param [in] size       Size of the region
+ * @param [in] pitch      Line pitch of the region, 0 if not applicable
+ *
+ * @returns a handle to the view or NULL if the region is invalid
+*/
+XvbmBufferHandle xvbm_buffer_view_create(XvbmBufferHandle b_handle,
+                                         size_t           offset,
+                                         size_t           size,
+                                         size_t           pitch);
+
 /**
  * Destroy all resources associated with a buffer pool 
  *
@@ -128,6 +508,242 @@ bool xvbm_buffer_pool_entry_free(XvbmBufferHandle b_handle);
 */
 void xvbm_buffer_pool_destroy(XvbmPoolHandle p_handle);
 
+/**
+ * Enable or disable the host read cache of a buffer pool
+ *
+ * When enabled, reads are staged through the host buffer of each entry and
+ * repeated reads of a range that has not been written on the device since
+ * are served from host memory instead of the device.  Kernels writing to a
+ * buffer behind XVBM's back must call xvbm_buffer_invalidate afterwards.
+ * Buffers whose host pointer has been handed out with
+ * xvbm_buffer_get_host_ptr are never served from the cache.
+ *
+ * @param [in] p_handle   Handle to a memory pool
+ * @param [in] enable     true to enable the cache, false to disable it
+*/
+void xvbm_buffer_pool_read_cache_set(XvbmPoolHandle p_handle,
+                                     bool           enable);
+
+/**
+ * Select the order in which a pool hands out free buffers
+ *
+ * FIFO spreads use over every buffer of the pool.  LIFO hands out the
+ * buffer freed last, whose host shadow is most likely still in the CPU
+ * caches, and leaves the other buffers untouched.  Bank round-robin
+ * alternates between the DDR banks holding the pool so consecutive
+ * buffers do not compete for the same bank.
+ *
+ * @param [in] p_handle   Handle to a memory pool
+ * @param [in] policy     Reuse policy
+ *
+ * @returns 0 on success, -1 for an unknown policy
+*/
+int32_t xvbm_buffer_pool_reuse_policy_set(XvbmPoolHandle  p_handle,
+                                          XvbmReusePolicy policy);
+
+/**
+ * Get the host NUMA node a device is attached to
+ *
+ * Host shadows of pools on the device are placed on this node.
+ *
+ * @param [in] d_handle   Device handle
+ *
+ * @returns the node, -1 when unknown
+*/
+int32_t xvbm_device_numa_node_get(xclDeviceHandle d_handle);
+
+/**
+ * Restrict the calling thread to the CPUs of the device's NUMA node
+ *
+ * Threads transferring to and from the device's pools should run there,
+ * transfers issued from other nodes are counted as remote.
+ *
+ * @param [in] d_handle   Device handle
+ *
+ * @returns 0 on success, -1 when the node is unknown or pinning failed
+*/
+int32_t xvbm_thread_numa_bind(xclDeviceHandle d_handle);
+
+/**
+ * Get the number of buffers a pool has on each DDR bank
+ *
+ * @param [in]  p_handle   Handle to a memory pool
+ * @param [out] usage      Receives one entry per bank holding buffers of
+ *                         the pool, in bank order
+ * @param [in]  max_banks  Number of entries usage has room for
+ *
+ * @returns Number of entries filled, -1 on error
+*/
+int32_t xvbm_buffer_pool_bank_usage_get(XvbmPoolHandle  p_handle,
+                                        XvbmBankUsage  *usage,
+                                        uint32_t        max_banks);
+
+/**
+ * Get the statistics of a buffer pool
+ *
+ * Counters are maintained with relaxed atomics and may be read at any
+ * time; a snapshot taken while the pool is in use is not guaranteed to be
+ * consistent across fields.
+ *
+ * @param [in]  p_handle   Handle to a memory pool
+ * @param [out] stats      Receives the pool statistics
+ *
+ * @returns 0 on success
+*/
+int32_t xvbm_buffer_pool_stats_get(XvbmPoolHandle  p_handle,
+                                   XvbmPoolStats  *stats);
+
+/**
+ * Reset the statistics counters of a buffer pool
+ *
+ * The high-water mark restarts from the current number of buffers in use
+ *
+ * @param [in] p_handle   Handle to a memory pool
+*/
+void xvbm_buffer_pool_stats_reset(XvbmPoolHandle p_handle);
+
+/**
+ * Get the transfer statistics of a buffer pool for one direction
+ *
+ * Transfers on views are accounted to the pool of the parent buffer
+ *
+ * @param [in]  p_handle   Handle to a memory pool
+ * @param [in]  dir        Transfer direction
+ * @param [out] stats      Receives the transfer statistics
+ *
+ * @returns 0 on success
+*/
+int32_t xvbm_buffer_pool_xfer_stats_get(XvbmPoolHandle  p_handle,
+                                        XvbmXferDir     dir,
+                                        XvbmXferStats  *stats);
+
+/**
+ * Get the allocation statistics of a buffer pool for one priority class
+ *
+ * Reset along with the pool statistics by xvbm_buffer_pool_stats_reset
+ *
+ * @param [in]  p_handle   Handle to a memory pool
+ * @param [in]  prio       Priority class
+ * @param [out] stats      Receives the class statistics
+ *
+ * @returns 0 on success
+*/
+int32_t xvbm_buffer_pool_prio_stats_get(XvbmPoolHandle  p_handle,
+                                        XvbmPriority    prio,
+                                        XvbmPrioStats  *stats);
+
+/**
+ * Print the statistics of all buffer pools of the process
+ *
+ * The dump can also be produced periodically by setting the environment
+ * variable XVBM_STATS_DUMP_MS to the interval in milliseconds before the
+ * first pool is created, or with xvbm_stats_dump_interval_set.
+*/
+void xvbm_stats_dump(void);
+
+/**
+ * Set the interval of the periodic statistics dump
+ *
+ * @param [in] interval_ms Interval in milliseconds, 0 stops the dump
+*/
+void xvbm_stats_dump_interval_set(uint32_t interval_ms);
+
+/**
+ * Publish live pool statistics in a shared memory segment
+ *
+ * The segment is named xvbm-stats-<pid> and is updated every interval_ms
+ * until the process exits; the xvbm-top tool reads it without stopping
+ * the process.  Publishing can also be enabled by setting the environment
+ * variable XVBM_SHM_STATS_MS to the interval before the first pool is
+ * created.
+ *
+ * @param [in] interval_ms Update interval in milliseconds, 0 stops publishing
+ *
+ * @returns 0 on success
+*/
+int32_t xvbm_shm_stats_enable(uint32_t interval_ms);
+
+/**
+ * Record allocation events of all pools to a binary trace file
+ *
+ * Pool creation, extension and destruction, buffer allocations, frees and
+ * reference increments are written with their time stamps.  The
+ * xvbm-alloc-sim tool replays the trace to find the smallest pool sizes
+ * that would have served it.  Recording also starts when the first pool is
+ * created if the environment variable XVBM_ALLOC_TRACE names the file, it
+ * stops at process exit.
+ *
+ * @param [in] path File to write
+ *
+ * @returns 0 on success
+*/
+int32_t xvbm_alloc_trace_start(const char *path);
+
+/**
+ * Stop recording allocation events and close the trace file
+*/
+void xvbm_alloc_trace_stop(void);
+
+/**
+ * Turn buffer lifecycle tracing on or off
+ *
+ * Allocations, frees, reference increments, writes and reads are recorded
+ * per thread and written by xvbm_trace_flush.  Tracing can also be enabled
+ * by setting the environment variable XVBM_TRACE to a file name, the trace
+ * is then written to that file when the process exits.  The environment
+ * variable XVBM_TRACE_EVENTS sets the number of events kept per thread
+ * between flushes, further events are dropped and counted.
+ *
+ * @param [in] enable true to record events
+*/
+void xvbm_trace_enable(bool enable);
+
+/**
+ * Write the recorded events as a Chrome trace JSON file
+ *
+ * The file can be loaded in chrome://tracing or ui.perfetto.dev.  Events
+ * written are removed from the per-thread buffers, so each flush contains
+ * the events since the previous one.
+ *
+ * @param [in] path File to write, NULL for the file named by XVBM_TRACE
+ *
+ * @returns 0 on success
+*/
+int32_t xvbm_trace_flush(const char *path);
+
+/**
+ * Set the most verbose level logged
+ *
+ * The default is XVBM_LOG_INFO, or the value of the environment variable
+ * XVBM_LOG_LEVEL (error, warning, info or debug).  Messages are queued
+ * without blocking and written by a background thread; each call site
+ * logs at most a few messages per second and reports how many it dropped.
+ *
+ * @param [in] level Most verbose level logged
+*/
+void xvbm_log_set_level(XvbmLogLevel level);
+
+/**
+ * Select where log messages are written
+ *
+ * The default is stderr, or syslog when the environment variable
+ * XVBM_LOG_SINK is set to syslog.
+ *
+ * @param [in] sink      Log destination
+ * @param [in] callback  Called for each message with XVBM_LOG_SINK_CALLBACK
+ * @param [in] user_data Passed to the callback
+ *
+ * @returns 0 on success, -1 if the callback sink is selected without a callback
+*/
+int32_t xvbm_log_set_sink(XvbmLogSink      sink,
+                          XvbmLogCallback  callback,
+                          void            *user_data);
+
+/**
+ * Write all queued log messages to the sink before returning
+*/
+void xvbm_log_flush(void);
+
 /****************************************************************************/
 /* Buffer related accessor functions                                        */
 /****************************************************************************/
@@ -159,6 +775,24 @@ uint32_t xvbm_buffer_get_id(XvbmBufferHandle b_handle);
 */
 size_t xvbm_buffer_get_size(XvbmBufferHandle b_handle);
 
+/**
+ * Get the line pitch of a view
+ *
+ * @param [in] b_handle   Handle to a buffer
+ *
+ * @returns the pitch given when creating the view, 0 for pool buffers
+*/
+size_t xvbm_buffer_get_pitch(XvbmBufferHandle b_handle);
+
+/**
+ * Get the offset of a view into its parent buffer
+ *
+ * @param [in] b_handle   Handle to a buffer
+ *
+ * @returns the offset of the view, 0 for pool buffers
+*/
+size_t xvbm_buffer_get_view_offset(XvbmBufferHandle b_handle);
+
 /**
  * Get the buffer physical address 
  *
@@ -168,6 +802,49 @@ size_t xvbm_buffer_get_size(XvbmBufferHandle b_handle);
 */
 uint64_t xvbm_buffer_get_paddr(XvbmBufferHandle b_handle);
 
+/**
+ * Get the DDR bank holding the buffer
+ *
+ * @param [in] b_handle   Handle to a buffer
+ *
+ * @returns the bank index reported by the device
+*/
+uint32_t xvbm_buffer_get_bank(XvbmBufferHandle b_handle);
+
+/**
+ * Get the user metadata slot of a buffer
+ *
+ * The slot is allocated with the buffer, cache line aligned, and sized by
+ * XvbmPoolAttr.meta_size rounded up to a cache line.  It reads as zeroes
+ * when the buffer is allocated: the final xvbm_buffer_pool_entry_free
+ * clears it.  Views share the slot of their buffer,
+ * xvbm_buffer_make_writable copies it to the new buffer.  Slots are not
+ * shared with other processes.
+ *
+ * @param [in] b_handle   Handle to a buffer
+ *
+ * @returns pointer to the slot, NULL if the pool has none
+*/
+void *xvbm_buffer_get_meta(XvbmBufferHandle b_handle);
+
+/**
+ * Get the size of the user metadata slot of a buffer
+ *
+ * @param [in] b_handle   Handle to a buffer
+ *
+ * @returns size in bytes, 0 if the pool has no slots
+*/
+uint32_t xvbm_buffer_get_meta_size(XvbmBufferHandle b_handle);
+
+/**
+ * Get the device holding the buffer
+ *
+ * @param [in] b_handle   Handle to a buffer
+ *
+ * @returns the device handle of the buffer's pool
+*/
+xclDeviceHandle xvbm_buffer_get_device(XvbmBufferHandle b_handle);
+
 /**
  * Get the buffer handle given a physical address 
  *
@@ -194,6 +871,29 @@ void xvbm_buffer_refcnt_inc(XvbmBufferHandle b_handle);
 */
 uint32_t xvbm_buffer_get_refcnt(XvbmBufferHandle b_handle);
 
+/**
+ * Get the device write generation of the buffer
+ *
+ * The generation changes whenever the device copy of the buffer may have
+ * been modified (writes, allocation to a new owner, invalidation)
+ *
+ * @param [in] b_handle   Handle to a buffer
+ *
+ * @returns the current generation of the buffer
+*/
+uint64_t xvbm_buffer_get_generation(XvbmBufferHandle b_handle);
+
+/**
+ * Mark the device copy of the buffer as modified
+ *
+ * Must be called after a device kernel wrote the buffer so that cached host
+ * copies are not served to subsequent readers
+ *
+ * @param [in] b_handle   Handle to a buffer
+ *
+*/
+void xvbm_buffer_invalidate(XvbmBufferHandle b_handle);
+
 XvbmPoolHandle xvbm_get_pool_handle(XvbmBufferHandle b_handle);
 XvbmBufferHandle xvbm_get_buffer_handle(XvbmPoolHandle p_handle,
 					uint32_t index);
@@ -241,6 +941,469 @@ int32_t xvbm_buffer_read(XvbmBufferHandle  b_handle,
                          void             *dst,
                          size_t            size,
                          size_t            offset);
+
+/**
+ * Copy data between two buffers without going through the caller
+ *
+ * Buffers on the same device are copied device side. Buffers on different
+ * devices (or devices without a copy engine) are copied through a
+ * pipelined host bounce buffer.  Both buffers may belong to different
+ * pools.
+ *
+ * @param [in] dst_handle Handle to the destination XVBM buffer
+ * @param [in] dst_offset Offset into the destination buffer
+ * @param [in] src_handle Handle to the source XVBM buffer
+ * @param [in] src_offset Offset into the source buffer
+ * @param [in] size       Size of data to be copied
+ *
+ * @returns 0 on success
+*/
+int32_t xvbm_buffer_copy(XvbmBufferHandle  dst_handle,
+                         size_t            dst_offset,
+                         XvbmBufferHandle  src_handle,
+                         size_t            src_offset,
+                         size_t            size);
+/****************************************************************************/
+/* Pool groups spanning several devices                                     */
+/****************************************************************************/
+
+/**
+ * Create one pool on each device and group them
+ *
+ * Buffers allocated from the group belong to the pool of the device they
+ * were placed on; they are freed, read and written as any other buffer.
+ *
+ * @param [in] d_handles   Devices, one pool is created on each
+ * @param [in] num_devices Number of devices
+ * @param [in] num_buffers Number of buffers of each pool
+ * @param [in] size        Size of each buffer
+ * @param [in] flags       Pool flags, as for xvbm_buffer_pool_create
+ *
+ * @returns XvbmPoolGroupHandle, NULL if any pool could not be created
+*/
+XvbmPoolGroupHandle xvbm_pool_group_create(xclDeviceHandle *d_handles,
+                                           uint32_t         num_devices,
+                                           int32_t          num_buffers,
+                                           size_t           size,
+                                           uint32_t         flags);
+
+/**
+ * Destroy a pool group
+ *
+ * Each pool is destroyed as with xvbm_buffer_pool_destroy, once its last
+ * buffer is freed.
+ *
+ * @param [in] g_handle   Handle to a pool group
+*/
+void xvbm_pool_group_destroy(XvbmPoolGroupHandle g_handle);
+
+/**
+ * Select how the group places allocations
+ *
+ * @param [in] g_handle   Handle to a pool group
+ * @param [in] policy     Placement policy
+ *
+ * @returns 0 on success, -1 for an unknown policy
+*/
+int32_t xvbm_pool_group_policy_set(XvbmPoolGroupHandle g_handle,
+                                   XvbmGroupPolicy     policy);
+
+/**
+ * Allocate a free buffer from one of the devices of a group
+ *
+ * @param [in] g_handle   Handle to a pool group
+ * @param [in] hint       Index of the preferred device, for example the one
+ *                        already holding related frames, or -1 to let the
+ *                        policy decide.  Other devices are used when it has
+ *                        no free buffer.
+ *
+ * @returns handle to the buffer, NULL when every pool is exhausted
+*/
+XvbmBufferHandle xvbm_pool_group_entry_alloc(XvbmPoolGroupHandle g_handle,
+                                             int32_t             hint);
+
+/**
+ * Get the number of devices of a group
+ *
+ * @param [in] g_handle   Handle to a pool group
+*/
+uint32_t xvbm_pool_group_num_devices(XvbmPoolGroupHandle g_handle);
+
+/**
+ * Get the pool of a group on one device
+ *
+ * @param [in] g_handle   Handle to a pool group
+ * @param [in] index      Index of the device in the array given at creation
+ *
+ * @returns the pool handle, NULL for an invalid index
+*/
+XvbmPoolHandle xvbm_pool_group_pool_get(XvbmPoolGroupHandle g_handle,
+                                        uint32_t            index);
+
+/****************************************************************************/
+/* Sharing pools between processes                                          */
+/****************************************************************************/
+
+/**
+ * Export a pool to another process
+ *
+ * Sends the device buffers and the pool state over a connected unix domain
+ * socket; the other process calls xvbm_buffer_pool_import on its end.  From
+ * then on allocations, frees and reference counts of the pool are shared
+ * by all processes it was exported to, and buffers of processes that exit
+ * without freeing them are reclaimed.  Exits are detected through file
+ * locks, which works across pid namespaces; without /proc the processes
+ * are probed by pid and must share a pid namespace.  Shared pools can not
+ * be extended and do not use the read cache.  A pool may be exported
+ * several times.
+ *
+ * @param [in] p_handle   Handle to a memory pool
+ * @param [in] sock       Connected AF_UNIX socket
+ *
+ * @returns 0 on success
+*/
+int32_t xvbm_buffer_pool_export(XvbmPoolHandle p_handle,
+                                int            sock);
+
+/**
+ * Import a pool exported by another process
+ *
+ * @param [in] d_handle   This process' handle of the device holding the pool
+ * @param [in] sock       Connected AF_UNIX socket the pool is sent over
+ *
+ * @returns handle to the pool, NULL on failure
+*/
+XvbmPoolHandle xvbm_buffer_pool_import(xclDeviceHandle d_handle,
+                                       int             sock);
+
+/**
+ * Pass a reference on a buffer of a shared pool to another process
+ *
+ * Takes an additional reference on behalf of the receiver and returns a
+ * token to send it along with the frame; the receiver turns it into a
+ * handle with xvbm_buffer_pool_accept.  The caller keeps its own
+ * reference.  Until accepted the reference belongs to the caller and is
+ * released if the caller's pool goes away.
+ *
+ * @param [in] b_handle   Handle to a buffer of a shared pool
+ *
+ * @returns the token, 0 on failure
+*/
+uint64_t xvbm_buffer_handoff(XvbmBufferHandle b_handle);
+
+/**
+ * Accept a reference passed with xvbm_buffer_handoff
+ *
+ * @param [in] p_handle   This process' handle of the shared pool
+ * @param [in] token      Token from xvbm_buffer_handoff
+ *
+ * @returns handle to the buffer, to be freed with
+ *          xvbm_buffer_pool_entry_free; NULL if the token is stale
+*/
+XvbmBufferHandle xvbm_buffer_pool_accept(XvbmPoolHandle p_handle,
+                                         uint64_t       token);
+
+/**
+ * Return buffers held by processes that no longer exist
+ *
+ * This also happens automatically when the shared free list runs empty.
+ *
+ * @param [in] p_handle   Handle to a shared pool
+ *
+ * @returns number of buffers freed, -1 if the pool is not shared
+*/
+int32_t xvbm_buffer_pool_reclaim(XvbmPoolHandle p_handle);
+
+/****************************************************************************/
+/* Buffer queues between pipeline stages                                    */
+/****************************************************************************/
+
+/**
+ * Create a bounded queue of buffer handles
+ *
+ * Push and pop do not take locks while the queue is neither full nor
+ * empty; threads only sleep, and are only signalled, when it is.  A push
+ * hands the caller's reference on the buffer to the queue and the pop
+ * returning it hands it to the consumer, who frees it with
+ * xvbm_buffer_pool_entry_free.  Together with
+ * xvbm_buffer_pool_entry_alloc_wait this gives back-pressure across a
+ * pipeline: a full queue blocks its producer, which then holds its
+ * buffers, until the stage behind it catches up.
+ *
+ * @param [in] type       XVBM_QUEUE_SPSC or XVBM_QUEUE_MPMC
+ * @param [in] capacity   Number of handles, rounded up to a power of two
+ *
+ * @returns handle to the queue, NULL on failure
+*/
+XvbmQueueHandle xvbm_queue_create(XvbmQueueType type,
+                                  uint32_t      capacity);
+
+/**
+ * Destroy a queue, buffers still queued are freed
+ *
+ * No thread may use the queue anymore.
+ *
+ * @param [in] q_handle   Handle to a queue
+*/
+void xvbm_queue_destroy(XvbmQueueHandle q_handle);
+
+/**
+ * Append a buffer to a queue
+ *
+ * @param [in] q_handle   Handle to a queue
+ * @param [in] b_handle   Buffer, the caller's reference moves to the queue
+ * @param [in] timeout_ms Time to wait while the queue is full, 0 does not
+ *                        wait, XVBM_WAIT_FOREVER waits until there is room
+ *
+ * @returns 0 on success, -1 if the queue stayed full or is closed; the
+ *          caller then keeps its reference
+*/
+int32_t xvbm_queue_push(XvbmQueueHandle  q_handle,
+                        XvbmBufferHandle b_handle,
+                        uint32_t         timeout_ms);
+
+/**
+ * Take the oldest buffer from a queue
+ *
+ * @param [in] q_handle   Handle to a queue
+ * @param [in] timeout_ms Time to wait while the queue is empty, 0 does not
+ *                        wait, XVBM_WAIT_FOREVER waits until a buffer
+ *                        arrives
+ *
+ * @returns the buffer with the reference pushed along with it, NULL if the
+ *          queue stayed empty or is closed and drained
+*/
+XvbmBufferHandle xvbm_queue_pop(XvbmQueueHandle q_handle,
+                                uint32_t        timeout_ms);
+
+/**
+ * Close a queue at the end of a stream
+ *
+ * Further pushes fail, pops return what is queued and then NULL without
+ * waiting.  Threads waiting on the queue return.
+ *
+ * @param [in] q_handle   Handle to a queue
+*/
+void xvbm_queue_close(XvbmQueueHandle q_handle);
+
+/**
+ * Get the number of buffers in a queue
+ *
+ * @param [in] q_handle   Handle to a queue
+ *
+ * @returns number of buffers, a snapshot when other threads use the queue
+*/
+uint32_t xvbm_queue_size(XvbmQueueHandle q_handle);
+
+/****************************************************************************/
+/* Pool cache                                                               */
+/****************************************************************************/
+
+/**
+ * Configure the cache of dormant pools
+ *
+ * With the cache enabled, destroying a pool keeps its buffers allocated and
+ * the next xvbm_buffer_pool_create with the same device, buffer count, size
+ * and flags returns it instead of allocating and clearing new buffers.
+ * Buffers of such a pool keep the contents left by its previous owner.
+ * Dormant pools are freed oldest first once they exceed max_bytes of
+ * device memory in total, or once they stayed unused for max_age_ms.
+ * Shared pools are never cached.  The cache is disabled by default; the
+ * XVBM_POOL_CACHE_MB and XVBM_POOL_CACHE_AGE_MS environment variables
+ * configure it at startup.
+ *
+ * @param [in] max_bytes  Device memory dormant pools may hold, 0 disables
+ *                        the cache and frees all dormant pools
+ * @param [in] max_age_ms Time a pool stays dormant, 0 for no limit
+ *
+ * @returns 0 on success
+*/
+int32_t xvbm_pool_cache_config(uint64_t max_bytes,
+                               uint32_t max_age_ms);
+
+/**
+ * Free the dormant pools of a device
+ *
+ * Also waits for pools of the device queued on the reclaim thread.  Must be
+ * called before the device is closed with xclClose;
+ * xvbm_emu_device_close does this itself.
+ *
+ * @param [in] d_handle   Device handle, NULL for all devices
+*/
+void xvbm_pool_cache_flush(xclDeviceHandle d_handle);
+
+/**
+ * Read the pool cache counters
+ *
+ * @param [out] stats     Counters to fill
+ *
+ * @returns 0 on success
+*/
+int32_t xvbm_pool_cache_stats_get(XvbmPoolCacheStats *stats);
+
+/****************************************************************************/
+/* Deferred pool teardown                                                   */
+/****************************************************************************/
+
+/**
+ * Free pools on a background thread
+ *
+ * When enabled, the thread dropping the last reference on a pool, in
+ * xvbm_buffer_pool_destroy or xvbm_buffer_pool_entry_free, queues the pool
+ * instead of freeing its device buffers and host shadows itself.  While the
+ * queued pools hold max_pending_bytes of device memory, further pools are
+ * freed by the caller again.  Disabled by default; XVBM_RECLAIM_MB enables
+ * it at startup.  Device memory of queued pools stays charged to the
+ * device budgets until it is freed.
+ *
+ * @param [in] max_pending_bytes Cap on device memory of queued pools,
+ *                               0 frees pools synchronously again after
+ *                               the queue drained
+ *
+ * @returns 0 on success
+*/
+int32_t xvbm_reclaim_config(uint64_t max_pending_bytes);
+
+/**
+ * Wait until queued pools are freed
+ *
+ * @param [in] d_handle   Wait for pools of this device, NULL for all
+ * @param [in] timeout_ms Time to wait, 0 does not wait, XVBM_WAIT_FOREVER
+ *                        waits until they are freed
+ *
+ * @returns 0 once freed, -1 on timeout
+*/
+int32_t xvbm_reclaim_wait(xclDeviceHandle d_handle,
+                          uint32_t        timeout_ms);
+
+/**
+ * Read the reclaim thread counters
+ *
+ * @param [out] stats     Counters to fill
+ *
+ * @returns 0 on success
+*/
+int32_t xvbm_reclaim_stats_get(XvbmReclaimStats *stats);
+
+/****************************************************************************/
+/* Device memory budgets                                                    */
+/****************************************************************************/
+
+/*
+ * Pools are charged to their tenant on the device and on each bank their
+ * buffers occupy.  Creating or extending a pool is admitted only if, in
+ * every budgeted scope it touches, the usage of all tenants (counting
+ * each tenant's reservation in full even if unused) stays within the
+ * budget.  Refused calls allocate nothing and fail with
+ * XVBM_STATUS_OVER_BUDGET.  If freeing the dormant pools of the device,
+ * and waiting for the ones queued for freeing, makes enough room, that is
+ * done first.  Pools imported from other processes are not charged.
+ */
+
+/**
+ * Set the memory budget of a device or of one of its banks
+ *
+ * A budget below the current usage only affects later admissions.
+ *
+ * @param [in] d_handle   Device handle
+ * @param [in] bank       DDR bank, or XVBM_BUDGET_DEVICE for the device
+ * @param [in] bytes      Budget, 0 to remove it
+ *
+ * @returns 0 on success
+*/
+int32_t xvbm_device_budget_set(xclDeviceHandle d_handle,
+                               int32_t         bank,
+                               uint64_t        bytes);
+
+/**
+ * Reserve memory of a device or bank for a tenant
+ *
+ * Other tenants can not be admitted into a reservation; the tenant's own
+ * pools use it first.
+ *
+ * @param [in] d_handle   Device handle
+ * @param [in] tenant     Tenant the memory is reserved for
+ * @param [in] bank       DDR bank, or XVBM_BUDGET_DEVICE for the device
+ * @param [in] bytes      Reservation, 0 to release it
+ *
+ * @returns 0 on success, -1 if the reservation does not fit the budget
+*/
+int32_t xvbm_device_reserve(xclDeviceHandle d_handle,
+                            uint32_t        tenant,
+                            int32_t         bank,
+                            uint64_t        bytes);
+
+/**
+ * Get the memory a tenant can still be admitted for
+ *
+ * For a bank this also accounts for the device budget.
+ *
+ * @param [in]  d_handle  Device handle
+ * @param [in]  tenant    Tenant
+ * @param [in]  bank      DDR bank, or XVBM_BUDGET_DEVICE for the device
+ * @param [out] bytes     Headroom, UINT64_MAX when no budget applies
+ *
+ * @returns 0 on success
+*/
+int32_t xvbm_device_headroom_get(xclDeviceHandle  d_handle,
+                                 uint32_t         tenant,
+                                 int32_t          bank,
+                                 uint64_t        *bytes);
+
+/**
+ * Check whether a pool would be admitted without creating it
+ *
+ * Memory held by dormant pools and pools queued for freeing counts as
+ * free; nothing is freed.
+ *
+ * @param [in] d_handle   Device handle
+ * @param [in] num_buffer Number of device buffers
+ * @param [in] size       Size of each buffer
+ * @param [in] flags      Flags as for xvbm_buffer_pool_create
+ * @param [in] attr       Attributes, NULL for the defaults
+ *
+ * @returns XVBM_STATUS_OK if the pool fits
+*/
+XvbmStatus xvbm_buffer_pool_admit(xclDeviceHandle     d_handle,
+                                  int32_t             num_buffers,
+                                  size_t              size,
+                                  uint32_t            flags,
+                                  const XvbmPoolAttr *attr);
+
+/****************************************************************************/
+/* Emulated device                                                          */
+/****************************************************************************/
+
+/**
+ * Fill an emulated device configuration with defaults resembling one U30
+ * device: two 2GB banks, 6GB/s each way over PCIe
+ *
+ * @param [out] cfg Configuration to fill
+*/
+void xvbm_emu_config_init(XvbmEmuConfig *cfg);
+
+/**
+ * Open an emulated device
+ *
+ * The device keeps its buffers in host memory and models transfer time and
+ * bank capacity, so pools can be sized and load tested without a card.
+ * The returned handle is accepted by xvbm_buffer_pool_create in place of a
+ * handle from xclOpen.
+ *
+ * @param [in] cfg Device model, NULL for the defaults of xvbm_emu_config_init
+ *
+ * @returns device handle, NULL on failure
+*/
+xclDeviceHandle xvbm_emu_device_open(const XvbmEmuConfig *cfg);
+
+/**
+ * Close an emulated device, all pools on it must be destroyed first;
+ * dormant pools and budgets of the device are dropped
+ *
+ * @param [in] d_handle Handle returned by xvbm_emu_device_open
+*/
+void xvbm_emu_device_close(xclDeviceHandle d_handle);
+
 #ifdef __cplusplus
 }
 #endif
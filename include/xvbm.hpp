@@ -0,0 +1,337 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later OR Apache-2.0 */
+
+/*
+ * Copyright (C) 2019-2021 Xilinx Inc - All rights reserved
+ * Xilinx Video Buffer Manager (Xvbm)
+ *
+ * This file is dual-licensed; you may select either the GNU
+ * Lesser General Public License version 3 or
+ * Apache License, Version 2.0.
+ *
+ */
+
+#ifndef _XVBM_HPP_
+#define _XVBM_HPP_
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include "xvbm.h"
+
+/****************************************************************************/
+/* C++ owners of pool, buffer and queue handles                             */
+/****************************************************************************/
+
+/*
+ * Each object owns exactly one reference on its handle and drops it when
+ * destroyed.  The types are move-only: a move hands the reference over
+ * without touching the reference count or the pool lock, and a second
+ * reference is only taken when asked for with BufferRef::share().
+ */
+namespace xvbm {
+
+namespace detail {
+
+// Matches contiguous containers and spans (anything with data() and size())
+template <typename C>
+using data_t = decltype(std::declval<C&>().data() + std::declval<C&>().size());
+
+} // namespace detail
+
+class BufferRef
+{
+public:
+    BufferRef() noexcept {}
+
+    /**
+     * Adopt a reference the caller owns, e.g. one returned by
+     * xvbm_buffer_pool_entry_alloc or xvbm_queue_pop
+    */
+    explicit BufferRef(XvbmBufferHandle b_handle) noexcept : m_handle(b_handle) {}
+
+    BufferRef(BufferRef &&other) noexcept : m_handle(other.release()) {}
+
+    BufferRef& operator=(BufferRef &&other) noexcept
+    {
+        if (this != &other)
+            reset(other.release());
+        return *this;
+    }
+
+    BufferRef(const BufferRef&) = delete;
+    BufferRef& operator=(const BufferRef&) = delete;
+
+    ~BufferRef() { reset(); }
+
+    /**
+     * Take another reference on the buffer
+     *
+     * @returns an owner of the new reference, empty if this one is empty
+    */
+    BufferRef share() const noexcept
+    {
+        if (m_handle)
+            xvbm_buffer_refcnt_inc(m_handle);
+        return BufferRef(m_handle);
+    }
+
+    /**
+     * Give up ownership without freeing
+     *
+     * @returns the handle, the caller now owns its reference
+    */
+    XvbmBufferHandle release() noexcept
+    {
+        XvbmBufferHandle b_handle = m_handle;
+        m_handle = nullptr;
+        return b_handle;
+    }
+
+    /**
+     * Free the owned reference, if any, and adopt b_handle
+    */
+    void reset(XvbmBufferHandle b_handle = nullptr) noexcept
+    {
+        if (m_handle)
+            xvbm_buffer_pool_entry_free(m_handle);
+        m_handle = b_handle;
+    }
+
+    XvbmBufferHandle get() const noexcept { return m_handle; }
+    explicit operator bool() const noexcept { return m_handle != nullptr; }
+
+    uint32_t id() const { return xvbm_buffer_get_id(m_handle); }
+    size_t size() const { return xvbm_buffer_get_size(m_handle); }
+    uint64_t paddr() const { return xvbm_buffer_get_paddr(m_handle); }
+    uint32_t bank() const { return xvbm_buffer_get_bank(m_handle); }
+    uint32_t refcnt() const { return xvbm_buffer_get_refcnt(m_handle); }
+    void *host_ptr() const { return xvbm_buffer_get_host_ptr(m_handle); }
+
+    /**
+     * Get the user metadata slot as a T, NULL if the pool has none or the
+     * slot is too small
+    */
+    template <typename T>
+    T *meta() const
+    {
+        if (xvbm_buffer_get_meta_size(m_handle) < sizeof(T))
+            return nullptr;
+        return static_cast<T*>(xvbm_buffer_get_meta(m_handle));
+    }
+
+    int32_t write(const void *src, size_t size, size_t offset = 0) const
+    {
+        return xvbm_buffer_write(m_handle, src, size, offset);
+    }
+
+    int32_t read(void *dst, size_t size, size_t offset = 0) const
+    {
+        return xvbm_buffer_read(m_handle, dst, size, offset);
+    }
+
+    /**
+     * Write or read a whole span, vector, array or string
+    */
+    template <typename C, typename = detail::data_t<const C>>
+    int32_t write(const C &src, size_t offset = 0) const
+    {
+        return write(src.data(), src.size() * sizeof(*src.data()), offset);
+    }
+
+    template <typename C, typename = detail::data_t<C>>
+    int32_t read(C &&dst, size_t offset = 0) const
+    {
+        return read(dst.data(), dst.size() * sizeof(*dst.data()), offset);
+    }
+
+    /**
+     * Create a view on a region of the buffer
+     *
+     * @returns an owner of the view, empty if the region is invalid
+    */
+    BufferRef view(size_t offset, size_t size, size_t pitch = 0) const
+    {
+        return BufferRef(xvbm_buffer_view_create(m_handle, offset, size, pitch));
+    }
+
+    /**
+     * Make the owned buffer safe to modify, see xvbm_buffer_make_writable
+     *
+     * @returns true if this now owns a writable buffer, false if it still
+     *          owns the shared one
+    */
+    bool make_writable()
+    {
+        XvbmBufferHandle b_handle = xvbm_buffer_make_writable(m_handle);
+
+        if (b_handle == nullptr)
+            return false;
+        m_handle = b_handle;
+        return true;
+    }
+
+private:
+    XvbmBufferHandle m_handle = nullptr;
+};
+
+class Pool
+{
+public:
+    Pool() noexcept {}
+
+    /**
+     * Adopt a pool handle the caller would otherwise destroy
+    */
+    explicit Pool(XvbmPoolHandle p_handle) noexcept : m_handle(p_handle) {}
+
+    /**
+     * Create a pool, see xvbm_buffer_pool_create_ex
+     *
+     * @returns the pool, empty on failure with the reason in
+     *          xvbm_last_status
+    */
+    static Pool create(xclDeviceHandle     d_handle,
+                       int32_t             num_buffers,
+                       size_t              size,
+                       uint32_t            flags = 0,
+                       const XvbmPoolAttr *attr = nullptr)
+    {
+        return Pool(xvbm_buffer_pool_create_ex(d_handle, num_buffers, size, flags, attr));
+    }
+
+    Pool(Pool &&other) noexcept : m_handle(other.release()) {}
+
+    Pool& operator=(Pool &&other) noexcept
+    {
+        if (this != &other)
+            reset(other.release());
+        return *this;
+    }
+
+    Pool(const Pool&) = delete;
+    Pool& operator=(const Pool&) = delete;
+
+    // Buffers still owned elsewhere keep the pool alive until they are freed
+    ~Pool() { reset(); }
+
+    XvbmPoolHandle release() noexcept
+    {
+        XvbmPoolHandle p_handle = m_handle;
+        m_handle = nullptr;
+        return p_handle;
+    }
+
+    void reset(XvbmPoolHandle p_handle = nullptr) noexcept
+    {
+        if (m_handle)
+            xvbm_buffer_pool_destroy(m_handle);
+        m_handle = p_handle;
+    }
+
+    XvbmPoolHandle get() const noexcept { return m_handle; }
+    explicit operator bool() const noexcept { return m_handle != nullptr; }
+
+    /**
+     * @returns a buffer free to the priority class, empty if there is none
+    */
+    BufferRef alloc(XvbmPriority prio = XVBM_PRIO_NORMAL) const
+    {
+        return BufferRef(xvbm_buffer_pool_entry_alloc_prio(m_handle, prio));
+    }
+
+    /**
+     * @returns a buffer free to the priority class, empty if none was
+     *          freed within timeout_ms
+    */
+    BufferRef alloc_wait(uint32_t     timeout_ms = XVBM_WAIT_FOREVER,
+                         XvbmPriority prio = XVBM_PRIO_NORMAL) const
+    {
+        return BufferRef(xvbm_buffer_pool_entry_alloc_prio_wait(m_handle, prio, timeout_ms));
+    }
+
+    /**
+     * Take a reference on the buffer at a device address
+     *
+     * xvbm_buffer_get_handle only looks the buffer up, the reference is
+     * taken here.  Another owner must keep holding the buffer until find
+     * returns.
+     *
+     * @returns the buffer at paddr with a new reference, empty if the pool
+     *          has none there or it is free
+    */
+    BufferRef find(uint64_t paddr) const
+    {
+        XvbmBufferHandle b_handle = xvbm_buffer_get_handle(m_handle, paddr);
+
+        if (b_handle == nullptr || xvbm_buffer_get_refcnt(b_handle) == 0)
+            return BufferRef();
+        xvbm_buffer_refcnt_inc(b_handle);
+        return BufferRef(b_handle);
+    }
+
+private:
+    XvbmPoolHandle m_handle = nullptr;
+};
+
+class Queue
+{
+public:
+    Queue() noexcept {}
+
+    explicit Queue(XvbmQueueType type, uint32_t capacity)
+        : m_handle(xvbm_queue_create(type, capacity)) {}
+
+    Queue(Queue &&other) noexcept : m_handle(other.m_handle) { other.m_handle = nullptr; }
+
+    Queue& operator=(Queue &&other) noexcept
+    {
+        if (this != &other) {
+            xvbm_queue_destroy(m_handle);
+            m_handle = other.m_handle;
+            other.m_handle = nullptr;
+        }
+        return *this;
+    }
+
+    Queue(const Queue&) = delete;
+    Queue& operator=(const Queue&) = delete;
+
+    // No thread may use the queue anymore, queued buffers are freed
+    ~Queue() { xvbm_queue_destroy(m_handle); }
+
+    XvbmQueueHandle get() const noexcept { return m_handle; }
+    explicit operator bool() const noexcept { return m_handle != nullptr; }
+
+    /**
+     * Hand a buffer to the queue
+     *
+     * @returns true if queued, buffer is then empty; false if the queue
+     *          stayed full or is closed, buffer then still owns it
+    */
+    bool push(BufferRef &&buffer, uint32_t timeout_ms = XVBM_WAIT_FOREVER)
+    {
+        if (!buffer || xvbm_queue_push(m_handle, buffer.get(), timeout_ms) != 0)
+            return false;
+        buffer.release();
+        return true;
+    }
+
+    /**
+     * @returns the oldest buffer, empty if the queue stayed empty or is
+     *          closed and drained
+    */
+    BufferRef pop(uint32_t timeout_ms = XVBM_WAIT_FOREVER)
+    {
+        return BufferRef(xvbm_queue_pop(m_handle, timeout_ms));
+    }
+
+    void close() { xvbm_queue_close(m_handle); }
+    uint32_t size() const { return xvbm_queue_size(m_handle); }
+
+private:
+    XvbmQueueHandle m_handle = nullptr;
+};
+
+} // namespace xvbm
+
+#endif
@@ -13,12 +13,21 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include "xvbm.h"
 #include "xvbm_private.h"
+#include "xvbm_trace.h"
+#include "xvbm_log.h"
+#include "xvbm_alloc_trace.h"
+#include "xvbm_numa.h"
+#include "xvbm_share.h"
 
 #define ALIGN_4K        4096
-
-//@TODO use syslog or xmalog for logging
+#define COPY_CHUNK_SIZE (2 * 1024 * 1024)
+#define STAGING_CACHE_MAX (16 * 1024 * 1024)
 
 //////////////////////////////////////////////////////////////////////////////
 // Class method for creating a buffer
@@ -26,37 +35,71 @@
 //@TODO handle out of memory
 XvbmBuffer* XvbmBufferPool::create_buffer(int32_t index)
 {
-    void *host_ptr = nullptr;
     uint32_t bo_handle;
-    int rc = -1;
+
+    uint32_t bank = bank_for(index);
+    bo_handle = m_backend->alloc_bo(m_dev_handle, m_size, bank | XCL_BO_FLAGS_DEV_ONLY);
+    if (bo_handle == NULLBO) {
+        XVBM_ERROR("xclAllocBO failed on bank %u", bank);
+        throw std::bad_alloc();
+    }
+
+    XvbmBuffer *buffer = add_buffer(index, bo_handle, true);
+    if (buffer->m_bank != bank)
+        XVBM_WARNING("buffer #%d requested on bank %u was placed on bank %u",
+                     index, bank, buffer->m_bank);
+
+    return buffer;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Allocation of a buffer with a cleared metadata slot of meta_size bytes
+//////////////////////////////////////////////////////////////////////////////
+void* XvbmBuffer::operator new(size_t size, uint32_t meta_size)
+{
+    void *ptr;
+
+    if (posix_memalign(&ptr, XVBM_META_ALIGN, std::max(size, meta_offset()) + meta_size))
+        throw std::bad_alloc();
+    memset((char*)ptr + meta_offset(), 0, meta_size);
+    return ptr;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Class method for adding a device buffer to the pool, cleared unless its
+// content belongs to another process
+//////////////////////////////////////////////////////////////////////////////
+XvbmBuffer* XvbmBufferPool::add_buffer(int32_t  index,
+                                       uint32_t bo_handle,
+                                       bool     clear)
+{
+    void *host_ptr = nullptr;
 
     //allocate host buffer (4K aligned)
     /*@TODO Do not allocate host buffer when not required.
-        'flags' argument for 'DDR bank to allocate buffer' is not being used.
-        Maybe that can be re-used to specify type of buffers like
-        Device-only, Host+device etc.
         Host buffer is required in cases where:
         1. Padding needs to be done on the host side before sending
            the buffer to the device side.
         2. The user provided host buffer is not aligned at 4K
     */
     if(posix_memalign(&host_ptr, ALIGN_4K, m_size)) {
-        std::cout << "xvbm : aligned alloc failed" << std::endl;
+        XVBM_ERROR("aligned alloc failed");
+        m_backend->free_bo(m_dev_handle, bo_handle);
         throw std::bad_alloc();
     }
+    // Place the shadow next to the device before it is first touched
+    if (m_numa_node >= 0)
+        xvbm_numa_bind(host_ptr, m_size, m_numa_node);
     memset(host_ptr, 0, m_size);
 
-    bo_handle = xclAllocBO(m_dev_handle, m_size, 0, XCL_BO_FLAGS_DEV_ONLY);
-    if (bo_handle == NULLBO) {
-        std::cerr << "xvbm : xclAllocBO failed" << std::endl;
-        throw std::bad_alloc();
-    }
-
-    uint64_t paddr = xclGetDeviceAddr(m_dev_handle, bo_handle);
-    XvbmBuffer *buffer = new XvbmBuffer(this, bo_handle, index, m_size, paddr, host_ptr);
+    uint64_t paddr = m_backend->get_device_addr(m_dev_handle, bo_handle);
+    XvbmBuffer *buffer = new (m_meta_size) XvbmBuffer(this, bo_handle, index, m_size, paddr, host_ptr);
     assert(buffer != nullptr);
+    buffer->m_bank = m_backend->get_bank(m_dev_handle, bo_handle);
+    m_num_banks = std::max(m_num_banks, buffer->m_bank + 1);
 
-    if (buffer->write_buffer(host_ptr, m_size, 0)) {
+    if (clear && buffer->write_buffer(host_ptr, m_size, 0)) {
+        m_backend->free_bo(m_dev_handle, bo_handle);
         delete buffer;
         free(host_ptr);
         throw std::bad_alloc();
@@ -65,10 +108,51 @@ XvbmBuffer* XvbmBufferPool::create_buffer(int32_t index)
     m_alloc_vector.push_back(buffer);
     m_paddr_map.insert(std::pair<uint64_t, XvbmBuffer*>(paddr, buffer));
     m_free_list.push_back(buffer);
+    free_notify_l();
 
     return buffer;
 }
 
+//////////////////////////////////////////////////////////////////////////////
+// Class method charging buffers [first, first + count) to the pool's tenant
+//////////////////////////////////////////////////////////////////////////////
+XvbmStatus XvbmBufferPool::admit(int32_t first, int32_t count)
+{
+    XvbmBankBytes bytes;
+
+    xvbm_bank_bytes(m_flags, m_size, first, count, bytes);
+    XvbmStatus status = xvbm_budget_admit(m_dev_handle, m_tenant, bytes, false);
+    if (status == XVBM_STATUS_OK) {
+        for (auto &b : bytes)
+            m_charged[b.first] += b.second;
+    }
+    return status;
+}
+
+void XvbmBufferPool::uncharge(int32_t first, int32_t count)
+{
+    XvbmBankBytes bytes;
+
+    xvbm_bank_bytes(m_flags, m_size, first, count, bytes);
+    xvbm_budget_release(m_dev_handle, m_tenant, bytes);
+    for (auto &b : bytes)
+        m_charged[b.first] -= b.second;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Class method counting transfers issued away from the device's node
+//////////////////////////////////////////////////////////////////////////////
+void XvbmBufferPool::numa_check(XvbmXferDir dir)
+{
+    if (m_numa_node < 0)
+        return;
+    int32_t node = xvbm_numa_current_node();
+    if (node >= 0 && node != m_numa_node &&
+        m_xfer[dir].m_remote.fetch_add(1, std::memory_order_relaxed) == 0)
+        XVBM_WARNING("pool %p: transfer from node %d, the device is on node %d",
+                     this, node, m_numa_node);
+}
+
 //////////////////////////////////////////////////////////////////////////////
 // Class method for creating the buffer pool
 //////////////////////////////////////////////////////////////////////////////
@@ -77,13 +161,16 @@ void XvbmBufferPool::create()
 {
     int32_t i;
 
-    std::lock_guard<std::mutex> guard(m_lock);
+    XvbmPoolGuard guard(this);
+
+    if (xvbm_numa_num_nodes() > 1)
+        m_numa_node = m_backend->get_numa_node(m_dev_handle);
 
     for (i = 0; i < m_num_buffers; i++) {
         try {
             create_buffer(i);
         } catch (const std::bad_alloc&) {
-            std::cerr <<  "buffer #" << i << "failed" << std::endl;
+            XVBM_ERROR("buffer #%d failed", i);
             throw std::bad_alloc();
         }
     }
@@ -91,30 +178,69 @@ void XvbmBufferPool::create()
 
 bool XvbmBufferPool::destroy_l()
 {
-    bool des = false;
     m_ref_cnt--;
-    if (m_ref_cnt == 0) {
-        assert(m_inuse_list.size() == 0);
-        assert(m_free_list.size() == m_alloc_vector.size());
-        if ((m_inuse_list.size() != 0) || (m_free_list.size() != m_alloc_vector.size())) {
-            std::cerr << "Error : Something went wrong, Pool: " << this << " may leak" << std::endl;
-            std::cerr << this << " : free buffers : " << m_free_list.size() << std::endl;
-            std::cerr << this << " : Allocated buffers : " << m_alloc_vector.size() << std::endl;
-            std::cerr << this << " : In Use buffers : " << m_inuse_list.size() << std::endl;
-            return false;
-        }
-        for (auto buf : m_free_list) {
-            xclFreeBO(m_dev_handle, buf->m_bo_handle);
-            if (buf->m_hptr) {
-                free(buf->m_hptr);
-                buf->m_hptr = nullptr;
-            }
-            delete buf;
+    if (m_ref_cnt != 0)
+        return false;
+    assert(m_inuse_list.size() == 0);
+    assert(m_free_list.size() == m_alloc_vector.size());
+    if ((m_inuse_list.size() != 0) || (m_free_list.size() != m_alloc_vector.size())) {
+        XVBM_ERROR("Something went wrong, Pool: %p may leak, free buffers : %zu, "
+                   "Allocated buffers : %zu, In Use buffers : %zu", this,
+                   m_free_list.size(), m_alloc_vector.size(), m_inuse_list.size());
+        return false;
+    }
+    return true;
+}
+
+// Frees the device and host memory of a pool no longer referenced
+void XvbmBufferPool::teardown()
+{
+    delete m_share;
+    m_share = nullptr;
+    for (auto buf : m_free_list) {
+        m_backend->free_bo(m_dev_handle, buf->m_bo_handle);
+        if (buf->m_hptr) {
+            free(buf->m_hptr);
+            buf->m_hptr = nullptr;
         }
-        m_free_list.clear();
-        des = true;
+        delete buf;
     }
-    return des;
+    m_free_list.clear();
+    xvbm_budget_release(m_dev_handle, m_tenant, m_charged);
+    m_charged.clear();
+}
+
+// Called once the last reference is gone, the pool either goes dormant in
+// the pool cache or is freed, possibly by the reclaim thread
+void XvbmBufferPool::retire()
+{
+    if (xvbm_pool_cache_put(this))
+        return;
+    xvbm_pool_free(this);
+}
+
+// Prepares a dormant pool for a new owner, buffers keep their contents
+void XvbmBufferPool::revive()
+{
+    m_ref_cnt = 1;
+    m_offsets.clear();
+    m_read_cache = false;
+    m_reuse = XVBM_REUSE_FIFO;
+    m_next_bank = 0;
+    for (auto buf : m_alloc_vector) {
+        buf->m_touched = false;
+        buf->m_hptr_exported = false;
+    }
+    m_stats.reset();
+    m_stats.m_touched = 0;
+    for (auto &xfer : m_xfer)
+        xfer.reset();
+    for (int32_t c = 0; c < XVBM_PRIO_CLASSES; c++) {
+        m_prio_reserved[c] = 0;
+        m_prio_max[c] = 0;
+        m_prio[c].reset();
+    }
+    xvbm_pool_register(this);
 }
 
 //@TODO return status
@@ -122,11 +248,11 @@ void XvbmBufferPool::destroy()
 {
     bool des = false;
     {
-        std::lock_guard<std::mutex> guard(m_lock);
+        XvbmPoolGuard guard(this);
         des = destroy_l();
     }
     if (des) {
-        delete this;
+        retire();
     }
 }
 //////////////////////////////////////////////////////////////////////////////
@@ -136,44 +262,273 @@ int32_t XvbmBufferPool::extend(int32_t num_buffers)
 {
     int32_t i;
 
-    std::lock_guard<std::mutex> guard(m_lock);
+    // Admission may flush the pool cache and wait for the reclaim thread,
+    // so it runs before the pool lock is taken. Only extend changes
+    // m_num_buffers and m_charged, m_extend_lock keeps them stable.
+    std::lock_guard<std::mutex> extending(m_extend_lock);
+    {
+        XvbmPoolGuard guard(this);
+        if (m_share) {
+            XVBM_ERROR("a pool shared with other processes can not be extended");
+            xvbm_status_set(XVBM_STATUS_INVALID);
+            return m_num_buffers;
+        }
+    }
+    XvbmStatus status = admit(m_num_buffers, num_buffers);
+    if (status != XVBM_STATUS_OK) {
+        XVBM_ERROR("extending pool %p by %d buffers exceeds the budget of device %p",
+                   this, num_buffers, m_dev_handle);
+        xvbm_status_set(status);
+        return 0;
+    }
 
+    XvbmPoolGuard guard(this);
+    if (m_share) {
+        // Exported while the budget was checked
+        XVBM_ERROR("a pool shared with other processes can not be extended");
+        uncharge(m_num_buffers, num_buffers);
+        xvbm_status_set(XVBM_STATUS_INVALID);
+        return m_num_buffers;
+    }
     for (i = m_num_buffers; i < m_num_buffers+num_buffers; i++) {
         try {
             create_buffer(i);
         } catch (const std::bad_alloc&) {
-            std::cerr <<  i << "th buffer allocation failed during extension" << std::endl;
+            XVBM_ERROR("%dth buffer allocation failed during extension", i);
+            uncharge(i, m_num_buffers + num_buffers - i);
             throw std::bad_alloc();
         }
     }
 
     m_num_buffers += num_buffers;
+    m_stats.m_extends.fetch_add(1, std::memory_order_relaxed);
+    XVBM_ALLOC_TRACE(XVBM_ATRACE_POOL_EXTEND, this, m_num_buffers, 0, num_buffers);
+    xvbm_status_set(XVBM_STATUS_OK);
 
     return m_num_buffers;
 }
 
+//////////////////////////////////////////////////////////////////////////////
+// Class method telling whether a free buffer may go to a priority class,
+// called with the pool lock held. The higher classes keep the part of
+// their reservation they have not taken yet. In a shared pool the local
+// free list also holds the buffers of other processes, the shared free
+// ring counts instead.
+//////////////////////////////////////////////////////////////////////////////
+bool XvbmBufferPool::prio_admits_l(XvbmPriority prio)
+{
+    uint32_t held = m_prio[prio].m_inuse.load(std::memory_order_relaxed);
+    size_t kept = 0;
+    size_t free;
+
+    if (m_prio_max[prio] && held >= m_prio_max[prio])
+        return false;
+    for (int32_t c = 0; c < prio; c++) {
+        uint32_t inuse = m_prio[c].m_inuse.load(std::memory_order_relaxed);
+        if (inuse < m_prio_reserved[c])
+            kept += m_prio_reserved[c] - inuse;
+    }
+    free = m_share ? m_share->free_count() : m_free_list.size();
+    return free > kept;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Class method for configuring a priority class
+//////////////////////////////////////////////////////////////////////////////
+int32_t XvbmBufferPool::prio_set(XvbmPriority prio,
+                                 uint32_t     reserved,
+                                 uint32_t     max_inuse)
+{
+    XvbmPoolGuard guard(this);
+    uint64_t total = reserved;
+
+    for (int32_t c = 0; c < XVBM_PRIO_CLASSES; c++) {
+        if (c != prio)
+            total += m_prio_reserved[c];
+    }
+    if (max_inuse && max_inuse < reserved) {
+        XVBM_ERROR("cap %u of priority class %d is below its reservation %u",
+                   max_inuse, prio, reserved);
+        return (-1);
+    }
+    if (total > (uint64_t)m_num_buffers) {
+        XVBM_ERROR("reservations of %lu buffers exceed pool %p of %d buffers",
+                   (unsigned long)total, this, (int32_t)m_num_buffers);
+        return (-1);
+    }
+    m_prio_reserved[prio] = reserved;
+    m_prio_max[prio] = max_inuse;
+    // A raised cap or a dropped reservation may admit waiting allocations
+    free_notify_l();
+
+    return 0;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 // Class method for allocating a buffer from the buffer pool
 //////////////////////////////////////////////////////////////////////////////
-XvbmBuffer* XvbmBufferPool::entry_alloc()
+XvbmBuffer* XvbmBufferPool::entry_alloc(XvbmPriority prio)
 {
     XvbmBuffer *buffer = NULL;
+    uint64_t start = xvbm_now_ns();
+    bool denied = false;
 
-    std::lock_guard<std::mutex> guard(m_lock);
+    {
+        XvbmPoolGuard guard(this);
+        auto it = m_free_list.end();
+
+        if (!prio_admits_l(prio)) {
+            denied = m_share ? m_share->free_count() > 0 : !m_free_list.empty();
+        } else if (m_share) {
+            // The free ring is shared, a buffer free there has no reference
+            // in this process either
+            int32_t idx = m_share->alloc();
+            if (idx >= 0) {
+                it = std::find(m_free_list.begin(), m_free_list.end(), m_alloc_vector[idx]);
+                if (it == m_free_list.end()) {
+                    XVBM_ERROR("shared buffer #%d is still in use in this process", idx);
+                    m_share->unref(idx);
+                }
+            }
+        } else if (m_free_list.size()) {
+            it = reuse_next_l();
+        }
+
+        if (it != m_free_list.end())
+        {
+            buffer = *it;
+            ++buffer->m_ref_cnt;
+            // A new owner is about to produce new content on the device, and
+            // has not been given the host pointer yet
+            buffer->invalidate();
+            buffer->m_hptr_exported = false;
+            m_free_list.erase(it);
+            if (!buffer->m_touched) {
+                buffer->m_touched = true;
+                m_stats.m_touched.fetch_add(1, std::memory_order_relaxed);
+            }
+            m_inuse_list.push_back(buffer);
+            m_ref_cnt++;
+            XVBM_ALLOC_TRACE(XVBM_ATRACE_ALLOC, this, buffer->m_buffer_id, 1, 0);
+
+            uint32_t inuse = ++m_stats.m_inuse;
+            if (inuse > m_stats.m_inuse_high_water.load(std::memory_order_relaxed))
+                m_stats.m_inuse_high_water.store(inuse, std::memory_order_relaxed);
+            buffer->m_prio = prio;
+            inuse = ++m_prio[prio].m_inuse;
+            if (inuse > m_prio[prio].m_inuse_high_water.load(std::memory_order_relaxed))
+                m_prio[prio].m_inuse_high_water.store(inuse, std::memory_order_relaxed);
+        }
+    }
+
+    if (buffer) {
+        m_stats.m_allocs.fetch_add(1, std::memory_order_relaxed);
+        m_prio[prio].m_allocs.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        m_stats.m_failed_allocs.fetch_add(1, std::memory_order_relaxed);
+        m_prio[prio].m_failed_allocs.fetch_add(1, std::memory_order_relaxed);
+        if (denied)
+            m_prio[prio].m_denied.fetch_add(1, std::memory_order_relaxed);
+        XVBM_ALLOC_TRACE(XVBM_ATRACE_ALLOC_FAILED, this, 0, 0, 0);
+    }
+    m_stats.m_alloc_latency.record(xvbm_now_ns() - start);
+    if (buffer)
+        XVBM_TRACE(XVBM_TRACE_ALLOC, this, buffer, buffer->m_buffer_id, 1);
+    else
+        XVBM_TRACE(XVBM_TRACE_ALLOC_FAILED, this, nullptr, 0, 0);
+
+    return buffer;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Class method for allocating a buffer, waiting for one to be freed
+//////////////////////////////////////////////////////////////////////////////
+XvbmBuffer* XvbmBufferPool::entry_alloc_wait(uint32_t     timeout_ms,
+                                             XvbmPriority prio)
+{
+    bool forever = timeout_ms == XVBM_WAIT_FOREVER;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    auto admitted = [this, prio]() { return prio_admits_l(prio); };
+    uint64_t start = 0;
+    XvbmBuffer *buffer;
+
+    while ((buffer = entry_alloc(prio)) == nullptr) {
+        auto now = std::chrono::steady_clock::now();
+        if (!forever && now >= deadline)
+            break;
+        if (start == 0)
+            start = xvbm_now_ns();
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_free_waiters++;
+        if (m_share) {
+            // Frees in other processes are not signalled, the shared free
+            // ring is polled
+            m_free_cond.wait_until(lock, std::min(deadline, now + std::chrono::milliseconds(1)));
+        } else if (forever) {
+            m_free_cond.wait(lock, admitted);
+        } else {
+            m_free_cond.wait_until(lock, deadline, admitted);
+        }
+        m_free_waiters--;
+    }
+    if (start)
+        m_prio[prio].record_wait(xvbm_now_ns() - start, buffer == nullptr);
+    return buffer;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Class method for taking over a reference handed off by another process
+//////////////////////////////////////////////////////////////////////////////
+XvbmBuffer* XvbmBufferPool::accept(uint64_t token)
+{
+    XvbmBuffer *buffer = nullptr;
 
-    if (m_free_list.size())
     {
-        buffer = m_free_list.front();
-        ++buffer->m_ref_cnt;
-        std::lock_guard<std::mutex> guard(buffer->m_rdlock);
-        m_free_list.pop_front();
-        m_inuse_list.push_back(buffer);
-        m_ref_cnt++;
+        XvbmPoolGuard guard(this);
+        int32_t idx = m_share ? m_share->accept(token) : -1;
+        if (idx < 0)
+            return nullptr;
+
+        buffer = m_alloc_vector[idx];
+        if (buffer->m_ref_cnt++ == 0) {
+            // Whatever the shadow holds predates the other process' writes
+            buffer->invalidate();
+            m_free_list.remove(buffer);
+            m_inuse_list.push_back(buffer);
+            m_ref_cnt++;
+            ++m_stats.m_inuse;
+            buffer->m_prio = XVBM_PRIO_NORMAL;
+            ++m_prio[XVBM_PRIO_NORMAL].m_inuse;
+        }
+        XVBM_ALLOC_TRACE(XVBM_ATRACE_REF_INC, this, buffer->m_buffer_id, buffer->m_ref_cnt, 0);
     }
+    XVBM_TRACE(XVBM_TRACE_REF_INC, this, buffer, buffer->m_buffer_id, buffer->m_ref_cnt);
 
     return buffer;
 }
 
+//////////////////////////////////////////////////////////////////////////////
+// Class method for picking the free buffer to hand out next, called with
+// the pool lock held and a non-empty free list
+//////////////////////////////////////////////////////////////////////////////
+std::list<XvbmBuffer*>::iterator XvbmBufferPool::reuse_next_l()
+{
+    if (m_reuse != XVBM_REUSE_BANK_RR || m_num_banks < 2)
+        return m_free_list.begin();
+
+    // Oldest free buffer of the next bank that has one
+    for (uint32_t i = 0; i < m_num_banks; i++) {
+        uint32_t bank = (m_next_bank + i) % m_num_banks;
+        for (auto it = m_free_list.begin(); it != m_free_list.end(); ++it) {
+            if ((*it)->m_bank == bank) {
+                m_next_bank = (bank + 1) % m_num_banks;
+                return it;
+            }
+        }
+    }
+    return m_free_list.begin();
+}
+
 //////////////////////////////////////////////////////////////////////////////
 // Class method for freeing a buffer back to the buffer pool
 //////////////////////////////////////////////////////////////////////////////
@@ -181,18 +536,39 @@ bool XvbmBufferPool::entry_free(XvbmBuffer *buffer)
 {
     bool ret = false;
     bool des = false;
+    uint64_t start = xvbm_now_ns();
+
+    if (buffer->is_view())
+        return view_free(buffer);
+
     {
-        std::lock_guard<std::mutex> guard(m_lock);
+        XvbmPoolGuard guard(this);
 
         if (buffer->m_ref_cnt > 0) {
             --buffer->m_ref_cnt;
+            if (m_share)
+                m_share->unref(buffer->m_buffer_id);
+            // Recorded before a possible pool teardown below
+            XVBM_TRACE(XVBM_TRACE_FREE, this, buffer, buffer->m_buffer_id, buffer->m_ref_cnt);
+            XVBM_ALLOC_TRACE(XVBM_ATRACE_FREE, this, buffer->m_buffer_id, buffer->m_ref_cnt, 0);
 
             if (buffer->m_ref_cnt == 0) {
                 auto it = std::find(m_inuse_list.begin(), m_inuse_list.end(), buffer);
                 if (it != m_inuse_list.end())
                 {
                     m_inuse_list.erase(it);
-                    m_free_list.push_back(buffer);
+                    // Allocation takes from the front
+                    if (m_reuse == XVBM_REUSE_LIFO)
+                        m_free_list.push_front(buffer);
+                    else
+                        m_free_list.push_back(buffer);
+                    free_notify_l();
+                    if (m_meta_size)
+                        memset(buffer->meta(), 0, m_meta_size);
+                    --m_stats.m_inuse;
+                    --m_prio[buffer->m_prio].m_inuse;
+                    m_stats.m_frees.fetch_add(1, std::memory_order_relaxed);
+                    m_stats.m_free_latency.record(xvbm_now_ns() - start);
                     des = destroy_l();
                     ret = true;
                 }
@@ -200,11 +576,88 @@ bool XvbmBufferPool::entry_free(XvbmBuffer *buffer)
         }
     }
     if (des) {
-        delete this;
+        retire();
     }
     return ret;
 }
 
+//////////////////////////////////////////////////////////////////////////////
+// Class method for getting a privately owned copy of a shared buffer
+//////////////////////////////////////////////////////////////////////////////
+XvbmBuffer* XvbmBufferPool::make_writable(XvbmBuffer *buffer)
+{
+    if (buffer->is_view()) {
+        XVBM_ERROR("copy-on-write of view %p not supported", buffer);
+        return nullptr;
+    }
+
+    // Sole owner, nobody else can observe the modification
+    if ((m_share ? m_share->refs(buffer->m_buffer_id) : buffer->m_ref_cnt.load()) == 1)
+        return buffer;
+
+    // The copy is held by the same class, the caller holds the original
+    XvbmBuffer *copy = entry_alloc(buffer->m_prio);
+    if (copy == nullptr) {
+        XVBM_ERROR("no free buffer for copy-on-write of %p", buffer);
+        return nullptr;
+    }
+    if (copy->copy_buffer(buffer, m_size, 0, 0)) {
+        entry_free(copy);
+        return nullptr;
+    }
+    if (m_meta_size)
+        memcpy(copy->meta(), buffer->meta(), m_meta_size);
+    // The pool can not go away here, the copy holds a reference on it
+    entry_free(buffer);
+
+    return copy;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Class methods for creating and releasing a view on a region of a buffer
+//////////////////////////////////////////////////////////////////////////////
+XvbmBuffer* XvbmBufferPool::view_create(XvbmBuffer *buffer,
+                                        size_t      offset,
+                                        size_t      size,
+                                        size_t      pitch)
+{
+    if (buffer->m_size < (size+offset)) {
+        XVBM_ERROR("view_create with invalid size:%zu offset:%zu", size, offset);
+        return nullptr;
+    }
+    // A view of a view is a view of the same parent
+    if (buffer->is_view()) {
+        offset += buffer->m_offset;
+        buffer = buffer->m_parent;
+    }
+
+    {
+        XvbmPoolGuard guard(this);
+        if (buffer->m_ref_cnt == 0) {
+            XVBM_ERROR("Can not create a view of a free buffer : %p", buffer);
+            return nullptr;
+        }
+        ++buffer->m_ref_cnt;
+        if (m_share)
+            m_share->ref(buffer->m_buffer_id);
+    }
+
+    return new XvbmBuffer(buffer, offset, size, pitch);
+}
+
+bool XvbmBufferPool::view_free(XvbmBuffer *view)
+{
+    {
+        XvbmPoolGuard guard(this);
+        if (view->m_ref_cnt == 0 || --view->m_ref_cnt > 0)
+            return false;
+    }
+    XvbmBuffer *parent = view->m_parent;
+    delete view;
+
+    return entry_free(parent);
+}
+
 //////////////////////////////////////////////////////////////////////////////
 // Class method for getting the buffer handle by physical address
 //////////////////////////////////////////////////////////////////////////////
@@ -212,7 +665,7 @@ XvbmBuffer* XvbmBufferPool::get_handle_by_paddr(uint64_t paddr)
 {
     XvbmBuffer* buffer = (XvbmBuffer*)NULL;
 
-    std::lock_guard<std::mutex> guard(m_lock);
+    XvbmPoolGuard guard(this);
     auto it = m_paddr_map.find(paddr);
     if (it != m_paddr_map.end())
         buffer = it->second;
@@ -232,7 +685,7 @@ XvbmBuffer* XvbmBufferPool::get_buffer_handle(uint32_t index)
 {
     XvbmBuffer *buffer = (XvbmBuffer*)NULL;
 
-    std::lock_guard<std::mutex> guard(m_lock);
+    XvbmPoolGuard guard(this);
     buffer = m_alloc_vector.at(index);
 
     return buffer;
@@ -252,6 +705,85 @@ XvbmBufferHandle xvbm_get_buffer_handle(XvbmPoolHandle p_handle, uint32_t index)
     return buffer;
 }
 
+//////////////////////////////////////////////////////////////////////////////
+// Per-thread 4K aligned staging memory for transfers from/to unaligned
+// user buffers, so concurrent transfers never share a staging area
+//////////////////////////////////////////////////////////////////////////////
+struct XvbmStaging
+{
+    void   *m_ptr = nullptr;
+    size_t  m_size = 0;
+
+    ~XvbmStaging() { free(m_ptr); }
+
+    void *get(size_t size)
+    {
+        if (size > m_size) {
+            free(m_ptr);
+            m_ptr = nullptr;
+            m_size = 0;
+            if (posix_memalign(&m_ptr, ALIGN_4K, size))
+                return nullptr;
+            m_size = size;
+        }
+        return m_ptr;
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Staging memory for one transfer. Up to STAGING_CACHE_MAX it is the
+// thread's cached area, larger transfers get their own allocation freed
+// with this object so one big frame does not stay pinned to the thread
+//////////////////////////////////////////////////////////////////////////////
+struct XvbmStagingArea
+{
+    void *m_transient = nullptr;
+
+    ~XvbmStagingArea() { free(m_transient); }
+
+    void *get(size_t size)
+    {
+        static thread_local XvbmStaging staging;
+
+        if (size <= STAGING_CACHE_MAX)
+            return staging.get(size);
+        if (posix_memalign(&m_transient, ALIGN_4K, size)) {
+            m_transient = nullptr;
+            return nullptr;
+        }
+        return m_transient;
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Class methods for tracking the host shadow against the device buffer
+// Both must be called with m_shadow_lock held
+//////////////////////////////////////////////////////////////////////////////
+bool XvbmBuffer::shadow_valid_l(uint64_t gen,
+                                size_t   size,
+                                size_t   offset)
+{
+    return (!m_hptr_exported && m_shadow_gen == gen &&
+            offset >= m_shadow_start && (offset + size) <= m_shadow_end);
+}
+
+void XvbmBuffer::shadow_update_l(uint64_t gen,
+                                 size_t   size,
+                                 size_t   offset)
+{
+    // Grow the valid range when the new one touches it, otherwise the
+    // most recent transfer wins
+    if (m_shadow_gen == gen && offset <= m_shadow_end &&
+        (offset + size) >= m_shadow_start) {
+        m_shadow_start = std::min(m_shadow_start, offset);
+        m_shadow_end = std::max(m_shadow_end, offset + size);
+    } else {
+        m_shadow_gen = gen;
+        m_shadow_start = offset;
+        m_shadow_end = offset + size;
+    }
+}
+
 //////////////////////////////////////////////////////////////////////////////
 // Class method for writing a device buffer
 //////////////////////////////////////////////////////////////////////////////
@@ -261,28 +793,60 @@ int32_t XvbmBuffer::write_buffer(const void *src,
                                  size_t      offset)
 {
     XvbmBufferPool *pool = static_cast<XvbmBufferPool*>(m_p_handle);
+    void *shadow = (unsigned char*)m_hptr + offset;
     int32_t rc;
 
 
     if (m_size < (size+offset)) {
-        std::cerr << "write_buffer with invalid size:" << size << " offset:" << offset <<std::endl;
+        XVBM_ERROR("write_buffer with invalid size:%zu offset:%zu", size, offset);
         return (-1);
     }
+    if (is_view())
+        return m_parent->write_buffer(src, size, m_offset + offset);
 
     // Check if the user provided host buffer is 4k aligned
-    if ((size_t)src & 0xFFF) {
-        void *aligned_src = (unsigned char*)m_hptr + offset;
+    bool staged = (size_t)src & 0xFFF;
+    pool->numa_check(XVBM_XFER_TO_DEVICE);
+    XvbmXferLoad load(pool, size);
+    uint64_t t0 = xvbm_now_ns();
+    uint64_t t1 = t0;
+    if (staged) {
+        XvbmStagingArea staging;
+        void *aligned_src = staging.get(size);
+        if (aligned_src == nullptr) {
+            XVBM_ERROR("staging alloc failed");
+            return (-1);
+        }
         memcpy(aligned_src, src, size);
-        rc = xclWriteBO(pool->m_dev_handle,
-                        m_bo_handle, aligned_src, size, offset);
+        t1 = xvbm_now_ns();
+        rc = pool->m_backend->write_bo(pool->m_dev_handle,
+                                       m_bo_handle, aligned_src, size, offset);
     } else {
-        rc = xclWriteBO(pool->m_dev_handle,
-                        m_bo_handle, src, size, offset);
+        rc = pool->m_backend->write_bo(pool->m_dev_handle,
+                                       m_bo_handle, src, size, offset);
     }
+    uint64_t t2 = xvbm_now_ns();
     if (rc != 0) {
-        std::string err = "xclSyncBO to device failed rc=";
-        std::cerr << err << rc << std::endl;
+        XVBM_ERROR("xclSyncBO to device failed rc=%d", rc);
+    }
+
+    {
+        // The device copy changed even if the transfer failed part way
+        std::unique_lock<std::shared_timed_mutex> guard(m_shadow_lock);
+        uint64_t gen = ++m_dev_gen;
+        if ((rc == 0) && !m_hptr_exported &&
+            (pool->m_read_cache || (src == shadow))) {
+            // Mirror what was just written; anything else the shadow held
+            // is still unchanged on the device
+            if (src != shadow)
+                memcpy(shadow, src, size);
+            if (m_shadow_gen == gen - 1)
+                m_shadow_gen = gen;
+            shadow_update_l(gen, size, offset);
+        }
     }
+    pool->m_xfer[XVBM_XFER_TO_DEVICE].record(size, staged, (t1 - t0) + (xvbm_now_ns() - t2),
+                                             t2 - t1, rc);
 
     return rc;
 
@@ -298,49 +862,325 @@ int32_t XvbmBuffer::read_buffer(void       *dst,
     XvbmBufferPool *pool = static_cast<XvbmBufferPool*>(m_p_handle);
     int32_t rc = 0;
 
-    std::lock_guard<std::mutex> guard(m_rdlock);
-
     if (m_size < (size+offset)) {
-        std::cerr << "read_buffer with invalid size:" << size << " offset:" << offset <<std::endl;
+        XVBM_ERROR("read_buffer with invalid size:%zu offset:%zu", size, offset);
         return (-1);
     }
+    if (is_view())
+        return m_parent->read_buffer(dst, size, m_offset + offset);
     //if there is at-least 1 ref
     if(m_ref_cnt) {
-        // Check if the user provided host buffer is 4k aligned
-        if ((size_t)dst & 0xFFF) {
-            void *aligned_dst = (unsigned char*)m_hptr + offset;
-            rc = xclReadBO(pool->m_dev_handle, m_bo_handle, aligned_dst, size, offset);
-            if (rc == 0) {
-                memcpy(dst, aligned_dst, size);
+        void *shadow = (unsigned char*)m_hptr + offset;
+        bool cache = pool->m_read_cache && !m_hptr_exported;
+        // Sample the generation before the transfer so that a concurrent
+        // write leaves the shadow marked stale
+        uint64_t gen = m_dev_gen.load();
+
+        XvbmXferCounters &xfer = pool->m_xfer[XVBM_XFER_FROM_DEVICE];
+        pool->numa_check(XVBM_XFER_FROM_DEVICE);
+        uint64_t t0 = xvbm_now_ns();
+        uint64_t t1, t2;
+
+        if (cache) {
+            std::shared_lock<std::shared_timed_mutex> guard(m_shadow_lock);
+            if (shadow_valid_l(gen, size, offset)) {
+                if (dst != shadow)
+                    memcpy(dst, shadow, size);
+                xfer.record_cached(size, xvbm_now_ns() - t0);
+                return 0;
             }
+        }
+        XvbmXferLoad load(pool, size);
+
+        if (dst == shadow) {
+            // Reading into the shadow itself, nobody may look at it meanwhile
+            std::unique_lock<std::shared_timed_mutex> guard(m_shadow_lock);
+            t1 = xvbm_now_ns();
+            rc = pool->m_backend->read_bo(pool->m_dev_handle, m_bo_handle, dst, size, offset);
+            t2 = xvbm_now_ns();
+            if ((rc == 0) && cache && (m_dev_gen.load() == gen))
+                shadow_update_l(gen, size, offset);
+            xfer.record(size, false, 0, t2 - t1, rc);
         } else {
-            rc = xclReadBO(pool->m_dev_handle, m_bo_handle, dst, size, offset);
+            // Check if the user provided host buffer is 4k aligned
+            bool staged = (size_t)dst & 0xFFF;
+            XvbmStagingArea staging;
+            void *aligned_dst = dst;
+            if (staged) {
+                aligned_dst = staging.get(size);
+                if (aligned_dst == nullptr) {
+                    XVBM_ERROR("staging alloc failed");
+                    return (-1);
+                }
+            }
+            t1 = xvbm_now_ns();
+            rc = pool->m_backend->read_bo(pool->m_dev_handle, m_bo_handle, aligned_dst, size, offset);
+            t2 = xvbm_now_ns();
+            if ((rc == 0) && (aligned_dst != dst))
+                memcpy(dst, aligned_dst, size);
+            if ((rc == 0) && cache) {
+                // Publish for later readers unless the device moved on
+                std::unique_lock<std::shared_timed_mutex> guard(m_shadow_lock);
+                if (m_dev_gen.load() == gen) {
+                    memcpy(shadow, aligned_dst, size);
+                    shadow_update_l(gen, size, offset);
+                }
+            }
+            xfer.record(size, staged, xvbm_now_ns() - t2, t2 - t1, rc);
         }
     }
     if (rc != 0) {
-        std::string err = "xclSyncBO from device failed rc=";
-        std::cerr << err << rc << std::endl;
+        XVBM_ERROR("xclSyncBO from device failed rc=%d", rc);
     }
 
     return rc;
 }
 
+//////////////////////////////////////////////////////////////////////////////
+// Class method for copying between device buffers
+//////////////////////////////////////////////////////////////////////////////
+int32_t XvbmBuffer::copy_buffer(XvbmBuffer *src,
+                                size_t      size,
+                                size_t      dst_offset,
+                                size_t      src_offset)
+{
+    XvbmBufferPool *pool = static_cast<XvbmBufferPool*>(m_p_handle);
+    XvbmBufferPool *src_pool = static_cast<XvbmBufferPool*>(src->m_p_handle);
+    int32_t rc;
+
+    if ((m_size < (size+dst_offset)) || (src->m_size < (size+src_offset))) {
+        XVBM_ERROR("copy_buffer with invalid size:%zu dst offset:%zu src offset:%zu",
+                   size, dst_offset, src_offset);
+        return (-1);
+    }
+    if (is_view())
+        return m_parent->copy_buffer(src, size, m_offset + dst_offset, src_offset);
+    if (src->is_view())
+        return copy_buffer(src->m_parent, size, dst_offset, src->m_offset + src_offset);
+    if ((src == this) && (dst_offset < src_offset + size) && (src_offset < dst_offset + size)) {
+        XVBM_ERROR("copy_buffer with overlapping ranges");
+        return (-1);
+    }
+
+    if (pool->m_dev_handle == src_pool->m_dev_handle) {
+        XvbmXferLoad load(pool, size);
+        uint64_t t0 = xvbm_now_ns();
+        rc = pool->m_backend->copy_bo(pool->m_dev_handle, m_bo_handle, src->m_bo_handle,
+                                      size, dst_offset, src_offset);
+        pool->m_xfer[XVBM_XFER_DEVICE_COPY].record(size, false, 0, xvbm_now_ns() - t0, rc);
+        if (rc == 0) {
+            invalidate();
+            return rc;
+        }
+        // Not every platform has a copy engine, go through the host instead
+        XVBM_WARNING("xclCopyBO failed rc=%d, falling back to host copy", rc);
+    }
+
+    return bounce_copy(src, size, dst_offset, src_offset);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Writes the chunks of one bounce copy on its own thread, one at a time,
+// from the node of the destination device when it has one
+//////////////////////////////////////////////////////////////////////////////
+struct XvbmBounceWriter
+{
+    XvbmBuffer              *m_dst;
+    int32_t                  m_numa_node;
+    std::mutex               m_lock;
+    std::condition_variable  m_cond;
+    const void              *m_src = nullptr;
+    size_t                   m_len = 0;
+    size_t                   m_offset = 0;
+    bool                     m_busy = false;
+    bool                     m_quit = false;
+    int32_t                  m_rc = 0;
+    std::thread              m_thread;
+
+    XvbmBounceWriter(XvbmBuffer *dst, int32_t numa_node)
+        : m_dst(dst), m_numa_node(numa_node), m_thread(&XvbmBounceWriter::run, this) {}
+
+    ~XvbmBounceWriter()
+    {
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            m_quit = true;
+        }
+        m_cond.notify_all();
+        m_thread.join();
+    }
+
+    // Waits for the chunk in flight, returns the first write error
+    int32_t wait()
+    {
+        std::unique_lock<std::mutex> guard(m_lock);
+        m_cond.wait(guard, [this]() { return !m_busy; });
+        return m_rc;
+    }
+
+    // The previous chunk must have been waited for
+    void post(const void *src, size_t len, size_t offset)
+    {
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            m_src = src;
+            m_len = len;
+            m_offset = offset;
+            m_busy = true;
+        }
+        m_cond.notify_all();
+    }
+
+    void run()
+    {
+        if (m_numa_node >= 0)
+            xvbm_numa_pin_thread(m_numa_node);
+
+        std::unique_lock<std::mutex> guard(m_lock);
+
+        for (;;) {
+            m_cond.wait(guard, [this]() { return m_busy || m_quit; });
+            if (!m_busy)
+                break;
+            guard.unlock();
+            int32_t rc = m_dst->write_buffer(m_src, m_len, m_offset);
+            guard.lock();
+            if (m_rc == 0)
+                m_rc = rc;
+            m_busy = false;
+            m_cond.notify_all();
+        }
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Copy through host memory, reading the next chunk from the source device
+// while the previous one is being written to the destination
+//////////////////////////////////////////////////////////////////////////////
+int32_t XvbmBuffer::bounce_copy(XvbmBuffer *src,
+                                size_t      size,
+                                size_t      dst_offset,
+                                size_t      src_offset)
+{
+    XvbmBufferPool *src_pool = static_cast<XvbmBufferPool*>(src->m_p_handle);
+    XvbmBufferPool *dst_pool = static_cast<XvbmBufferPool*>(m_p_handle);
+    size_t chunk = std::min(size, (size_t)COPY_CHUNK_SIZE);
+    unsigned char *bounce = nullptr;
+    std::unique_ptr<XvbmBounceWriter> writer;
+    int32_t rc = 0;
+    int32_t wr_rc = 0;
+
+    if (size == 0)
+        return 0;
+
+    if (posix_memalign((void**)&bounce, ALIGN_4K, chunk * 2)) {
+        XVBM_ERROR("bounce buffer alloc failed");
+        return (-1);
+    }
+    // The destination side is accounted by write_buffer
+    XvbmXferLoad load(src_pool, size);
+    // A single chunk has nothing to overlap with
+    if (size > chunk)
+        writer.reset(new XvbmBounceWriter(this, dst_pool->m_numa_node));
+
+    for (size_t done = 0, i = 0; done < size; done += chunk, i++) {
+        size_t len = std::min(chunk, size - done);
+        unsigned char *stage = bounce + (i & 1) * chunk;
+
+        uint64_t t0 = xvbm_now_ns();
+        rc = src_pool->m_backend->read_bo(src_pool->m_dev_handle, src->m_bo_handle, stage,
+                                          len, src_offset + done);
+        src_pool->m_xfer[XVBM_XFER_FROM_DEVICE].record(len, false, 0, xvbm_now_ns() - t0, rc);
+        // The previous write must be done before its half is reused
+        if (writer)
+            wr_rc = writer->wait();
+        if ((rc != 0) || (wr_rc != 0))
+            break;
+        if (writer)
+            writer->post(stage, len, dst_offset + done);
+        else
+            wr_rc = write_buffer(stage, len, dst_offset + done);
+    }
+    if (writer) {
+        wr_rc = writer->wait();
+        writer.reset();
+    }
+    if (rc != 0) {
+        XVBM_ERROR("xclSyncBO from device failed rc=%d", rc);
+    }
+    free(bounce);
+
+    return rc ? rc : wr_rc;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 XvbmPoolHandle xvbm_buffer_pool_create(xclDeviceHandle d_handle,
                                        int32_t         num_buffers,
                                        size_t          size,
                                        uint32_t        flags)
 {
-    XvbmBufferPool *pool = new XvbmBufferPool(d_handle,
-                                              num_buffers,
-                                              size,
-                                              flags);
+    return xvbm_buffer_pool_create_ex(d_handle, num_buffers, size, flags, nullptr);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+XvbmPoolHandle xvbm_buffer_pool_create_ex(xclDeviceHandle     d_handle,
+                                          int32_t             num_buffers,
+                                          size_t              size,
+                                          uint32_t            flags,
+                                          const XvbmPoolAttr *attr)
+{
+    XvbmPoolAttr a = {};
+
+    if (attr)
+        a = *attr;
+    if ((flags & XVBM_POOL_STRIPE) && !(flags & XVBM_POOL_BANK_MASK)) {
+        XVBM_ERROR("striped pool needs at least one bank in the mask");
+        xvbm_status_set(XVBM_STATUS_INVALID);
+        return nullptr;
+    }
+    if (a.meta_size > XVBM_META_MAX_SIZE) {
+        XVBM_ERROR("metadata size %u larger than %u", a.meta_size, XVBM_META_MAX_SIZE);
+        xvbm_status_set(XVBM_STATUS_INVALID);
+        return nullptr;
+    }
+    a.meta_size = (a.meta_size + XVBM_META_ALIGN - 1) & ~(XVBM_META_ALIGN - 1);
+    XvbmBufferPool *pool = xvbm_pool_cache_get(d_handle, num_buffers, size, flags, a);
+    if (pool) {
+        xvbm_status_set(XVBM_STATUS_OK);
+        return pool;
+    }
+    pool = new XvbmBufferPool(d_handle,
+                              num_buffers,
+                              size,
+                              flags);
+    if (pool->m_backend == nullptr) {
+        XVBM_ERROR("no backend for device %p", d_handle);
+        xvbm_status_set(XVBM_STATUS_INVALID);
+        delete pool;
+        return nullptr;
+    }
+    pool->m_tenant = a.tenant;
+    pool->m_meta_size = a.meta_size;
+    XvbmStatus status = pool->admit(0, num_buffers);
+    if (status != XVBM_STATUS_OK) {
+        XVBM_ERROR("pool of %d x %zu bytes exceeds the budget of device %p",
+                   num_buffers, size, d_handle);
+        xvbm_status_set(status);
+        delete pool;
+        return nullptr;
+    }
     try {
         pool->create();
+        xvbm_pool_register(pool);
+        status = XVBM_STATUS_OK;
     } catch (const std::bad_alloc&) {
-        std::cerr << "xrt : failed to create a pool" << std::endl;
+        XVBM_ERROR("failed to create a pool");
+        pool->teardown();
+        delete pool;
         pool = nullptr;
+        status = XVBM_STATUS_NO_MEMORY;
     }
+    xvbm_status_set(status);
     return pool;
 }
 
@@ -350,8 +1190,16 @@ XvbmPoolHandle xvbm_buffer_pool_create_by_device_id(int32_t  device_id,
                                                     size_t   size,
                                                     uint32_t flags)
 {
+#ifdef XVBM_EMU_ONLY
+    (void)num_buffers;
+    (void)size;
+    (void)flags;
+    XVBM_ERROR("device %d not available in an emulation only build", device_id);
+    return nullptr;
+#else
     xclDeviceHandle d_handle = xclOpen(device_id, NULL, XCL_QUIET);
     return xvbm_buffer_pool_create(d_handle, num_buffers, size, flags);
+#endif
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -395,7 +1243,8 @@ int32_t xvbm_buffer_pool_extend(XvbmBufferHandle  b_handle,
         ret = pool->extend(num_buffers);
     } catch (const std::bad_alloc&)
     {
-        std::cerr << "xrt : failed to extend/allocate memory" << std::endl;
+        XVBM_ERROR("failed to extend/allocate memory");
+        xvbm_status_set(XVBM_STATUS_NO_MEMORY);
         ret = 0;
     }
     return ret;
@@ -411,6 +1260,22 @@ int32_t xvbm_buffer_pool_num_buffers_get(XvbmBufferHandle  b_handle)
     return pool->get_num_buffers();
 }
 
+//////////////////////////////////////////////////////////////////////////////
+int32_t xvbm_buffer_pool_reuse_policy_set(XvbmPoolHandle  p_handle,
+                                          XvbmReusePolicy policy)
+{
+    XvbmBufferPool *pool = static_cast<XvbmBufferPool*>(p_handle);
+
+    if (policy < XVBM_REUSE_FIFO || policy > XVBM_REUSE_BANK_RR) {
+        XVBM_ERROR("unknown reuse policy %d", policy);
+        return (-1);
+    }
+    XvbmPoolGuard guard(pool);
+    pool->m_reuse = policy;
+
+    return 0;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 XvbmBufferHandle xvbm_buffer_pool_entry_alloc(XvbmPoolHandle p_handle)
 {
@@ -420,23 +1285,97 @@ XvbmBufferHandle xvbm_buffer_pool_entry_alloc(XvbmPoolHandle p_handle)
     return buffer;
 }
 
+//////////////////////////////////////////////////////////////////////////////
+XvbmBufferHandle xvbm_buffer_pool_entry_alloc_wait(XvbmPoolHandle p_handle,
+                                                   uint32_t       timeout_ms)
+{
+    XvbmBufferPool *pool = static_cast<XvbmBufferPool*>(p_handle);
+
+    return pool->entry_alloc_wait(timeout_ms);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+XvbmBufferHandle xvbm_buffer_pool_entry_alloc_prio(XvbmPoolHandle p_handle,
+                                                   XvbmPriority   prio)
+{
+    XvbmBufferPool *pool = static_cast<XvbmBufferPool*>(p_handle);
+
+    if (prio < XVBM_PRIO_CRITICAL || prio >= XVBM_PRIO_CLASSES) {
+        XVBM_ERROR("unknown priority class %d", prio);
+        return nullptr;
+    }
+    return pool->entry_alloc(prio);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+XvbmBufferHandle xvbm_buffer_pool_entry_alloc_prio_wait(XvbmPoolHandle p_handle,
+                                                        XvbmPriority   prio,
+                                                        uint32_t       timeout_ms)
+{
+    XvbmBufferPool *pool = static_cast<XvbmBufferPool*>(p_handle);
+
+    if (prio < XVBM_PRIO_CRITICAL || prio >= XVBM_PRIO_CLASSES) {
+        XVBM_ERROR("unknown priority class %d", prio);
+        return nullptr;
+    }
+    return pool->entry_alloc_wait(timeout_ms, prio);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int32_t xvbm_buffer_pool_prio_set(XvbmPoolHandle p_handle,
+                                  XvbmPriority   prio,
+                                  uint32_t       reserved,
+                                  uint32_t       max_inuse)
+{
+    XvbmBufferPool *pool = static_cast<XvbmBufferPool*>(p_handle);
+
+    if (pool == nullptr || prio < XVBM_PRIO_CRITICAL || prio >= XVBM_PRIO_CLASSES) {
+        XVBM_ERROR("invalid pool %p or priority class %d", pool, prio);
+        return (-1);
+    }
+    return pool->prio_set(prio, reserved, max_inuse);
+}
+
 //////////////////////////////////////////////////////////////////////////////
 bool xvbm_buffer_pool_entry_free(XvbmBufferHandle b_handle)
 {
     XvbmBuffer *buffer = static_cast<XvbmBuffer*>(b_handle);
     if (buffer == NULL) {
-        std::cerr << "Warning: xvbm trying to free a buffer which is already null" << std::endl;
+        XVBM_WARNING("trying to free a buffer which is already null");
         return true;
     }
     XvbmPoolHandle p_handle = buffer->get_pool_handle();
     if (p_handle == NULL) {
-        std::cerr << "Warning : xvbm buffer pool has already destroyed" << std::endl;
+        XVBM_WARNING("buffer pool has already destroyed");
         return true;
     }
     XvbmBufferPool *pool = static_cast<XvbmBufferPool*>(p_handle);
     return pool->entry_free(buffer);
 }
 
+//////////////////////////////////////////////////////////////////////////////
+XvbmBufferHandle xvbm_buffer_make_writable(XvbmBufferHandle b_handle)
+{
+    XvbmBuffer *buffer = static_cast<XvbmBuffer*>(b_handle);
+    XvbmPoolHandle p_handle = buffer->get_pool_handle();
+    XvbmBufferPool *pool = static_cast<XvbmBufferPool*>(p_handle);
+
+    return pool->make_writable(buffer);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+XvbmBufferHandle xvbm_buffer_view_create(XvbmBufferHandle b_handle,
+                                         size_t           offset,
+                                         size_t           size,
+                                         size_t           pitch)
+{
+    XvbmBuffer *buffer = static_cast<XvbmBuffer*>(b_handle);
+    XvbmPoolHandle p_handle = buffer->get_pool_handle();
+    XvbmBufferPool *pool = static_cast<XvbmBufferPool*>(p_handle);
+
+    return pool->view_create(buffer, offset, size, pitch);
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //@TODO return bool to notify status
 void xvbm_buffer_pool_destroy(XvbmPoolHandle p_handle)
@@ -468,6 +1407,20 @@ size_t xvbm_buffer_get_size(XvbmBufferHandle b_handle)
     return buffer->get_size();
 }
 
+//////////////////////////////////////////////////////////////////////////////
+size_t xvbm_buffer_get_pitch(XvbmBufferHandle b_handle)
+{
+    XvbmBuffer *buffer = static_cast<XvbmBuffer*>(b_handle);
+    return buffer->get_pitch();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+size_t xvbm_buffer_get_view_offset(XvbmBufferHandle b_handle)
+{
+    XvbmBuffer *buffer = static_cast<XvbmBuffer*>(b_handle);
+    return buffer->get_view_offset();
+}
+
 //////////////////////////////////////////////////////////////////////////////
 uint64_t xvbm_buffer_get_paddr(XvbmBufferHandle b_handle)
 {
@@ -475,6 +1428,39 @@ uint64_t xvbm_buffer_get_paddr(XvbmBufferHandle b_handle)
     return buffer->get_paddr();
 }
 
+//////////////////////////////////////////////////////////////////////////////
+uint32_t xvbm_buffer_get_bank(XvbmBufferHandle b_handle)
+{
+    XvbmBuffer *buffer = static_cast<XvbmBuffer*>(b_handle);
+    return buffer->m_bank;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void *xvbm_buffer_get_meta(XvbmBufferHandle b_handle)
+{
+    XvbmBuffer *buffer = static_cast<XvbmBuffer*>(b_handle);
+    XvbmBufferPool *pool = static_cast<XvbmBufferPool*>(buffer->m_p_handle);
+
+    return pool->m_meta_size ? buffer->meta() : nullptr;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+uint32_t xvbm_buffer_get_meta_size(XvbmBufferHandle b_handle)
+{
+    XvbmBuffer *buffer = static_cast<XvbmBuffer*>(b_handle);
+    XvbmBufferPool *pool = static_cast<XvbmBufferPool*>(buffer->m_p_handle);
+
+    return pool->m_meta_size;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+xclDeviceHandle xvbm_buffer_get_device(XvbmBufferHandle b_handle)
+{
+    XvbmBuffer *buffer = static_cast<XvbmBuffer*>(b_handle);
+    XvbmBufferPool *pool = static_cast<XvbmBufferPool*>(buffer->m_p_handle);
+    return pool->m_dev_handle;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 void *xvbm_buffer_get_host_ptr(XvbmBufferHandle b_handle)
 {
@@ -482,6 +1468,32 @@ void *xvbm_buffer_get_host_ptr(XvbmBufferHandle b_handle)
     return buffer->get_host_ptr();
 }
 
+//////////////////////////////////////////////////////////////////////////////
+void xvbm_buffer_pool_read_cache_set(XvbmPoolHandle p_handle,
+                                     bool           enable)
+{
+    XvbmBufferPool *pool = static_cast<XvbmBufferPool*>(p_handle);
+    if (enable && pool->m_share) {
+        XVBM_WARNING("read cache not available on a pool shared with other processes");
+        return;
+    }
+    pool->m_read_cache = enable;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+uint64_t xvbm_buffer_get_generation(XvbmBufferHandle b_handle)
+{
+    XvbmBuffer *buffer = static_cast<XvbmBuffer*>(b_handle);
+    return buffer->get_generation();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void xvbm_buffer_invalidate(XvbmBufferHandle b_handle)
+{
+    XvbmBuffer *buffer = static_cast<XvbmBuffer*>(b_handle);
+    buffer->invalidate();
+}
+
 //////////////////////////////////////////////////////////////////////////////
 XvbmBufferHandle xvbm_buffer_get_handle(XvbmPoolHandle p_handle,
                                         uint64_t       paddr)
@@ -509,13 +1521,19 @@ void xvbm_buffer_refcnt_inc(XvbmBufferHandle b_handle)
     XvbmPoolHandle p_handle = buffer->get_pool_handle();
     XvbmBufferPool *pool = static_cast<XvbmBufferPool*>(p_handle);
 
-    std::lock_guard<std::mutex> guard(pool->m_lock);
+    XvbmPoolGuard guard(pool);
     assert(buffer->m_ref_cnt > 0);
     if (buffer->m_ref_cnt <= 0) {
-        std::cerr << "Error : Can not increment ref count of a free buffer : " << buffer << std::endl;
+        XVBM_ERROR("Can not increment ref count of a free buffer : %p", buffer);
         return;
     }
     ++buffer->m_ref_cnt;
+    // A view holds a single reference on its parent whatever its own count,
+    // view_free drops it once
+    if (pool->m_share && !buffer->is_view())
+        pool->m_share->ref(buffer->m_buffer_id);
+    XVBM_ALLOC_TRACE(XVBM_ATRACE_REF_INC, pool, buffer->get_id(), buffer->m_ref_cnt, 0);
+    XVBM_TRACE(XVBM_TRACE_REF_INC, pool, buffer, buffer->get_id(), buffer->m_ref_cnt);
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -525,9 +1543,25 @@ int32_t xvbm_buffer_write(XvbmBufferHandle  b_handle,
                           size_t            offset)
 {
     XvbmBuffer *buffer = static_cast<XvbmBuffer*>(b_handle);
+    uint64_t start = XVBM_TRACE_BEGIN();
 
     //if (buffer->get_host_ptr() != src)   return(-1);
-    return buffer->write_buffer(src, size, offset);
+    int32_t rc = buffer->write_buffer(src, size, offset);
+    XVBM_TRACE_END(XVBM_TRACE_WRITE, start, buffer->get_pool_handle(), buffer,
+                   buffer->get_id(), size, offset);
+    return rc;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int32_t xvbm_buffer_copy(XvbmBufferHandle  dst_handle,
+                         size_t            dst_offset,
+                         XvbmBufferHandle  src_handle,
+                         size_t            src_offset,
+                         size_t            size)
+{
+    XvbmBuffer *dst = static_cast<XvbmBuffer*>(dst_handle);
+    XvbmBuffer *src = static_cast<XvbmBuffer*>(src_handle);
+    return dst->copy_buffer(src, size, dst_offset, src_offset);
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -537,6 +1571,11 @@ int32_t xvbm_buffer_read(XvbmBufferHandle  b_handle,
                          size_t            offset)
 {
     XvbmBuffer *buffer = static_cast<XvbmBuffer*>(b_handle);
+    uint64_t start = XVBM_TRACE_BEGIN();
+
     //if (buffer->get_host_ptr() != dst)   return(-1);
-    return buffer->read_buffer(dst, size, offset);
+    int32_t rc = buffer->read_buffer(dst, size, offset);
+    XVBM_TRACE_END(XVBM_TRACE_READ, start, buffer->get_pool_handle(), buffer,
+                   buffer->get_id(), size, offset);
+    return rc;
 }
@@ -0,0 +1,175 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later OR Apache-2.0 */
+
+/*
+ * Copyright (C) 2019-2021 Xilinx Inc - All rights reserved
+ * Xilinx Video Buffer Manager (Xvbm)
+ *
+ * This file is dual-licensed; you may select either the GNU
+ * Lesser General Public License version 3 or
+ * Apache License, Version 2.0.
+ *
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <deque>
+#include <thread>
+#include "xvbm.h"
+#include "xvbm_private.h"
+#include "xvbm_alloc_trace.h"
+#include "xvbm_log.h"
+
+#define ALLOC_TRACE_BATCH 4096
+
+std::atomic<bool> g_xvbm_alloc_trace_enabled(false);
+
+//////////////////////////////////////////////////////////////////////////////
+// Records are appended to a batch under a short lock. Callers may hold a
+// pool lock, so full batches are handed to a writer thread instead of
+// being written by the thread that filled them.
+//////////////////////////////////////////////////////////////////////////////
+class XvbmAllocTracer
+{
+public:
+    int32_t start(const char *path)
+    {
+        std::lock_guard<std::mutex> state_guard(m_state_lock);
+        if (m_fp) {
+            XVBM_ERROR("allocation trace already active");
+            return (-1);
+        }
+        m_fp = fopen(path, "wb");
+        if (m_fp == nullptr) {
+            XVBM_ERROR("can not open allocation trace %s: %s", path, strerror(errno));
+            return (-1);
+        }
+        XvbmAllocTraceHeader hdr = {};
+        hdr.m_magic = XVBM_ALLOC_TRACE_MAGIC;
+        hdr.m_version = XVBM_ALLOC_TRACE_VERSION;
+        hdr.m_pid = getpid();
+        hdr.m_start_ns = xvbm_now_ns();
+        fwrite(&hdr, sizeof(hdr), 1, m_fp);
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            m_batch.reserve(ALLOC_TRACE_BATCH);
+            m_active = true;
+        }
+        m_writer = std::thread(&XvbmAllocTracer::run, this);
+        g_xvbm_alloc_trace_enabled.store(true);
+        return 0;
+    }
+
+    void stop()
+    {
+        g_xvbm_alloc_trace_enabled.store(false);
+        std::lock_guard<std::mutex> state_guard(m_state_lock);
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            if (!m_active)
+                return;
+            m_active = false;
+            if (m_batch.size())
+                m_full.push_back(std::move(m_batch));
+            m_batch.clear();
+        }
+        // The writer drains the queue before it exits
+        m_cond.notify_all();
+        m_writer.join();
+        fclose(m_fp);
+        m_fp = nullptr;
+    }
+
+    void record(const XvbmAllocTraceRecord &rec)
+    {
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            if (!m_active)
+                return;
+            m_batch.push_back(rec);
+            if (m_batch.size() < ALLOC_TRACE_BATCH)
+                return;
+            m_full.push_back(std::move(m_batch));
+            m_batch.clear();
+            m_batch.reserve(ALLOC_TRACE_BATCH);
+        }
+        m_cond.notify_all();
+    }
+
+private:
+    // Only the writer touches m_fp between start and stop
+    void run()
+    {
+        std::unique_lock<std::mutex> guard(m_lock);
+        for (;;) {
+            m_cond.wait(guard, [&]() { return !m_full.empty() || !m_active; });
+            if (m_full.empty())
+                break;
+            std::vector<XvbmAllocTraceRecord> batch = std::move(m_full.front());
+            m_full.pop_front();
+            guard.unlock();
+            if (fwrite(batch.data(), sizeof(XvbmAllocTraceRecord), batch.size(), m_fp) != batch.size())
+                XVBM_ERROR("allocation trace write failed");
+            guard.lock();
+        }
+    }
+
+    std::mutex                                    m_lock;
+    std::condition_variable                       m_cond;
+    std::vector<XvbmAllocTraceRecord>             m_batch;
+    std::deque<std::vector<XvbmAllocTraceRecord>> m_full;
+    bool                                          m_active = false;
+    // Serialises start and stop
+    std::mutex                                    m_state_lock;
+    FILE                                         *m_fp = nullptr;
+    std::thread                                   m_writer;
+};
+
+// Never destroyed, pools may still be used while statics are torn down
+static XvbmAllocTracer &tracer()
+{
+    static XvbmAllocTracer *t = new XvbmAllocTracer;
+    return *t;
+}
+
+void xvbm_alloc_trace_record(XvbmAllocTraceType  type,
+                             const void         *pool,
+                             uint32_t            buffer,
+                             uint32_t            ref_cnt,
+                             uint64_t            arg)
+{
+    XvbmAllocTraceRecord rec = {};
+
+    rec.m_ts_ns = xvbm_now_ns();
+    rec.m_pool_id = (uint64_t)pool;
+    rec.m_arg = arg;
+    rec.m_buffer = buffer;
+    rec.m_ref_cnt = std::min<uint32_t>(ref_cnt, UINT16_MAX);
+    rec.m_type = type;
+    tracer().record(rec);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int32_t xvbm_alloc_trace_start(const char *path)
+{
+    if (tracer().start(path))
+        return (-1);
+    // Pools created before the trace started
+    xvbm_pool_foreach([](XvbmBufferPool *pool) {
+        xvbm_alloc_trace_record(XVBM_ATRACE_POOL_CREATE, pool, pool->get_num_buffers(),
+                                0, pool->m_size);
+    });
+    return 0;
+}
+
+void xvbm_alloc_trace_stop(void)
+{
+    tracer().stop();
+}
+
+// Started from xvbm_pool_register when XVBM_ALLOC_TRACE is set
+static struct XvbmAllocTraceAtExit
+{
+    ~XvbmAllocTraceAtExit() { tracer().stop(); }
+} g_alloc_trace_at_exit;
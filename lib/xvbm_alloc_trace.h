@@ -0,0 +1,74 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later OR Apache-2.0 */
+
+/*
+ * Copyright (C) 2019-2021 Xilinx Inc - All rights reserved
+ * Xilinx Video Buffer Manager (Xvbm)
+ *
+ * This file is dual-licensed; you may select either the GNU
+ * Lesser General Public License version 3 or
+ * Apache License, Version 2.0.
+ *
+ */
+
+#ifndef _XVBM_ALLOC_TRACE_H_
+#define _XVBM_ALLOC_TRACE_H_
+
+#include <atomic>
+#include <cstdint>
+
+// Binary allocation trace written with XVBM_ALLOC_TRACE set and replayed by
+// xvbm-alloc-sim. Shared between the library and the tool, so it must not
+// depend on XRT headers. The file is a header followed by fixed size
+// records in host byte order, roughly but not strictly sorted by time.
+
+#define XVBM_ALLOC_TRACE_MAGIC   0x315254414d425658ull   // "XVBMATR1"
+#define XVBM_ALLOC_TRACE_VERSION 1
+
+enum XvbmAllocTraceType : uint8_t
+{
+    XVBM_ATRACE_POOL_CREATE = 0,  // m_buffer: buffers, m_arg: buffer size
+    XVBM_ATRACE_POOL_EXTEND,      // m_buffer: buffers after, m_arg: buffers added
+    XVBM_ATRACE_POOL_DESTROY,
+    XVBM_ATRACE_ALLOC,            // m_buffer: buffer index
+    XVBM_ATRACE_ALLOC_FAILED,
+    XVBM_ATRACE_FREE,             // m_ref_cnt: references left
+    XVBM_ATRACE_REF_INC,          // m_ref_cnt: references after
+    XVBM_ATRACE_TYPES
+};
+
+struct XvbmAllocTraceHeader
+{
+    uint64_t m_magic;
+    uint32_t m_version;
+    uint32_t m_pid;
+    uint64_t m_start_ns;
+};
+
+struct XvbmAllocTraceRecord
+{
+    uint64_t m_ts_ns;
+    uint64_t m_pool_id;
+    uint64_t m_arg;
+    uint32_t m_buffer;
+    uint16_t m_ref_cnt;
+    uint8_t  m_type;
+    uint8_t  m_reserved;
+};
+
+static_assert(sizeof(XvbmAllocTraceRecord) == 32, "trace record layout changed");
+
+extern std::atomic<bool> g_xvbm_alloc_trace_enabled;
+
+void xvbm_alloc_trace_record(XvbmAllocTraceType  type,
+                             const void         *pool,
+                             uint32_t            buffer,
+                             uint32_t            ref_cnt,
+                             uint64_t            arg);
+
+#define XVBM_ALLOC_TRACE(type, pool, buffer, ref, arg)                          \
+    do {                                                                        \
+        if (__builtin_expect(g_xvbm_alloc_trace_enabled.load(std::memory_order_relaxed), 0)) \
+            xvbm_alloc_trace_record((type), (pool), (buffer), (ref), (arg));    \
+    } while (0)
+
+#endif
@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later OR Apache-2.0 */
+
+/*
+ * Copyright (C) 2019-2021 Xilinx Inc - All rights reserved
+ * Xilinx Video Buffer Manager (Xvbm)
+ *
+ * This file is dual-licensed; you may select either the GNU
+ * Lesser General Public License version 3 or
+ * Apache License, Version 2.0.
+ *
+ */
+
+#ifndef _XVBM_BACKEND_H_
+#define _XVBM_BACKEND_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <xclhal2.h>
+
+// Device operations used by the pools. The XRT backend forwards to
+// xclhal2, the emulated device keeps buffers in host memory.
+class XvbmBackend
+{
+public:
+    virtual ~XvbmBackend() {}
+
+    virtual xclBufferHandle alloc_bo(xclDeviceHandle dev, size_t size, uint32_t flags) = 0;
+    virtual void free_bo(xclDeviceHandle dev, xclBufferHandle bo) = 0;
+    virtual uint64_t get_device_addr(xclDeviceHandle dev, xclBufferHandle bo) = 0;
+    virtual uint32_t get_bank(xclDeviceHandle dev, xclBufferHandle bo) = 0;
+    virtual int32_t get_numa_node(xclDeviceHandle dev) = 0;
+    // Descriptor another process can import the buffer from, -1 on failure
+    virtual int export_bo(xclDeviceHandle dev, xclBufferHandle bo) = 0;
+    // The caller keeps ownership of fd
+    virtual xclBufferHandle import_bo(xclDeviceHandle dev, int fd) = 0;
+    virtual int write_bo(xclDeviceHandle dev, xclBufferHandle bo,
+                         const void *src, size_t size, size_t offset) = 0;
+    virtual int read_bo(xclDeviceHandle dev, xclBufferHandle bo,
+                        void *dst, size_t size, size_t offset) = 0;
+    virtual int copy_bo(xclDeviceHandle dev, xclBufferHandle dst_bo, xclBufferHandle src_bo,
+                        size_t size, size_t dst_offset, size_t src_offset) = 0;
+};
+
+// XRT backend, NULL in an emulation only build
+XvbmBackend* xvbm_backend_xrt();
+
+// Backend serving a device handle, the emulated device when the handle was
+// returned by xvbm_emu_device_open and XRT otherwise
+XvbmBackend* xvbm_backend_get(xclDeviceHandle dev);
+
+#endif
@@ -0,0 +1,102 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later OR Apache-2.0 */
+
+/*
+ * Copyright (C) 2019-2021 Xilinx Inc - All rights reserved
+ * Xilinx Video Buffer Manager (Xvbm)
+ *
+ * This file is dual-licensed; you may select either the GNU
+ * Lesser General Public License version 3 or
+ * Apache License, Version 2.0.
+ *
+ */
+
+#include "xvbm_backend.h"
+#include "xvbm_numa.h"
+
+#ifdef XVBM_EMU_ONLY
+
+XvbmBackend* xvbm_backend_xrt()
+{
+    return nullptr;
+}
+
+#else
+
+//////////////////////////////////////////////////////////////////////////////
+// Backend for Alveo devices through xclhal2
+//////////////////////////////////////////////////////////////////////////////
+class XvbmXrtBackend : public XvbmBackend
+{
+public:
+    xclBufferHandle alloc_bo(xclDeviceHandle dev, size_t size, uint32_t flags) override
+    {
+        return xclAllocBO(dev, size, 0, flags);
+    }
+
+    void free_bo(xclDeviceHandle dev, xclBufferHandle bo) override
+    {
+        xclFreeBO(dev, bo);
+    }
+
+    uint64_t get_device_addr(xclDeviceHandle dev, xclBufferHandle bo) override
+    {
+        return xclGetDeviceAddr(dev, bo);
+    }
+
+    uint32_t get_bank(xclDeviceHandle dev, xclBufferHandle bo) override
+    {
+        struct xclBOProperties props;
+
+        // The memory bank index is kept in the low bits of the BO flags
+        if (xclGetBOProperties(dev, bo, &props))
+            return 0;
+        return props.flags & 0xffff;
+    }
+
+    int32_t get_numa_node(xclDeviceHandle dev) override
+    {
+        char path[256];
+
+        // numa_node of the PCIe function, -1 when the platform has none
+        if (xclGetSysfsPath(dev, "", "numa_node", path, sizeof(path)))
+            return (-1);
+        return xvbm_numa_read_node(path);
+    }
+
+    int export_bo(xclDeviceHandle dev, xclBufferHandle bo) override
+    {
+        return xclExportBO(dev, bo);
+    }
+
+    xclBufferHandle import_bo(xclDeviceHandle dev, int fd) override
+    {
+        return xclImportBO(dev, fd, 0);
+    }
+
+    int write_bo(xclDeviceHandle dev, xclBufferHandle bo,
+                 const void *src, size_t size, size_t offset) override
+    {
+        return xclWriteBO(dev, bo, src, size, offset);
+    }
+
+    int read_bo(xclDeviceHandle dev, xclBufferHandle bo,
+                void *dst, size_t size, size_t offset) override
+    {
+        return xclReadBO(dev, bo, dst, size, offset);
+    }
+
+    int copy_bo(xclDeviceHandle dev, xclBufferHandle dst_bo, xclBufferHandle src_bo,
+                size_t size, size_t dst_offset, size_t src_offset) override
+    {
+        return xclCopyBO(dev, dst_bo, src_bo, size, dst_offset, src_offset);
+    }
+};
+
+XvbmBackend* xvbm_backend_xrt()
+{
+    // Stateless and never destroyed, pools may outlive static destructors
+    static XvbmXrtBackend *backend = new XvbmXrtBackend;
+    return backend;
+}
+
+#endif
@@ -0,0 +1,289 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later OR Apache-2.0 */
+
+/*
+ * Copyright (C) 2019-2021 Xilinx Inc - All rights reserved
+ * Xilinx Video Buffer Manager (Xvbm)
+ *
+ * This file is dual-licensed; you may select either the GNU
+ * Lesser General Public License version 3 or
+ * Apache License, Version 2.0.
+ *
+ */
+
+#include "xvbm.h"
+#include "xvbm_private.h"
+#include "xvbm_log.h"
+
+// One budgeted scope, a bank or a whole device. A tenant commits the larger
+// of what it uses and what it reserved; admission keeps the sum of all
+// commitments within the limit.
+struct XvbmBudgetScope
+{
+    struct Tenant
+    {
+        uint64_t m_used = 0;
+        uint64_t m_reserved = 0;
+
+        uint64_t committed() const { return std::max(m_used, m_reserved); }
+    };
+
+    uint64_t                   m_limit = 0;     // 0 for no budget
+    uint64_t                   m_committed = 0;
+    std::map<uint32_t, Tenant> m_tenants;
+
+    bool admits(uint32_t tenant, uint64_t bytes)
+    {
+        if (m_limit == 0)
+            return true;
+        Tenant &t = m_tenants[tenant];
+        uint64_t after = m_committed - t.committed() + std::max(t.m_used + bytes, t.m_reserved);
+        return after <= m_limit;
+    }
+
+    uint64_t headroom(uint32_t tenant)
+    {
+        if (m_limit == 0)
+            return UINT64_MAX;
+        Tenant &t = m_tenants[tenant];
+        uint64_t others = m_committed - t.committed();
+        if (others + t.m_used >= m_limit)
+            return 0;
+        return m_limit - others - t.m_used;
+    }
+
+    void charge(uint32_t tenant, int64_t bytes)
+    {
+        Tenant &t = m_tenants[tenant];
+        // A pool released twice in a simulated budget never goes below 0
+        if (bytes < 0 && (uint64_t)-bytes > t.m_used)
+            bytes = -(int64_t)t.m_used;
+        m_committed -= t.committed();
+        t.m_used += bytes;
+        m_committed += t.committed();
+    }
+
+    bool reserve(uint32_t tenant, uint64_t bytes)
+    {
+        Tenant &t = m_tenants[tenant];
+        uint64_t after = m_committed - t.committed() + std::max(t.m_used, bytes);
+        if (m_limit && bytes > t.m_reserved && after > m_limit)
+            return false;
+        t.m_reserved = bytes;
+        m_committed = after;
+        return true;
+    }
+};
+
+struct XvbmDeviceBudget
+{
+    XvbmBudgetScope                     m_device;
+    std::map<uint32_t, XvbmBudgetScope> m_banks;
+
+    XvbmBudgetScope& scope(int32_t bank)
+    {
+        return bank == XVBM_BUDGET_DEVICE ? m_device : m_banks[bank];
+    }
+};
+
+static std::mutex g_budget_lock;
+
+// Never destroyed, pools may still release their charge at exit
+static std::map<xclDeviceHandle, XvbmDeviceBudget>& budgets()
+{
+    static auto *b = new std::map<xclDeviceHandle, XvbmDeviceBudget>();
+    return *b;
+}
+
+static thread_local XvbmStatus t_status = XVBM_STATUS_OK;
+
+void xvbm_status_set(XvbmStatus status)
+{
+    t_status = status;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+XvbmStatus xvbm_last_status(void)
+{
+    return t_status;
+}
+
+uint32_t xvbm_bank_for(uint32_t flags, int32_t index)
+{
+    uint32_t mask = flags & XVBM_POOL_BANK_MASK;
+
+    if (!(flags & XVBM_POOL_STRIPE))
+        return mask;
+    // Striped: buffer i goes to the (i mod n)th bank of the mask
+    uint32_t n = index % __builtin_popcount(mask);
+    for (uint32_t bank = 0; ; bank++) {
+        if ((mask & (1U << bank)) && n-- == 0)
+            return bank;
+    }
+}
+
+void xvbm_bank_bytes(uint32_t       flags,
+                     size_t         size,
+                     int32_t        first,
+                     int32_t        count,
+                     XvbmBankBytes &bytes)
+{
+    for (int32_t i = first; i < first + count; i++)
+        bytes[xvbm_bank_for(flags, i)] += size;
+}
+
+static bool xvbm_budget_admits_l(XvbmDeviceBudget    &dev,
+                                 uint32_t             tenant,
+                                 const XvbmBankBytes &bytes)
+{
+    uint64_t total = 0;
+
+    for (auto &b : bytes) {
+        if (!dev.scope(b.first).admits(tenant, b.second))
+            return false;
+        total += b.second;
+    }
+    return dev.m_device.admits(tenant, total);
+}
+
+static void xvbm_budget_charge_l(XvbmDeviceBudget    &dev,
+                                 uint32_t             tenant,
+                                 const XvbmBankBytes &bytes,
+                                 int64_t              sign)
+{
+    uint64_t total = 0;
+
+    for (auto &b : bytes) {
+        dev.scope(b.first).charge(tenant, sign * (int64_t)b.second);
+        total += b.second;
+    }
+    dev.m_device.charge(tenant, sign * (int64_t)total);
+}
+
+static XvbmStatus xvbm_budget_charge(xclDeviceHandle      d_handle,
+                                     uint32_t             tenant,
+                                     const XvbmBankBytes &bytes,
+                                     bool                 dry_run)
+{
+    std::lock_guard<std::mutex> guard(g_budget_lock);
+    XvbmDeviceBudget &dev = budgets()[d_handle];
+    if (!xvbm_budget_admits_l(dev, tenant, bytes))
+        return XVBM_STATUS_OVER_BUDGET;
+    if (!dry_run)
+        xvbm_budget_charge_l(dev, tenant, bytes, 1);
+    return XVBM_STATUS_OK;
+}
+
+// Checks bytes against the budgets as they will be once the charges of
+// releasable pools are gone, without touching the real budgets
+static bool xvbm_budget_admits_after(xclDeviceHandle      d_handle,
+                                     uint32_t             tenant,
+                                     const XvbmBankBytes &bytes,
+                                     const XvbmCharges   &releasable)
+{
+    std::lock_guard<std::mutex> guard(g_budget_lock);
+    XvbmDeviceBudget dev = budgets()[d_handle];
+    for (auto &c : releasable)
+        xvbm_budget_charge_l(dev, c.m_tenant, c.m_bytes, -1);
+    return xvbm_budget_admits_l(dev, tenant, bytes);
+}
+
+// Dormant pools and pools queued for freeing still hold budget. A dry run
+// counts it as headroom, an admission frees them only if that makes room.
+XvbmStatus xvbm_budget_admit(xclDeviceHandle      d_handle,
+                             uint32_t             tenant,
+                             const XvbmBankBytes &bytes,
+                             bool                 dry_run)
+{
+    XvbmStatus status = xvbm_budget_charge(d_handle, tenant, bytes, dry_run);
+    XvbmCharges releasable;
+
+    if (status != XVBM_STATUS_OVER_BUDGET)
+        return status;
+    xvbm_pool_cache_charges(d_handle, releasable);
+    xvbm_reclaim_charges(d_handle, releasable);
+    if (releasable.empty() || !xvbm_budget_admits_after(d_handle, tenant, bytes, releasable))
+        return XVBM_STATUS_OVER_BUDGET;
+    if (dry_run)
+        return XVBM_STATUS_OK;
+    xvbm_pool_cache_flush(d_handle);
+    return xvbm_budget_charge(d_handle, tenant, bytes, false);
+}
+
+void xvbm_budget_release(xclDeviceHandle      d_handle,
+                         uint32_t             tenant,
+                         const XvbmBankBytes &bytes)
+{
+    std::lock_guard<std::mutex> guard(g_budget_lock);
+    xvbm_budget_charge_l(budgets()[d_handle], tenant, bytes, -1);
+}
+
+void xvbm_budget_forget(xclDeviceHandle d_handle)
+{
+    std::lock_guard<std::mutex> guard(g_budget_lock);
+    budgets().erase(d_handle);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int32_t xvbm_device_budget_set(xclDeviceHandle d_handle,
+                               int32_t         bank,
+                               uint64_t        bytes)
+{
+    if (d_handle == nullptr || bank < XVBM_BUDGET_DEVICE) {
+        XVBM_ERROR("invalid budget scope %d of device %p", bank, d_handle);
+        return (-1);
+    }
+    std::lock_guard<std::mutex> guard(g_budget_lock);
+    budgets()[d_handle].scope(bank).m_limit = bytes;
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int32_t xvbm_device_reserve(xclDeviceHandle d_handle,
+                            uint32_t        tenant,
+                            int32_t         bank,
+                            uint64_t        bytes)
+{
+    if (d_handle == nullptr || bank < XVBM_BUDGET_DEVICE) {
+        XVBM_ERROR("invalid budget scope %d of device %p", bank, d_handle);
+        return (-1);
+    }
+    std::lock_guard<std::mutex> guard(g_budget_lock);
+    if (!budgets()[d_handle].scope(bank).reserve(tenant, bytes)) {
+        XVBM_ERROR("reservation of %lu bytes for tenant %u exceeds the budget of device %p",
+                   (unsigned long)bytes, tenant, d_handle);
+        return (-1);
+    }
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int32_t xvbm_device_headroom_get(xclDeviceHandle  d_handle,
+                                 uint32_t         tenant,
+                                 int32_t          bank,
+                                 uint64_t        *bytes)
+{
+    if (d_handle == nullptr || bank < XVBM_BUDGET_DEVICE || bytes == nullptr)
+        return (-1);
+    std::lock_guard<std::mutex> guard(g_budget_lock);
+    XvbmDeviceBudget &dev = budgets()[d_handle];
+    *bytes = dev.m_device.headroom(tenant);
+    if (bank != XVBM_BUDGET_DEVICE)
+        *bytes = std::min(*bytes, dev.scope(bank).headroom(tenant));
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+XvbmStatus xvbm_buffer_pool_admit(xclDeviceHandle     d_handle,
+                                  int32_t             num_buffers,
+                                  size_t              size,
+                                  uint32_t            flags,
+                                  const XvbmPoolAttr *attr)
+{
+    XvbmBankBytes bytes;
+
+    if (d_handle == nullptr || num_buffers < 0 ||
+        ((flags & XVBM_POOL_STRIPE) && !(flags & XVBM_POOL_BANK_MASK)))
+        return XVBM_STATUS_INVALID;
+    xvbm_bank_bytes(flags, size, 0, num_buffers, bytes);
+    return xvbm_budget_admit(d_handle, attr ? attr->tenant : 0, bytes, true);
+}
@@ -0,0 +1,387 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later OR Apache-2.0 */
+
+/*
+ * Copyright (C) 2019-2021 Xilinx Inc - All rights reserved
+ * Xilinx Video Buffer Manager (Xvbm)
+ *
+ * This file is dual-licensed; you may select either the GNU
+ * Lesser General Public License version 3 or
+ * Apache License, Version 2.0.
+ *
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <map>
+#include <memory>
+#include <set>
+#include <thread>
+#include "xvbm.h"
+#include "xvbm_private.h"
+#include "xvbm_backend.h"
+#include "xvbm_log.h"
+#include "xvbm_numa.h"
+
+#define EMU_MAX_BOS        65536
+#define EMU_BANK_BASE      0x4000000000ULL
+#define EMU_ALIGN          4096
+#define EMU_SPIN_NS        100000
+
+//////////////////////////////////////////////////////////////////////////////
+// Sleeps for long waits and spins for the last stretch, sleeping alone is
+// too coarse for per-call latencies of a few microseconds
+//////////////////////////////////////////////////////////////////////////////
+static void emu_wait_until(uint64_t deadline_ns)
+{
+    for (uint64_t now = xvbm_now_ns(); now < deadline_ns; now = xvbm_now_ns()) {
+        if (deadline_ns - now > EMU_SPIN_NS)
+            std::this_thread::sleep_for(std::chrono::nanoseconds(deadline_ns - now - EMU_SPIN_NS));
+        else
+            std::this_thread::yield();
+    }
+}
+
+// One direction of the PCIe link or the device copy engine. Transfers are
+// served one after the other at the configured bandwidth.
+struct XvbmEmuLink
+{
+    std::mutex m_lock;
+    uint64_t   m_busy_until = 0;
+    uint64_t   m_bandwidth = 0;
+
+    // Returns when the transfer is done
+    uint64_t reserve(uint64_t now, size_t size)
+    {
+        if (m_bandwidth == 0)
+            return now;
+        uint64_t duration = (uint64_t)((double)size * 1e9 / m_bandwidth);
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_busy_until = std::max(m_busy_until, now) + duration;
+        return m_busy_until;
+    }
+};
+
+// DDR bank with a first fit allocator over free address ranges
+struct XvbmEmuBank
+{
+    uint64_t                     m_base;
+    uint64_t                     m_size;
+    uint64_t                     m_used = 0;
+    std::map<uint64_t, uint64_t> m_free;
+
+    XvbmEmuBank(uint64_t base, uint64_t size) : m_base(base), m_size(size)
+    {
+        m_free[base] = size;
+    }
+
+    uint64_t alloc(uint64_t size)
+    {
+        for (auto it = m_free.begin(); it != m_free.end(); ++it) {
+            if (it->second < size)
+                continue;
+            uint64_t addr = it->first;
+            uint64_t left = it->second - size;
+            m_free.erase(it);
+            if (left)
+                m_free[addr + size] = left;
+            m_used += size;
+            return addr;
+        }
+        return 0;
+    }
+
+    void free(uint64_t addr, uint64_t size)
+    {
+        m_used -= size;
+        auto next = m_free.lower_bound(addr);
+        if (next != m_free.end() && addr + size == next->first) {
+            size += next->second;
+            next = m_free.erase(next);
+        }
+        if (next != m_free.begin()) {
+            auto prev = std::prev(next);
+            if (prev->first + prev->second == addr) {
+                prev->second += size;
+                return;
+            }
+        }
+        m_free[addr] = size;
+    }
+};
+
+struct XvbmEmuBo
+{
+    std::atomic<bool> m_valid;
+    void             *m_data;
+    uint64_t          m_size;
+    uint64_t          m_paddr;
+    uint32_t          m_bank;
+    uint32_t          m_refs;       // the allocation plus imports
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Emulated device, its address is the device handle given to the pools
+//////////////////////////////////////////////////////////////////////////////
+class XvbmEmuDevice : public XvbmBackend
+{
+public:
+    explicit XvbmEmuDevice(const XvbmEmuConfig *cfg) :
+        m_cfg(*cfg), m_bos(new XvbmEmuBo[EMU_MAX_BOS]())
+    {
+        // Keep bank address ranges apart so a paddr identifies its bank
+        uint64_t stride = (m_cfg.bank_size + EMU_BANK_BASE - 1) / EMU_BANK_BASE * EMU_BANK_BASE;
+        for (uint32_t i = 0; i < m_cfg.num_banks; i++)
+            m_banks.emplace_back(EMU_BANK_BASE + i * stride, m_cfg.bank_size);
+        m_h2d.m_bandwidth = m_cfg.h2d_bytes_per_sec;
+        m_d2h.m_bandwidth = m_cfg.d2h_bytes_per_sec;
+        m_d2d.m_bandwidth = m_cfg.d2d_bytes_per_sec;
+    }
+
+    ~XvbmEmuDevice()
+    {
+        for (uint32_t i = 0; i < EMU_MAX_BOS; i++)
+            if (m_bos[i].m_valid)
+                ::free(m_bos[i].m_data);
+    }
+
+    xclBufferHandle alloc_bo(xclDeviceHandle, size_t size, uint32_t flags) override
+    {
+        // As on the card, the low bits of the flags name the bank
+        uint32_t bank = flags & XVBM_POOL_BANK_MASK;
+        if (bank >= m_banks.size())
+            return NULLBO;
+
+        uint64_t deadline = xvbm_now_ns() + m_cfg.alloc_latency_ns;
+        uint64_t aligned = (size + EMU_ALIGN - 1) & ~(uint64_t)(EMU_ALIGN - 1);
+        xclBufferHandle bo = NULLBO;
+        void *data = nullptr;
+
+        if (m_cfg.store_data && posix_memalign(&data, EMU_ALIGN, aligned))
+            return NULLBO;
+        // Device memory stays on the node the card is attached to
+        if (data && m_cfg.numa_node >= 0 && xvbm_numa_num_nodes() > 1)
+            xvbm_numa_bind(data, aligned, m_cfg.numa_node);
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            uint64_t paddr = m_banks[bank].alloc(aligned);
+            if (paddr != 0 && !m_free_bos.empty()) {
+                bo = m_free_bos.back();
+                m_free_bos.pop_back();
+            } else if (paddr != 0 && m_next_bo < EMU_MAX_BOS) {
+                bo = m_next_bo++;
+            } else if (paddr != 0) {
+                m_banks[bank].free(paddr, aligned);
+            }
+            if (bo != NULLBO) {
+                XvbmEmuBo &b = m_bos[bo];
+                b.m_data = data;
+                b.m_size = size;
+                b.m_paddr = paddr;
+                b.m_bank = bank;
+                b.m_refs = 1;
+                b.m_valid.store(true, std::memory_order_release);
+            }
+        }
+        if (bo == NULLBO)
+            ::free(data);
+        emu_wait_until(deadline);
+
+        return bo;
+    }
+
+    void free_bo(xclDeviceHandle, xclBufferHandle bo) override
+    {
+        uint64_t deadline = xvbm_now_ns() + m_cfg.alloc_latency_ns;
+        XvbmEmuBo *b = lookup(bo, 0, 0);
+        if (b == nullptr)
+            return;
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            if (--b->m_refs > 0)
+                return;
+            b->m_valid.store(false, std::memory_order_release);
+            m_banks[b->m_bank].free(b->m_paddr, (b->m_size + EMU_ALIGN - 1) & ~(uint64_t)(EMU_ALIGN - 1));
+            ::free(b->m_data);
+            b->m_data = nullptr;
+            m_free_bos.push_back(bo);
+        }
+        emu_wait_until(deadline);
+    }
+
+    uint64_t get_device_addr(xclDeviceHandle, xclBufferHandle bo) override
+    {
+        XvbmEmuBo *b = lookup(bo, 0, 0);
+        return b ? b->m_paddr : (uint64_t)-1;
+    }
+
+    uint32_t get_bank(xclDeviceHandle, xclBufferHandle bo) override
+    {
+        XvbmEmuBo *b = lookup(bo, 0, 0);
+        return b ? b->m_bank : 0;
+    }
+
+    int32_t get_numa_node(xclDeviceHandle) override
+    {
+        return m_cfg.numa_node;
+    }
+
+    // Only the BO number travels, so an import is only meaningful in this
+    // process or a child forked after the allocation. The child's device
+    // memory is a copy and does not follow writes of the parent.
+    int export_bo(xclDeviceHandle, xclBufferHandle bo) override
+    {
+        uint64_t token[2] = { (uint64_t)(uintptr_t)this, bo };
+        int fd = memfd_create("xvbm_emu_bo", MFD_CLOEXEC);
+
+        if (fd < 0 || lookup(bo, 0, 0) == nullptr ||
+            pwrite(fd, token, sizeof(token), 0) != sizeof(token)) {
+            if (fd >= 0)
+                close(fd);
+            return (-1);
+        }
+        return fd;
+    }
+
+    xclBufferHandle import_bo(xclDeviceHandle, int fd) override
+    {
+        uint64_t token[2];
+
+        if (pread(fd, token, sizeof(token), 0) != sizeof(token) ||
+            token[0] != (uint64_t)(uintptr_t)this)
+            return NULLBO;
+        XvbmEmuBo *b = lookup(token[1], 0, 0);
+        if (b == nullptr)
+            return NULLBO;
+        std::lock_guard<std::mutex> guard(m_lock);
+        b->m_refs++;
+        return token[1];
+    }
+
+    int write_bo(xclDeviceHandle, xclBufferHandle bo,
+                 const void *src, size_t size, size_t offset) override
+    {
+        uint64_t start = xvbm_now_ns();
+        XvbmEmuBo *b = lookup(bo, size, offset);
+        if (b == nullptr)
+            return -EINVAL;
+        if (b->m_data)
+            memcpy((unsigned char*)b->m_data + offset, src, size);
+        emu_wait_until(m_h2d.reserve(start, size) + m_cfg.xfer_latency_ns);
+        return 0;
+    }
+
+    int read_bo(xclDeviceHandle, xclBufferHandle bo,
+                void *dst, size_t size, size_t offset) override
+    {
+        uint64_t start = xvbm_now_ns();
+        XvbmEmuBo *b = lookup(bo, size, offset);
+        if (b == nullptr)
+            return -EINVAL;
+        if (b->m_data)
+            memcpy(dst, (unsigned char*)b->m_data + offset, size);
+        emu_wait_until(m_d2h.reserve(start, size) + m_cfg.xfer_latency_ns);
+        return 0;
+    }
+
+    int copy_bo(xclDeviceHandle, xclBufferHandle dst_bo, xclBufferHandle src_bo,
+                size_t size, size_t dst_offset, size_t src_offset) override
+    {
+        uint64_t start = xvbm_now_ns();
+        XvbmEmuBo *d = lookup(dst_bo, size, dst_offset);
+        XvbmEmuBo *s = lookup(src_bo, size, src_offset);
+        if (d == nullptr || s == nullptr)
+            return -EINVAL;
+        if (d->m_data && s->m_data)
+            memmove((unsigned char*)d->m_data + dst_offset,
+                    (unsigned char*)s->m_data + src_offset, size);
+        emu_wait_until(m_d2d.reserve(start, size) + m_cfg.xfer_latency_ns);
+        return 0;
+    }
+
+private:
+    // Lock free, a BO is only freed by the pool that owns it
+    XvbmEmuBo* lookup(xclBufferHandle bo, size_t size, size_t offset)
+    {
+        if (bo >= EMU_MAX_BOS || !m_bos[bo].m_valid.load(std::memory_order_acquire))
+            return nullptr;
+        XvbmEmuBo *b = &m_bos[bo];
+        return (offset + size <= b->m_size) ? b : nullptr;
+    }
+
+    XvbmEmuConfig                 m_cfg;
+    std::mutex                    m_lock;
+    std::vector<XvbmEmuBank>      m_banks;
+    std::unique_ptr<XvbmEmuBo[]>  m_bos;
+    std::vector<xclBufferHandle>  m_free_bos;
+    xclBufferHandle               m_next_bo = 0;
+    XvbmEmuLink                   m_h2d;
+    XvbmEmuLink                   m_d2h;
+    XvbmEmuLink                   m_d2d;
+};
+
+// Open emulated devices, consulted when a pool is created
+static std::mutex                    &g_emu_lock = *new std::mutex;
+static std::set<XvbmEmuDevice*>      &g_emu_devices = *new std::set<XvbmEmuDevice*>;
+
+XvbmBackend* xvbm_backend_get(xclDeviceHandle dev)
+{
+    {
+        std::lock_guard<std::mutex> guard(g_emu_lock);
+        auto it = g_emu_devices.find(static_cast<XvbmEmuDevice*>(dev));
+        if (it != g_emu_devices.end())
+            return *it;
+    }
+    return xvbm_backend_xrt();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void xvbm_emu_config_init(XvbmEmuConfig *cfg)
+{
+    // Roughly one U30 device: two 2GB DDR banks behind PCIe Gen3 x8
+    cfg->num_banks = 2;
+    cfg->bank_size = 2ULL << 30;
+    cfg->alloc_latency_ns = 20000;
+    cfg->xfer_latency_ns = 5000;
+    cfg->h2d_bytes_per_sec = 6ULL << 30;
+    cfg->d2h_bytes_per_sec = 6ULL << 30;
+    cfg->d2d_bytes_per_sec = 16ULL << 30;
+    cfg->store_data = true;
+    cfg->numa_node = -1;
+}
+
+xclDeviceHandle xvbm_emu_device_open(const XvbmEmuConfig *cfg)
+{
+    XvbmEmuConfig def;
+
+    if (cfg == nullptr) {
+        xvbm_emu_config_init(&def);
+        cfg = &def;
+    }
+    if (cfg->num_banks == 0 || cfg->bank_size == 0) {
+        XVBM_ERROR("emulated device needs at least one bank");
+        return nullptr;
+    }
+
+    XvbmEmuDevice *dev = new XvbmEmuDevice(cfg);
+    std::lock_guard<std::mutex> guard(g_emu_lock);
+    g_emu_devices.insert(dev);
+
+    return dev;
+}
+
+void xvbm_emu_device_close(xclDeviceHandle d_handle)
+{
+    XvbmEmuDevice *dev = static_cast<XvbmEmuDevice*>(d_handle);
+
+    xvbm_pool_cache_flush(d_handle);
+    xvbm_budget_forget(d_handle);
+    {
+        std::lock_guard<std::mutex> guard(g_emu_lock);
+        if (g_emu_devices.erase(dev) == 0)
+            return;
+    }
+    delete dev;
+}
@@ -0,0 +1,156 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later OR Apache-2.0 */
+
+/*
+ * Copyright (C) 2019-2021 Xilinx Inc - All rights reserved
+ * Xilinx Video Buffer Manager (Xvbm)
+ *
+ * This file is dual-licensed; you may select either the GNU
+ * Lesser General Public License version 3 or
+ * Apache License, Version 2.0.
+ *
+ */
+
+#include "xvbm.h"
+#include "xvbm_private.h"
+#include "xvbm_log.h"
+
+// Devices of a group are tracked in a 64 bit mask while allocating
+#define GROUP_MAX_DEVICES 64
+
+//////////////////////////////////////////////////////////////////////////////
+// Class method for allocating from the best device of the group
+//////////////////////////////////////////////////////////////////////////////
+XvbmBuffer* XvbmPoolGroup::entry_alloc(int32_t hint)
+{
+    uint32_t n = m_pools.size();
+    uint32_t start = m_next.fetch_add(1, std::memory_order_relaxed) % n;
+    XvbmGroupPolicy policy = m_policy.load(std::memory_order_relaxed);
+    uint64_t tried = 0;
+
+    // The load figures are read without locks and may be stale by the time
+    // the pool is locked, a pool found empty then is skipped
+    auto free_of = [](XvbmBufferPool *pool) {
+        return (int64_t)pool->get_num_buffers() -
+               pool->m_stats.m_inuse.load(std::memory_order_relaxed);
+    };
+
+    if (hint >= 0 && (uint32_t)hint < n && free_of(m_pools[hint]) > 0) {
+        XvbmBuffer *buffer = m_pools[hint]->entry_alloc();
+        if (buffer)
+            return buffer;
+        tried |= 1ULL << hint;
+    }
+
+    for (;;) {
+        int32_t best = -1;
+        int64_t best_free = 0;
+        uint64_t best_load = 0;
+
+        for (uint32_t k = 0; k < n; k++) {
+            uint32_t i = (start + k) % n;
+            if (tried & (1ULL << i))
+                continue;
+            int64_t free = free_of(m_pools[i]);
+            uint64_t load = m_pools[i]->m_inflight_bytes.load(std::memory_order_relaxed);
+            if (free <= 0)
+                continue;
+            bool better;
+            if (best < 0)
+                better = true;
+            else if (policy == XVBM_GROUP_LEAST_LOADED && load != best_load)
+                better = load < best_load;
+            else
+                better = free > best_free;
+            if (better) {
+                best = i;
+                best_free = free;
+                best_load = load;
+            }
+        }
+        if (best < 0)
+            return nullptr;
+        XvbmBuffer *buffer = m_pools[best]->entry_alloc();
+        if (buffer)
+            return buffer;
+        tried |= 1ULL << best;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+XvbmPoolGroupHandle xvbm_pool_group_create(xclDeviceHandle *d_handles,
+                                           uint32_t         num_devices,
+                                           int32_t          num_buffers,
+                                           size_t           size,
+                                           uint32_t         flags)
+{
+    if (d_handles == nullptr || num_devices == 0 || num_devices > GROUP_MAX_DEVICES) {
+        XVBM_ERROR("pool group needs 1 to %d devices", GROUP_MAX_DEVICES);
+        return nullptr;
+    }
+
+    XvbmPoolGroup *group = new XvbmPoolGroup;
+    for (uint32_t i = 0; i < num_devices; i++) {
+        XvbmPoolHandle p_handle = xvbm_buffer_pool_create(d_handles[i], num_buffers,
+                                                          size, flags);
+        if (p_handle == nullptr) {
+            XVBM_ERROR("pool group: no pool on device #%u", i);
+            xvbm_pool_group_destroy(group);
+            return nullptr;
+        }
+        group->m_pools.push_back(static_cast<XvbmBufferPool*>(p_handle));
+    }
+    return group;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void xvbm_pool_group_destroy(XvbmPoolGroupHandle g_handle)
+{
+    XvbmPoolGroup *group = static_cast<XvbmPoolGroup*>(g_handle);
+
+    if (group == nullptr)
+        return;
+    for (auto pool : group->m_pools)
+        xvbm_buffer_pool_destroy(pool);
+    delete group;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int32_t xvbm_pool_group_policy_set(XvbmPoolGroupHandle g_handle,
+                                   XvbmGroupPolicy     policy)
+{
+    XvbmPoolGroup *group = static_cast<XvbmPoolGroup*>(g_handle);
+
+    if (policy < XVBM_GROUP_MOST_FREE || policy > XVBM_GROUP_LEAST_LOADED) {
+        XVBM_ERROR("unknown group policy %d", policy);
+        return (-1);
+    }
+    group->m_policy = policy;
+
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+XvbmBufferHandle xvbm_pool_group_entry_alloc(XvbmPoolGroupHandle g_handle,
+                                             int32_t             hint)
+{
+    XvbmPoolGroup *group = static_cast<XvbmPoolGroup*>(g_handle);
+    return group->entry_alloc(hint);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+uint32_t xvbm_pool_group_num_devices(XvbmPoolGroupHandle g_handle)
+{
+    XvbmPoolGroup *group = static_cast<XvbmPoolGroup*>(g_handle);
+    return group->m_pools.size();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+XvbmPoolHandle xvbm_pool_group_pool_get(XvbmPoolGroupHandle g_handle,
+                                        uint32_t            index)
+{
+    XvbmPoolGroup *group = static_cast<XvbmPoolGroup*>(g_handle);
+
+    if (index >= group->m_pools.size())
+        return nullptr;
+    return group->m_pools[index];
+}
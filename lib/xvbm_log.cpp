@@ -0,0 +1,296 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later OR Apache-2.0 */
+
+/*
+ * Copyright (C) 2019-2021 Xilinx Inc - All rights reserved
+ * Xilinx Video Buffer Manager (Xvbm)
+ *
+ * This file is dual-licensed; you may select either the GNU
+ * Lesser General Public License version 3 or
+ * Apache License, Version 2.0.
+ *
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <syslog.h>
+#include <condition_variable>
+#include <new>
+#include <thread>
+#include "xvbm.h"
+#include "xvbm_private.h"
+#include "xvbm_log.h"
+
+#define LOG_QUEUE_SLOTS    256
+#define LOG_MSG_SIZE       1024
+#define LOG_RATE_WINDOW_NS 1000000000ULL
+#define LOG_RATE_BURST     10
+#define LOG_WRITER_WAKE_MS 50
+
+std::atomic<int32_t> g_xvbm_log_level(XVBM_LOG_INFO);
+
+static const char *g_level_names[] = { "error", "warning", "info", "debug" };
+
+struct XvbmLogSlot
+{
+    std::atomic<uint64_t> m_seq;
+    XvbmLogLevel          m_level;
+    char                  m_msg[LOG_MSG_SIZE];
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Bounded multi-producer queue, a slot is claimed with one CAS and
+// published through its sequence number. Whoever holds m_lock (the writer
+// thread or a flush) is the single consumer.
+//////////////////////////////////////////////////////////////////////////////
+class XvbmLogger
+{
+public:
+    XvbmLogger() : m_enqueue_pos(0), m_dequeue_pos(0), m_dropped(0),
+                   m_started(false), m_stop(false), m_sink(XVBM_LOG_SINK_STDERR),
+                   m_callback(nullptr), m_user_data(nullptr)
+    {
+        for (uint64_t i = 0; i < LOG_QUEUE_SLOTS; i++)
+            m_slots[i].m_seq.store(i, std::memory_order_relaxed);
+    }
+
+    XvbmLogSlot *reserve()
+    {
+        uint64_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            XvbmLogSlot *slot = &m_slots[pos % LOG_QUEUE_SLOTS];
+            int64_t diff = (int64_t)slot->m_seq.load(std::memory_order_acquire) - (int64_t)pos;
+            if (diff == 0) {
+                if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    return slot;
+            } else if (diff < 0) {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            } else {
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void publish(XvbmLogSlot *slot)
+    {
+        uint64_t pos = slot->m_seq.load(std::memory_order_relaxed);
+        slot->m_seq.store(pos + 1, std::memory_order_release);
+        if (!m_started.load(std::memory_order_acquire))
+            start();
+        if (m_stop.load(std::memory_order_relaxed))
+            flush();
+        else
+            m_cv.notify_one();
+    }
+
+    void flush()
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        drain_l();
+    }
+
+    void set_sink(XvbmLogSink sink, XvbmLogCallback callback, void *user_data)
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        drain_l();
+        if (m_sink == XVBM_LOG_SINK_SYSLOG && sink != XVBM_LOG_SINK_SYSLOG)
+            closelog();
+        if (sink == XVBM_LOG_SINK_SYSLOG && m_sink != XVBM_LOG_SINK_SYSLOG)
+            openlog("xvbm", LOG_PID, LOG_USER);
+        m_sink = sink;
+        m_callback = callback;
+        m_user_data = user_data;
+    }
+
+    // Called at exit, later messages are written by the caller
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            m_stop = true;
+        }
+        m_cv.notify_one();
+        std::lock_guard<std::mutex> guard(m_start_lock);
+        if (m_thread.joinable())
+            m_thread.join();
+        flush();
+    }
+
+private:
+    void start()
+    {
+        std::lock_guard<std::mutex> guard(m_start_lock);
+        if (m_started || m_stop)
+            return;
+        m_thread = std::thread(&XvbmLogger::run, this);
+        m_started.store(true, std::memory_order_release);
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lk(m_lock);
+        while (!m_stop) {
+            drain_l();
+            m_cv.wait_for(lk, std::chrono::milliseconds(LOG_WRITER_WAKE_MS));
+        }
+    }
+
+    void drain_l()
+    {
+        for (;;) {
+            XvbmLogSlot *slot = &m_slots[m_dequeue_pos % LOG_QUEUE_SLOTS];
+            if (slot->m_seq.load(std::memory_order_acquire) != m_dequeue_pos + 1)
+                break;
+            emit_l(slot->m_level, slot->m_msg);
+            slot->m_seq.store(m_dequeue_pos + LOG_QUEUE_SLOTS, std::memory_order_release);
+            m_dequeue_pos++;
+        }
+        uint64_t dropped = m_dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped) {
+            char msg[64];
+            snprintf(msg, sizeof(msg), "log queue full, %llu messages dropped",
+                     (unsigned long long)dropped);
+            emit_l(XVBM_LOG_WARNING, msg);
+        }
+    }
+
+    void emit_l(XvbmLogLevel level, const char *msg)
+    {
+        static const int prio[] = { LOG_ERR, LOG_WARNING, LOG_INFO, LOG_DEBUG };
+
+        switch (m_sink) {
+        case XVBM_LOG_SINK_SYSLOG:
+            syslog(prio[level], "%s", msg);
+            break;
+        case XVBM_LOG_SINK_CALLBACK:
+            m_callback(level, msg, m_user_data);
+            break;
+        default:
+            fprintf(stderr, "xvbm %s : %s\n", g_level_names[level], msg);
+            break;
+        }
+    }
+
+    XvbmLogSlot             m_slots[LOG_QUEUE_SLOTS];
+    alignas(64)
+    std::atomic<uint64_t>   m_enqueue_pos;
+    alignas(64)
+    uint64_t                m_dequeue_pos;
+    std::atomic<uint64_t>   m_dropped;
+    std::mutex              m_lock;
+    std::condition_variable m_cv;
+    std::mutex              m_start_lock;
+    std::thread             m_thread;
+    std::atomic<bool>       m_started;
+    std::atomic<bool>       m_stop;
+    XvbmLogSink             m_sink;
+    XvbmLogCallback         m_callback;
+    void                   *m_user_data;
+};
+
+// Never destroyed, other threads may still log while statics are torn down.
+// Plain new does not honour the alignas of the queue positions before C++17.
+static XvbmLogger *logger_create()
+{
+    void *mem = nullptr;
+
+    if (posix_memalign(&mem, alignof(XvbmLogger), sizeof(XvbmLogger)))
+        throw std::bad_alloc();
+    return new (mem) XvbmLogger;
+}
+
+static XvbmLogger &logger()
+{
+    static XvbmLogger &l = *logger_create();
+    return l;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+static bool rate_limit(XvbmLogSite *site, uint32_t *suppressed)
+{
+    uint64_t now = xvbm_now_ns();
+    uint64_t window = site->m_window_ns.load(std::memory_order_relaxed);
+
+    if (now - window >= LOG_RATE_WINDOW_NS &&
+        site->m_window_ns.compare_exchange_strong(window, now, std::memory_order_relaxed)) {
+        *suppressed = site->m_suppressed.exchange(0, std::memory_order_relaxed);
+        site->m_count.store(0, std::memory_order_relaxed);
+    }
+    if (site->m_count.fetch_add(1, std::memory_order_relaxed) >= LOG_RATE_BURST) {
+        site->m_suppressed.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+void xvbm_log_write(XvbmLogLevel  level,
+                    XvbmLogSite  *site,
+                    const char   *fmt, ...)
+{
+    uint32_t suppressed = 0;
+
+    if (level > g_xvbm_log_level.load(std::memory_order_relaxed))
+        return;
+    if (site && rate_limit(site, &suppressed))
+        return;
+
+    XvbmLogSlot *slot = logger().reserve();
+    if (slot == nullptr)
+        return;
+
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(slot->m_msg, LOG_MSG_SIZE, fmt, args);
+    va_end(args);
+    if (suppressed && len >= 0 && len < LOG_MSG_SIZE)
+        snprintf(slot->m_msg + len, LOG_MSG_SIZE - len,
+                 " (%u similar messages suppressed)", suppressed);
+    slot->m_level = level;
+    logger().publish(slot);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void xvbm_log_set_level(XvbmLogLevel level)
+{
+    g_xvbm_log_level.store(level, std::memory_order_relaxed);
+}
+
+int32_t xvbm_log_set_sink(XvbmLogSink      sink,
+                          XvbmLogCallback  callback,
+                          void            *user_data)
+{
+    if (sink == XVBM_LOG_SINK_CALLBACK && callback == nullptr)
+        return (-1);
+    logger().set_sink(sink, callback, user_data);
+    return 0;
+}
+
+void xvbm_log_flush(void)
+{
+    logger().flush();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// XVBM_LOG_LEVEL and XVBM_LOG_SINK are read at load time, queued messages
+// are written out at exit
+//////////////////////////////////////////////////////////////////////////////
+static struct XvbmLogEnv
+{
+    XvbmLogEnv()
+    {
+        const char *env = getenv("XVBM_LOG_LEVEL");
+        if (env) {
+            for (int32_t i = XVBM_LOG_ERROR; i <= XVBM_LOG_DEBUG; i++)
+                if (strcasecmp(env, g_level_names[i]) == 0)
+                    xvbm_log_set_level((XvbmLogLevel)i);
+        }
+        env = getenv("XVBM_LOG_SINK");
+        if (env && strcasecmp(env, "syslog") == 0)
+            xvbm_log_set_sink(XVBM_LOG_SINK_SYSLOG, nullptr, nullptr);
+    }
+
+    ~XvbmLogEnv() { logger().stop(); }
+} g_log_env;
@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later OR Apache-2.0 */
+
+/*
+ * Copyright (C) 2019-2021 Xilinx Inc - All rights reserved
+ * Xilinx Video Buffer Manager (Xvbm)
+ *
+ * This file is dual-licensed; you may select either the GNU
+ * Lesser General Public License version 3 or
+ * Apache License, Version 2.0.
+ *
+ */
+
+#ifndef _XVBM_LOG_H_
+#define _XVBM_LOG_H_
+
+#include <atomic>
+#include <cstdint>
+#include "xvbm.h"
+
+// Messages are formatted by the caller into a slot of a lock-free queue and
+// written to the sink by a background thread, so logging never takes the
+// stdio lock while a pool or shadow lock is held.
+
+// Rate limit state of one logging call site
+struct XvbmLogSite
+{
+    std::atomic<uint64_t> m_window_ns;
+    std::atomic<uint32_t> m_count;
+    std::atomic<uint32_t> m_suppressed;
+};
+
+extern std::atomic<int32_t> g_xvbm_log_level;
+
+// site may be NULL for output that must not be rate limited
+void xvbm_log_write(XvbmLogLevel  level,
+                    XvbmLogSite  *site,
+                    const char   *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+#define XVBM_LOG(level, ...)                                                   \
+    do {                                                                       \
+        if ((level) <= g_xvbm_log_level.load(std::memory_order_relaxed)) {     \
+            static XvbmLogSite xvbm_log_site_;                                 \
+            xvbm_log_write((level), &xvbm_log_site_, __VA_ARGS__);             \
+        }                                                                      \
+    } while (0)
+
+#define XVBM_ERROR(...)   XVBM_LOG(XVBM_LOG_ERROR, __VA_ARGS__)
+#define XVBM_WARNING(...) XVBM_LOG(XVBM_LOG_WARNING, __VA_ARGS__)
+#define XVBM_INFO(...)    XVBM_LOG(XVBM_LOG_INFO, __VA_ARGS__)
+#define XVBM_DEBUG(...)   XVBM_LOG(XVBM_LOG_DEBUG, __VA_ARGS__)
+
+#endif
@@ -0,0 +1,163 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later OR Apache-2.0 */
+
+/*
+ * Copyright (C) 2019-2021 Xilinx Inc - All rights reserved
+ * Xilinx Video Buffer Manager (Xvbm)
+ *
+ * This file is dual-licensed; you may select either the GNU
+ * Lesser General Public License version 3 or
+ * Apache License, Version 2.0.
+ *
+ */
+
+#include <sched.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <vector>
+#include "xvbm.h"
+#include "xvbm_numa.h"
+#include "xvbm_backend.h"
+#include "xvbm_log.h"
+
+// From linux/mempolicy.h, kept here to avoid a libnuma dependency
+#define XVBM_MPOL_PREFERRED 1
+
+//////////////////////////////////////////////////////////////////////////////
+// Topology, CPU to node table read from sysfs
+//////////////////////////////////////////////////////////////////////////////
+struct XvbmNumaTopology
+{
+    std::vector<int32_t>  m_cpu_node;
+    int32_t               m_num_nodes = 1;
+
+    XvbmNumaTopology()
+    {
+        for (int32_t node = 0; ; node++) {
+            char path[128];
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+            FILE *fp = fopen(path, "r");
+            if (fp == nullptr)
+                break;
+            // Ranges such as "0-15,32-47"
+            int first, last;
+            while (fscanf(fp, "%d", &first) == 1) {
+                last = first;
+                int c = fgetc(fp);
+                if (c == '-') {
+                    if (fscanf(fp, "%d", &last) != 1)
+                        break;
+                    c = fgetc(fp);
+                }
+                if ((size_t)last >= m_cpu_node.size())
+                    m_cpu_node.resize(last + 1, -1);
+                for (int cpu = first; cpu <= last; cpu++)
+                    m_cpu_node[cpu] = node;
+                if (c != ',')
+                    break;
+            }
+            fclose(fp);
+            m_num_nodes = node + 1;
+        }
+    }
+};
+
+// Never destroyed, transfers may still look up nodes from other threads
+// while static objects are torn down at exit
+static XvbmNumaTopology& numa_topology()
+{
+    static XvbmNumaTopology &topo = *new XvbmNumaTopology;
+    return topo;
+}
+
+int32_t xvbm_numa_num_nodes()
+{
+    return numa_topology().m_num_nodes;
+}
+
+int32_t xvbm_numa_current_node()
+{
+    XvbmNumaTopology &topo = numa_topology();
+    int cpu = sched_getcpu();
+
+    if (cpu < 0 || (size_t)cpu >= topo.m_cpu_node.size())
+        return -1;
+    return topo.m_cpu_node[cpu];
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int32_t xvbm_numa_bind(void *ptr, size_t size, int32_t node)
+{
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)ptr + page - 1) & ~(page - 1);
+    uintptr_t end = ((uintptr_t)ptr + size) & ~(page - 1);
+    unsigned long mask[4] = {0};
+    const unsigned long bits = 8 * sizeof(unsigned long);
+
+    if (node < 0 || node >= (int32_t)(bits * 4) || end <= start)
+        return (-1);
+    mask[node / bits] = 1UL << (node % bits);
+    // Preferred rather than bound, so a full node falls back instead of
+    // failing the allocation
+    if (syscall(SYS_mbind, start, end - start, XVBM_MPOL_PREFERRED,
+                mask, bits * 4 + 1, 0) != 0) {
+        XVBM_WARNING("mbind to node %d failed", node);
+        return (-1);
+    }
+    return 0;
+}
+
+int32_t xvbm_numa_pin_thread(int32_t node)
+{
+    XvbmNumaTopology &topo = numa_topology();
+    cpu_set_t set;
+    bool any = false;
+
+    CPU_ZERO(&set);
+    for (size_t cpu = 0; cpu < topo.m_cpu_node.size() && cpu < CPU_SETSIZE; cpu++) {
+        if (topo.m_cpu_node[cpu] == node) {
+            CPU_SET(cpu, &set);
+            any = true;
+        }
+    }
+    if (!any || sched_setaffinity(0, sizeof(set), &set) != 0) {
+        XVBM_WARNING("can not pin thread to node %d", node);
+        return (-1);
+    }
+    return 0;
+}
+
+int32_t xvbm_numa_read_node(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    int node = -1;
+
+    if (fp == nullptr)
+        return (-1);
+    if (fscanf(fp, "%d", &node) != 1)
+        node = -1;
+    fclose(fp);
+
+    return node;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int32_t xvbm_device_numa_node_get(xclDeviceHandle d_handle)
+{
+    XvbmBackend *backend = xvbm_backend_get(d_handle);
+
+    if (backend == nullptr)
+        return (-1);
+    return backend->get_numa_node(d_handle);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int32_t xvbm_thread_numa_bind(xclDeviceHandle d_handle)
+{
+    int32_t node = xvbm_device_numa_node_get(d_handle);
+
+    if (node < 0)
+        return (-1);
+    return xvbm_numa_pin_thread(node);
+}
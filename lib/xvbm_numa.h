@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later OR Apache-2.0 */
+
+/*
+ * Copyright (C) 2019-2021 Xilinx Inc - All rights reserved
+ * Xilinx Video Buffer Manager (Xvbm)
+ *
+ * This file is dual-licensed; you may select either the GNU
+ * Lesser General Public License version 3 or
+ * Apache License, Version 2.0.
+ *
+ */
+
+#ifndef _XVBM_NUMA_H_
+#define _XVBM_NUMA_H_
+
+#include <cstdint>
+#include <cstddef>
+
+// NUMA topology from sysfs, read once. Nodes are -1 when unknown, and all
+// helpers are no-ops on single node machines.
+
+// Number of nodes with CPUs, 1 when the topology can not be read
+int32_t xvbm_numa_num_nodes();
+
+// Node of the CPU the calling thread currently runs on
+int32_t xvbm_numa_current_node();
+
+// Prefer node for the pages fully inside [ptr, ptr + size). Must be called
+// before the memory is first touched; returns 0 on success.
+int32_t xvbm_numa_bind(void *ptr, size_t size, int32_t node);
+
+// Restrict the calling thread to the CPUs of node; returns 0 on success.
+int32_t xvbm_numa_pin_thread(int32_t node);
+
+// Node of a PCIe device from its sysfs numa_node file
+int32_t xvbm_numa_read_node(const char *path);
+
+#endif
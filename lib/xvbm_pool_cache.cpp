@@ -0,0 +1,260 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later OR Apache-2.0 */
+
+/*
+ * Copyright (C) 2019-2021 Xilinx Inc - All rights reserved
+ * Xilinx Video Buffer Manager (Xvbm)
+ *
+ * This file is dual-licensed; you may select either the GNU
+ * Lesser General Public License version 3 or
+ * Apache License, Version 2.0.
+ *
+ */
+
+#include <condition_variable>
+#include <thread>
+#include "xvbm.h"
+#include "xvbm_private.h"
+#include "xvbm_log.h"
+
+// Dormant pools, oldest first. Pools are looked up newest first so that a
+// channel restarting right away gets the buffers it just released.
+class XvbmPoolCache
+{
+public:
+    XvbmPoolCache()
+    {
+        const char *env = getenv("XVBM_POOL_CACHE_MB");
+        if (env && atoll(env) > 0)
+            m_max_bytes = (uint64_t)atoll(env) << 20;
+        env = getenv("XVBM_POOL_CACHE_AGE_MS");
+        if (env && atoi(env) > 0)
+            m_max_age_ms = atoi(env);
+        if (m_max_bytes && m_max_age_ms)
+            m_reaper = std::thread(&XvbmPoolCache::run, this);
+    }
+
+    void config(uint64_t max_bytes, uint32_t max_age_ms)
+    {
+        std::list<XvbmBufferPool*> victims;
+        bool reap;
+
+        // Only the caller of config starts or stops the reaper. The age
+        // changes under the same lock, so no other config can restart a
+        // reaper that is being joined.
+        std::lock_guard<std::mutex> reaper_guard(m_reaper_lock);
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            m_max_bytes = max_bytes;
+            m_max_age_ms = max_bytes ? max_age_ms : 0;
+            reap = m_max_age_ms != 0;
+            evict_l(victims, xvbm_now_ns());
+        }
+        m_cond.notify_all();
+        free_pools(victims);
+
+        if (reap && !m_reaper.joinable()) {
+            m_reaper = std::thread(&XvbmPoolCache::run, this);
+        } else if (!reap && m_reaper.joinable()) {
+            m_reaper.join();
+        }
+    }
+
+    bool put(XvbmBufferPool *pool)
+    {
+        uint64_t bytes = (uint64_t)pool->get_num_buffers() * pool->m_size;
+        std::list<XvbmBufferPool*> victims;
+
+        if (pool->m_share)
+            return false;
+        // Once listed the pool may be revived and registered again at once
+        xvbm_pool_unregister(pool);
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            if (bytes == 0 || bytes > m_max_bytes)
+                return false;
+            m_dormant.push_back({pool, xvbm_now_ns(), bytes});
+            m_bytes += bytes;
+            evict_l(victims, xvbm_now_ns());
+        }
+        free_pools(victims);
+        return true;
+    }
+
+    XvbmBufferPool* get(xclDeviceHandle     d_handle,
+                        int32_t             num_buffers,
+                        size_t              size,
+                        uint32_t            flags,
+                        const XvbmPoolAttr &attr)
+    {
+        XvbmBufferPool *pool = nullptr;
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            if (m_max_bytes == 0)
+                return nullptr;
+            for (auto it = m_dormant.rbegin(); it != m_dormant.rend(); ++it) {
+                XvbmBufferPool *p = it->m_pool;
+                if (p->m_dev_handle == d_handle && p->get_num_buffers() == num_buffers &&
+                    p->m_size == size && p->m_flags == flags && p->m_tenant == attr.tenant &&
+                    p->m_meta_size == attr.meta_size) {
+                    pool = p;
+                    m_bytes -= it->m_bytes;
+                    m_dormant.erase(std::next(it).base());
+                    break;
+                }
+            }
+            if (pool)
+                m_hits++;
+            else
+                m_misses++;
+        }
+        if (pool)
+            pool->revive();
+        return pool;
+    }
+
+    void flush(xclDeviceHandle d_handle)
+    {
+        std::list<XvbmBufferPool*> victims;
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            for (auto it = m_dormant.begin(); it != m_dormant.end();) {
+                if (d_handle == nullptr || it->m_pool->m_dev_handle == d_handle) {
+                    victims.push_back(it->m_pool);
+                    m_bytes -= it->m_bytes;
+                    it = m_dormant.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        free_pools(victims);
+        xvbm_reclaim_wait(d_handle, XVBM_WAIT_FOREVER);
+    }
+
+    void charges(xclDeviceHandle d_handle, XvbmCharges &charges)
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        for (auto &e : m_dormant) {
+            if (e.m_pool->m_dev_handle == d_handle)
+                charges.push_back({e.m_pool->m_tenant, e.m_pool->m_charged});
+        }
+    }
+
+    void get_stats(XvbmPoolCacheStats *stats)
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        stats->hits = m_hits;
+        stats->misses = m_misses;
+        stats->evictions = m_evictions;
+        stats->dormant_pools = m_dormant.size();
+        stats->dormant_bytes = m_bytes;
+    }
+
+private:
+    struct Entry
+    {
+        XvbmBufferPool *m_pool;
+        uint64_t        m_since_ns;
+        uint64_t        m_bytes;
+    };
+
+    // Moves pools over budget or past their age to victims, oldest first
+    void evict_l(std::list<XvbmBufferPool*> &victims, uint64_t now)
+    {
+        uint64_t max_age_ns = (uint64_t)m_max_age_ms * 1000000;
+
+        while (!m_dormant.empty()) {
+            Entry &e = m_dormant.front();
+            if (m_bytes <= m_max_bytes && (max_age_ns == 0 || now - e.m_since_ns < max_age_ns))
+                break;
+            victims.push_back(e.m_pool);
+            m_bytes -= e.m_bytes;
+            m_evictions++;
+            m_dormant.pop_front();
+        }
+    }
+
+    // Pools are freed without the cache lock, freeing BOs may take a while
+    static void free_pools(std::list<XvbmBufferPool*> &victims)
+    {
+        for (auto pool : victims)
+            xvbm_pool_free(pool);
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> guard(m_lock);
+        while (m_max_age_ms) {
+            std::list<XvbmBufferPool*> victims;
+            // Pools outlive their age by at most half of it
+            m_cond.wait_for(guard, std::chrono::milliseconds(m_max_age_ms / 2 + 1));
+            evict_l(victims, xvbm_now_ns());
+            if (!victims.empty()) {
+                guard.unlock();
+                free_pools(victims);
+                guard.lock();
+            }
+        }
+    }
+
+    std::mutex              m_lock;
+    std::condition_variable m_cond;
+    std::list<Entry>        m_dormant;
+    uint64_t                m_bytes = 0;
+    uint64_t                m_max_bytes = 0;
+    uint32_t                m_max_age_ms = 0;
+    uint64_t                m_hits = 0;
+    uint64_t                m_misses = 0;
+    uint64_t                m_evictions = 0;
+    std::mutex              m_reaper_lock;
+    std::thread             m_reaper;
+};
+
+// Never destroyed, dormant pools may still be freed by the reaper at exit
+static XvbmPoolCache& cache()
+{
+    static XvbmPoolCache *c = new XvbmPoolCache();
+    return *c;
+}
+
+bool xvbm_pool_cache_put(XvbmBufferPool *pool)
+{
+    return cache().put(pool);
+}
+
+XvbmBufferPool* xvbm_pool_cache_get(xclDeviceHandle     d_handle,
+                                    int32_t             num_buffers,
+                                    size_t              size,
+                                    uint32_t            flags,
+                                    const XvbmPoolAttr &attr)
+{
+    return cache().get(d_handle, num_buffers, size, flags, attr);
+}
+
+void xvbm_pool_cache_charges(xclDeviceHandle d_handle, XvbmCharges &charges)
+{
+    cache().charges(d_handle, charges);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int32_t xvbm_pool_cache_config(uint64_t max_bytes,
+                               uint32_t max_age_ms)
+{
+    cache().config(max_bytes, max_age_ms);
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void xvbm_pool_cache_flush(xclDeviceHandle d_handle)
+{
+    cache().flush(d_handle);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int32_t xvbm_pool_cache_stats_get(XvbmPoolCacheStats *stats)
+{
+    if (stats == nullptr)
+        return (-1);
+    cache().get_stats(stats);
+    return 0;
+}
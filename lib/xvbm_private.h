@@ -14,17 +14,26 @@
 #define _XVBM_PRIVATE_H_
 
 #include <vector>
+#include <algorithm>
 #include <list>
 #include <map>
 #include <atomic>
-#include <iostream>
 #include <cstdint>
 #include <cstdlib>
 #include <mutex>
+#include <shared_mutex>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
 #include <xclhal2.h>
+#include "xvbm.h"
+#include "xvbm_backend.h"
 
 //@TODO decouple XvbmBuffer/XvbmBufferPool
 
+// Alignment of per buffer user metadata
+#define XVBM_META_ALIGN 64
+
 /* @TODO
     All members need not be public
 */
@@ -37,8 +46,30 @@ typedef struct XvbmBuffer
     size_t                m_size;
     uint64_t              m_paddr;
     void                 *m_hptr;
-    uint32_t              m_ref_cnt;
-    std::mutex            m_rdlock;
+    std::atomic<uint32_t> m_ref_cnt;
+    // DDR bank, whether the buffer was ever handed out and the priority
+    // class holding it, all guarded by the pool lock
+    uint32_t              m_bank;
+    bool                  m_touched;
+    XvbmPriority          m_prio;
+
+    // Device/host coherence tracking. m_dev_gen is bumped on every
+    // device-side write; the host shadow holds a copy of the device range
+    // [m_shadow_start, m_shadow_end) as of generation m_shadow_gen.
+    // m_shadow_lock guards the shadow contents and state only, transfers
+    // that do not use the shadow run without it.
+    std::shared_timed_mutex m_shadow_lock;
+    std::atomic<uint64_t> m_dev_gen;
+    uint64_t              m_shadow_gen;
+    size_t                m_shadow_start;
+    size_t                m_shadow_end;
+    std::atomic<bool>     m_hptr_exported;
+
+    // Views reference a region of a parent buffer; they own no device or
+    // host memory and hold a reference on the parent for their lifetime
+    XvbmBuffer           *m_parent;
+    size_t                m_offset;
+    size_t                m_pitch;
 
     XvbmBuffer(XvbmPoolHandle p_handle,
                uint32_t       bo_handle,
@@ -52,10 +83,53 @@ typedef struct XvbmBuffer
                    m_size(size),
                    m_paddr(paddr),
                    m_hptr(hptr),
-                   m_ref_cnt(0) {}
+                   m_ref_cnt(0),
+                   m_bank(0),
+                   m_touched(false),
+                   m_prio(XVBM_PRIO_NORMAL),
+                   m_dev_gen(1),
+                   m_shadow_gen(0),
+                   m_shadow_start(0),
+                   m_shadow_end(0),
+                   m_hptr_exported(false),
+                   m_parent(nullptr),
+                   m_offset(0),
+                   m_pitch(0) {}
+
+    XvbmBuffer(XvbmBuffer *parent,
+               size_t      offset,
+               size_t      size,
+               size_t      pitch) :
+                   m_p_handle(parent->m_p_handle),
+                   m_bo_handle(parent->m_bo_handle),
+                   m_buffer_id(parent->m_buffer_id),
+                   m_size(size),
+                   m_paddr(parent->m_paddr + offset),
+                   m_hptr((unsigned char*)parent->m_hptr + offset),
+                   m_ref_cnt(1),
+                   m_bank(parent->m_bank),
+                   m_touched(true),
+                   m_prio(parent->m_prio),
+                   m_dev_gen(0),
+                   m_shadow_gen(0),
+                   m_shadow_start(0),
+                   m_shadow_end(0),
+                   m_hptr_exported(false),
+                   m_parent(parent),
+                   m_offset(offset),
+                   m_pitch(pitch) {}
 
     ~XvbmBuffer() {}
 
+    // Buffers are allocated with the pool's metadata slot right behind
+    // them; views have none and use the slot of their parent
+    static void* operator new(size_t size, uint32_t meta_size);
+    static void* operator new(size_t size) { return operator new(size, 0U); }
+    static void operator delete(void *ptr) { free(ptr); }
+    static void operator delete(void *ptr, uint32_t) { free(ptr); }
+    static size_t meta_offset() { return (sizeof(XvbmBuffer) + XVBM_META_ALIGN - 1) & ~(size_t)(XVBM_META_ALIGN - 1); }
+    void *meta() { return (char*)root() + meta_offset(); }
+
     XvbmPoolHandle get_pool_handle() { return m_p_handle; }
 
     int32_t write_buffer(const void *src,
@@ -66,6 +140,16 @@ typedef struct XvbmBuffer
                         size_t   size,
                         size_t   offset);
 
+    int32_t copy_buffer(XvbmBuffer *src,
+                        size_t      size,
+                        size_t      dst_offset,
+                        size_t      src_offset);
+
+    int32_t bounce_copy(XvbmBuffer *src,
+                        size_t      size,
+                        size_t      dst_offset,
+                        size_t      src_offset);
+
     uint32_t get_bo_handle() { return m_bo_handle; }
 
     uint32_t get_id() { return m_buffer_id; }
@@ -73,50 +157,317 @@ typedef struct XvbmBuffer
     size_t get_size() { return m_size; }
 
     uint64_t get_paddr() { return m_paddr; }
-    void *get_host_ptr() { return m_hptr; }
+
+    // Once the caller holds the shadow pointer it may be modified at any
+    // time, so it can no longer be trusted to mirror the device
+    void *get_host_ptr() { root()->m_hptr_exported = true; return m_hptr; }
+
+    uint64_t get_generation() { return root()->m_dev_gen.load(); }
+    void invalidate() { ++root()->m_dev_gen; }
+
+    bool is_view() { return m_parent != nullptr; }
+    XvbmBuffer *root() { return m_parent ? m_parent : this; }
+    size_t get_pitch() { return m_pitch; }
+    size_t get_view_offset() { return m_offset; }
+
+    bool shadow_valid_l(uint64_t gen, size_t size, size_t offset);
+    void shadow_update_l(uint64_t gen, size_t size, size_t offset);
 
 } XvbmBuffer;
 
+static inline uint64_t xvbm_now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Log2 latency histogram, bucket i counts samples in [2^i, 2^(i+1)) ns
+struct XvbmHistogram
+{
+    std::atomic<uint64_t> m_bucket[XVBM_STATS_HIST_BUCKETS];
+
+    XvbmHistogram() { reset(); }
+    void record(uint64_t ns);
+    void get(uint64_t *buckets);
+    void reset();
+};
+
+// Pool counters, updated with relaxed atomics so they can be read at any
+// time without the pool lock
+struct XvbmPoolCounters
+{
+    std::atomic<uint64_t> m_allocs;
+    std::atomic<uint64_t> m_frees;
+    std::atomic<uint64_t> m_failed_allocs;
+    std::atomic<uint32_t> m_inuse;
+    std::atomic<uint32_t> m_inuse_high_water;
+    std::atomic<uint32_t> m_touched;
+    std::atomic<uint64_t> m_extends;
+    std::atomic<uint64_t> m_lock_contentions;
+    std::atomic<uint64_t> m_lock_wait_ns;
+    XvbmHistogram         m_alloc_latency;
+    XvbmHistogram         m_free_latency;
+
+    XvbmPoolCounters() : m_inuse(0), m_touched(0) { reset(); }
+    void reset();
+    void get(XvbmPoolStats *stats);
+};
+
+// Allocation counters of one priority class. m_inuse only changes under
+// the pool lock, everything may be read without it.
+struct XvbmPrioCounters
+{
+    std::atomic<uint32_t> m_inuse;
+    std::atomic<uint32_t> m_inuse_high_water;
+    std::atomic<uint64_t> m_allocs;
+    std::atomic<uint64_t> m_failed_allocs;
+    std::atomic<uint64_t> m_denied;
+    std::atomic<uint64_t> m_waits;
+    std::atomic<uint64_t> m_wait_timeouts;
+    std::atomic<uint64_t> m_wait_ns;
+    std::atomic<uint64_t> m_max_wait_ns;
+
+    XvbmPrioCounters() : m_inuse(0) { reset(); }
+    void record_wait(uint64_t ns, bool timed_out);
+    void reset();
+    void get(XvbmPrioStats *stats);
+};
+
+// Transfer counters for one direction
+struct XvbmXferCounters
+{
+    std::atomic<uint64_t> m_calls;
+    std::atomic<uint64_t> m_bytes;
+    std::atomic<uint64_t> m_staged;
+    std::atomic<uint64_t> m_direct;
+    std::atomic<uint64_t> m_cached;
+    std::atomic<uint64_t> m_cached_bytes;
+    std::atomic<uint64_t> m_errors;
+    std::atomic<uint64_t> m_remote;
+    std::atomic<uint64_t> m_dma_ns;
+    std::atomic<uint64_t> m_memcpy_ns;
+    XvbmHistogram         m_dma_latency;
+    XvbmHistogram         m_memcpy_latency;
+
+    XvbmXferCounters() { reset(); }
+    void record(size_t   size,
+                bool     staged,
+                uint64_t memcpy_ns,
+                uint64_t dma_ns,
+                int32_t  rc);
+    void record_cached(size_t size, uint64_t memcpy_ns);
+    void reset();
+    void get(XvbmXferStats *stats);
+};
+
+struct XvbmBufferPool;
+class XvbmPoolShare;
+
+// Registry of live pools, for process wide reporting
+void xvbm_pool_register(XvbmBufferPool *pool);
+void xvbm_pool_unregister(XvbmBufferPool *pool);
+void xvbm_pool_foreach(const std::function<void(XvbmBufferPool*)> &fn);
+
+// Bytes per DDR bank
+typedef std::map<uint32_t, uint64_t> XvbmBankBytes;
+
+uint32_t xvbm_bank_for(uint32_t flags, int32_t index);
+void xvbm_bank_bytes(uint32_t       flags,
+                     size_t         size,
+                     int32_t        first,
+                     int32_t        count,
+                     XvbmBankBytes &bytes);
+
+// Budget still charged to a pool that is dormant or queued for freeing
+struct XvbmCharge
+{
+    uint32_t      m_tenant;
+    XvbmBankBytes m_bytes;
+};
+typedef std::vector<XvbmCharge> XvbmCharges;
+
+// Device memory budgets. admit checks bytes against the budgets of their
+// banks and the device and, unless dry_run, charges them to the tenant.
+XvbmStatus xvbm_budget_admit(xclDeviceHandle      d_handle,
+                             uint32_t             tenant,
+                             const XvbmBankBytes &bytes,
+                             bool                 dry_run);
+void xvbm_budget_release(xclDeviceHandle      d_handle,
+                         uint32_t             tenant,
+                         const XvbmBankBytes &bytes);
+void xvbm_budget_forget(xclDeviceHandle d_handle);
+void xvbm_status_set(XvbmStatus status);
+
+// Frees a pool no longer referenced, on the reclaim thread when enabled.
+// reclaim_charges appends the charges of the device's pools not yet freed.
+void xvbm_pool_free(XvbmBufferPool *pool);
+void xvbm_reclaim_charges(xclDeviceHandle d_handle, XvbmCharges &charges);
+
+// Cache of dormant pools. put takes a pool whose last reference is gone
+// and returns false if it is not cached; get returns a revived pool
+// matching the arguments or NULL; charges appends the charges of the
+// device's dormant pools.
+bool xvbm_pool_cache_put(XvbmBufferPool *pool);
+XvbmBufferPool* xvbm_pool_cache_get(xclDeviceHandle     d_handle,
+                                    int32_t             num_buffers,
+                                    size_t              size,
+                                    uint32_t            flags,
+                                    const XvbmPoolAttr &attr);
+void xvbm_pool_cache_charges(xclDeviceHandle d_handle, XvbmCharges &charges);
+
 typedef struct XvbmBufferPool
 {
     xclDeviceHandle                      m_dev_handle;
-    int32_t                              m_num_buffers;
+    XvbmBackend                         *m_backend;
+    std::atomic<int32_t>                 m_num_buffers;
     size_t                               m_size;
     uint32_t                             m_flags;
     std::vector<uint32_t>                m_offsets;
     uint32_t                             m_ref_cnt;
     std::mutex                           m_lock;
+    // Serialises extend, which checks the budget without m_lock
+    std::mutex                           m_extend_lock;
+    std::atomic<bool>                    m_read_cache;
+    XvbmPoolCounters                     m_stats;
+    XvbmXferCounters                     m_xfer[XVBM_XFER_DIRS];
 
     std::vector<XvbmBuffer*>             m_alloc_vector;
     std::map<uint64_t, XvbmBuffer*>      m_paddr_map;
     std::list<XvbmBuffer*>               m_free_list;
     std::list<XvbmBuffer*>               m_inuse_list;
+    XvbmReusePolicy                      m_reuse;
+    uint32_t                             m_num_banks;
+    uint32_t                             m_next_bank;
+    // Node of the device when the host has several, -1 otherwise
+    int32_t                              m_numa_node;
+    // Bytes of transfers currently running, the load seen by pool groups
+    std::atomic<uint64_t>                m_inflight_bytes;
+    // State shared with other processes once exported or imported, the
+    // local lists then only reflect the references of this process
+    XvbmPoolShare                       *m_share;
+    // Signalled under m_lock when a buffer is freed while threads wait in
+    // entry_alloc_wait
+    std::condition_variable              m_free_cond;
+    uint32_t                             m_free_waiters;
+    // Size of the user metadata slot of each buffer
+    uint32_t                             m_meta_size;
+    // Owner in the device budgets and the bytes charged to it
+    uint32_t                             m_tenant;
+    XvbmBankBytes                        m_charged;
+    // Reservation and cap of each priority class, guarded by m_lock
+    uint32_t                             m_prio_reserved[XVBM_PRIO_CLASSES];
+    uint32_t                             m_prio_max[XVBM_PRIO_CLASSES];
+    XvbmPrioCounters                     m_prio[XVBM_PRIO_CLASSES];
 
     XvbmBufferPool(xclDeviceHandle dev_handle,
                    int32_t         num_buffers,
                    size_t          size,
                    uint32_t        flags) :
                        m_dev_handle(dev_handle),
+                       m_backend(xvbm_backend_get(dev_handle)),
                        m_num_buffers(num_buffers),
                        m_size(size),
                        m_flags(flags),
-                       m_ref_cnt(1) {}
+                       m_ref_cnt(1),
+                       m_read_cache(false),
+                       m_reuse(XVBM_REUSE_FIFO),
+                       m_num_banks(1),
+                       m_next_bank(0),
+                       m_numa_node(-1),
+                       m_inflight_bytes(0),
+                       m_share(nullptr),
+                       m_free_waiters(0),
+                       m_meta_size(0),
+                       m_tenant(0),
+                       m_prio_reserved(),
+                       m_prio_max() {}
 
-    ~XvbmBufferPool() {}
+    ~XvbmBufferPool() { xvbm_pool_unregister(this); }
 
     XvbmBuffer* create_buffer(int32_t i);
+    XvbmBuffer* add_buffer(int32_t index, uint32_t bo_handle, bool clear);
+    uint32_t bank_for(int32_t index) { return xvbm_bank_for(m_flags, index); }
+    XvbmStatus admit(int32_t first, int32_t count);
+    void uncharge(int32_t first, int32_t count);
+    void numa_check(XvbmXferDir dir);
     void create();
     void set_offset(uint32_t offset) { m_offsets.push_back(offset); }
     uint32_t get_offset(uint32_t offset_idx) { return m_offsets[offset_idx]; }
     int32_t extend(int32_t num_buffers);
     int32_t get_num_buffers() { return m_num_buffers; }
-    XvbmBuffer* entry_alloc();
+    bool prio_admits_l(XvbmPriority prio);
+    int32_t prio_set(XvbmPriority prio, uint32_t reserved, uint32_t max_inuse);
+    XvbmBuffer* entry_alloc(XvbmPriority prio = XVBM_PRIO_NORMAL);
+    XvbmBuffer* entry_alloc_wait(uint32_t timeout_ms, XvbmPriority prio = XVBM_PRIO_NORMAL);
+    void free_notify_l() { if (m_free_waiters) m_free_cond.notify_all(); }
+    XvbmBuffer* accept(uint64_t token);
+    std::list<XvbmBuffer*>::iterator reuse_next_l();
     bool entry_free(XvbmBuffer *buffer);
+    XvbmBuffer* make_writable(XvbmBuffer *buffer);
+    XvbmBuffer* view_create(XvbmBuffer *buffer,
+                            size_t      offset,
+                            size_t      size,
+                            size_t      pitch);
+    bool view_free(XvbmBuffer *view);
     XvbmBuffer* get_handle_by_paddr(uint64_t paddr);
     void destroy();
     XvbmBuffer* get_buffer_handle(uint32_t index);
     uint32_t get_freelist_count() { return m_free_list.size(); }
     bool destroy_l();
+    void teardown();
+    void retire();
+    void revive();
 } XvbmBufferPool;
 
+// Scoped pool lock accounting for contention on m_lock
+class XvbmPoolGuard
+{
+public:
+    explicit XvbmPoolGuard(XvbmBufferPool *pool) : m_pool(pool)
+    {
+        if (!m_pool->m_lock.try_lock())
+            lock_slow();
+    }
+    ~XvbmPoolGuard() { m_pool->m_lock.unlock(); }
+
+    XvbmPoolGuard(const XvbmPoolGuard&) = delete;
+    XvbmPoolGuard& operator=(const XvbmPoolGuard&) = delete;
+
+private:
+    void lock_slow();
+
+    XvbmBufferPool *m_pool;
+};
+
+// Scoped accounting of a transfer in m_inflight_bytes
+class XvbmXferLoad
+{
+public:
+    XvbmXferLoad(XvbmBufferPool *pool, size_t size) : m_pool(pool), m_size(size)
+    {
+        m_pool->m_inflight_bytes.fetch_add(m_size, std::memory_order_relaxed);
+    }
+    ~XvbmXferLoad() { m_pool->m_inflight_bytes.fetch_sub(m_size, std::memory_order_relaxed); }
+
+    XvbmXferLoad(const XvbmXferLoad&) = delete;
+    XvbmXferLoad& operator=(const XvbmXferLoad&) = delete;
+
+private:
+    XvbmBufferPool *m_pool;
+    size_t          m_size;
+};
+
+// One pool per device, allocations placed by m_policy
+typedef struct XvbmPoolGroup
+{
+    std::vector<XvbmBufferPool*>         m_pools;
+    std::atomic<XvbmGroupPolicy>         m_policy;
+    // Rotates the starting device so ties do not always go to the first
+    std::atomic<uint32_t>                m_next;
+
+    XvbmPoolGroup() : m_policy(XVBM_GROUP_MOST_FREE), m_next(0) {}
+
+    XvbmBuffer* entry_alloc(int32_t hint);
+} XvbmPoolGroup;
+
 #endif
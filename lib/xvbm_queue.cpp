@@ -0,0 +1,336 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later OR Apache-2.0 */
+
+/*
+ * Copyright (C) 2019-2021 Xilinx Inc - All rights reserved
+ * Xilinx Video Buffer Manager (Xvbm)
+ *
+ * This file is dual-licensed; you may select either the GNU
+ * Lesser General Public License version 3 or
+ * Apache License, Version 2.0.
+ *
+ */
+
+#include <thread>
+#include "xvbm.h"
+#include "xvbm_private.h"
+#include "xvbm_log.h"
+
+#define QUEUE_CACHE_LINE   64
+// Retries before a full or empty queue puts the thread to sleep
+#define QUEUE_SPIN_RETRIES 16
+
+// Bounded ring of buffer handles. The rings of the subclasses are lock
+// free; m_lock and the condition variables are only used by threads that
+// have to wait, and by the other side once it sees m_waiters set.
+class XvbmQueue
+{
+public:
+    explicit XvbmQueue(uint32_t capacity) : m_capacity(capacity), m_mask(capacity - 1),
+                                            m_closed(false), m_waiters(0) {}
+    virtual ~XvbmQueue() {}
+
+    virtual bool try_push(XvbmBuffer *buffer) = 0;
+    virtual XvbmBuffer* try_pop() = 0;
+    virtual uint32_t size() = 0;
+
+    int32_t push(XvbmBuffer *buffer, uint32_t timeout_ms);
+    XvbmBuffer* pop(uint32_t timeout_ms);
+    void close();
+
+protected:
+    const uint32_t m_capacity;
+    const uint64_t m_mask;
+
+private:
+    template <typename Op>
+    bool wait(std::condition_variable &cond, uint32_t timeout_ms, Op op);
+    void wake(std::condition_variable &cond);
+
+    std::atomic<bool>       m_closed;
+    std::atomic<uint32_t>   m_waiters;
+    std::mutex              m_lock;
+    std::condition_variable m_not_empty;
+    std::condition_variable m_not_full;
+};
+
+// Runs op until it succeeds, the queue is closed or the timeout expires
+template <typename Op>
+bool XvbmQueue::wait(std::condition_variable &cond, uint32_t timeout_ms, Op op)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    bool done = false;
+
+    for (int i = 0; timeout_ms && i < QUEUE_SPIN_RETRIES; i++) {
+        std::this_thread::yield();
+        if (op())
+            return true;
+    }
+    if (timeout_ms == 0)
+        return false;
+
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_waiters.fetch_add(1);
+    // Pairs with the fence in wake: either the other side sees the waiter
+    // or op below sees its update
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (;;) {
+        if ((done = op()) || m_closed.load(std::memory_order_acquire))
+            break;
+        if (timeout_ms == XVBM_WAIT_FOREVER) {
+            cond.wait(lock);
+        } else if (cond.wait_until(lock, deadline) == std::cv_status::timeout) {
+            done = op();
+            break;
+        }
+    }
+    m_waiters.fetch_sub(1);
+    return done;
+}
+
+void XvbmQueue::wake(std::condition_variable &cond)
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_waiters.load(std::memory_order_relaxed) == 0)
+        return;
+    // A waiter holds the lock from its last check until it sleeps
+    { std::lock_guard<std::mutex> guard(m_lock); }
+    cond.notify_all();
+}
+
+int32_t XvbmQueue::push(XvbmBuffer *buffer, uint32_t timeout_ms)
+{
+    if (m_closed.load(std::memory_order_acquire))
+        return (-1);
+    if (!try_push(buffer) &&
+        !wait(m_not_full, timeout_ms, [&]() { return try_push(buffer); }))
+        return (-1);
+    wake(m_not_empty);
+    return 0;
+}
+
+XvbmBuffer* XvbmQueue::pop(uint32_t timeout_ms)
+{
+    XvbmBuffer *buffer = try_pop();
+
+    if (buffer == nullptr) {
+        if (m_closed.load(std::memory_order_acquire))
+            timeout_ms = 0;
+        wait(m_not_empty, timeout_ms, [&]() { return (buffer = try_pop()) != nullptr; });
+        if (buffer == nullptr)
+            return nullptr;
+    }
+    wake(m_not_full);
+    return buffer;
+}
+
+void XvbmQueue::close()
+{
+    m_closed.store(true, std::memory_order_release);
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+    }
+    m_not_empty.notify_all();
+    m_not_full.notify_all();
+}
+
+// Single producer, single consumer. Each side keeps a copy of the other
+// side's index and only rereads it when the ring looks full or empty.
+class XvbmSpscQueue : public XvbmQueue
+{
+public:
+    explicit XvbmSpscQueue(uint32_t capacity) : XvbmQueue(capacity), m_ring(capacity) {}
+
+    bool try_push(XvbmBuffer *buffer)
+    {
+        uint64_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head_cache == m_capacity) {
+            m_head_cache = m_head.load(std::memory_order_acquire);
+            if (tail - m_head_cache == m_capacity)
+                return false;
+        }
+        m_ring[tail & m_mask] = buffer;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    XvbmBuffer* try_pop()
+    {
+        uint64_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail_cache) {
+            m_tail_cache = m_tail.load(std::memory_order_acquire);
+            if (head == m_tail_cache)
+                return nullptr;
+        }
+        XvbmBuffer *buffer = m_ring[head & m_mask];
+        m_head.store(head + 1, std::memory_order_release);
+        return buffer;
+    }
+
+    uint32_t size()
+    {
+        return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+    }
+
+private:
+    // The two sides are kept a cache line apart, the padding works without
+    // over-aligned allocations
+    std::vector<XvbmBuffer*>  m_ring;
+    char                      m_pad0[QUEUE_CACHE_LINE];
+    // Consumer side
+    std::atomic<uint64_t>     m_head{0};
+    uint64_t                  m_tail_cache = 0;
+    char                      m_pad1[QUEUE_CACHE_LINE];
+    // Producer side
+    std::atomic<uint64_t>     m_tail{0};
+    uint64_t                  m_head_cache = 0;
+};
+
+// Multiple producers and consumers. Every slot carries a sequence number
+// telling which lap of the ring may write or read it next, so a producer
+// and a consumer only contend on the index of their own side.
+class XvbmMpmcQueue : public XvbmQueue
+{
+public:
+    explicit XvbmMpmcQueue(uint32_t capacity) : XvbmQueue(capacity), m_slots(capacity)
+    {
+        for (uint32_t i = 0; i < capacity; i++)
+            m_slots[i].m_seq.store(i, std::memory_order_relaxed);
+    }
+
+    bool try_push(XvbmBuffer *buffer)
+    {
+        uint64_t pos = m_tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot &slot = m_slots[pos & m_mask];
+            int64_t diff = (int64_t)slot.m_seq.load(std::memory_order_acquire) - (int64_t)pos;
+            if (diff == 0) {
+                if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.m_buffer = buffer;
+                    slot.m_seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    XvbmBuffer* try_pop()
+    {
+        uint64_t pos = m_head.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot &slot = m_slots[pos & m_mask];
+            int64_t diff = (int64_t)slot.m_seq.load(std::memory_order_acquire) - (int64_t)(pos + 1);
+            if (diff == 0) {
+                if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    XvbmBuffer *buffer = slot.m_buffer;
+                    slot.m_seq.store(pos + m_capacity, std::memory_order_release);
+                    return buffer;
+                }
+            } else if (diff < 0) {
+                return nullptr;
+            } else {
+                pos = m_head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    uint32_t size()
+    {
+        uint64_t head = m_head.load(std::memory_order_acquire);
+        uint64_t tail = m_tail.load(std::memory_order_acquire);
+        return tail > head ? std::min<uint64_t>(tail - head, m_capacity) : 0;
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<uint64_t> m_seq;
+        XvbmBuffer           *m_buffer = nullptr;
+    };
+
+    std::vector<Slot>         m_slots;
+    char                      m_pad0[QUEUE_CACHE_LINE];
+    std::atomic<uint64_t>     m_head{0};
+    char                      m_pad1[QUEUE_CACHE_LINE];
+    std::atomic<uint64_t>     m_tail{0};
+};
+
+//////////////////////////////////////////////////////////////////////////////
+XvbmQueueHandle xvbm_queue_create(XvbmQueueType type,
+                                  uint32_t      capacity)
+{
+    if (capacity == 0 || capacity > (1U << 31)) {
+        XVBM_ERROR("invalid queue capacity %u", capacity);
+        return nullptr;
+    }
+    // Power of two, so positions map to slots with a mask
+    uint32_t n = 1;
+    while (n < capacity)
+        n <<= 1;
+
+    switch (type) {
+    case XVBM_QUEUE_SPSC:
+        return static_cast<XvbmQueue*>(new XvbmSpscQueue(n));
+    case XVBM_QUEUE_MPMC:
+        return static_cast<XvbmQueue*>(new XvbmMpmcQueue(n));
+    default:
+        XVBM_ERROR("unknown queue type %d", type);
+        return nullptr;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void xvbm_queue_destroy(XvbmQueueHandle q_handle)
+{
+    XvbmQueue *queue = static_cast<XvbmQueue*>(q_handle);
+    XvbmBuffer *buffer;
+
+    if (queue == nullptr)
+        return;
+    while ((buffer = queue->try_pop()) != nullptr)
+        xvbm_buffer_pool_entry_free(buffer);
+    delete queue;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int32_t xvbm_queue_push(XvbmQueueHandle  q_handle,
+                        XvbmBufferHandle b_handle,
+                        uint32_t         timeout_ms)
+{
+    XvbmQueue *queue = static_cast<XvbmQueue*>(q_handle);
+
+    if (queue == nullptr || b_handle == nullptr)
+        return (-1);
+    return queue->push(static_cast<XvbmBuffer*>(b_handle), timeout_ms);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+XvbmBufferHandle xvbm_queue_pop(XvbmQueueHandle q_handle,
+                                uint32_t        timeout_ms)
+{
+    XvbmQueue *queue = static_cast<XvbmQueue*>(q_handle);
+
+    if (queue == nullptr)
+        return nullptr;
+    return queue->pop(timeout_ms);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void xvbm_queue_close(XvbmQueueHandle q_handle)
+{
+    XvbmQueue *queue = static_cast<XvbmQueue*>(q_handle);
+
+    if (queue)
+        queue->close();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+uint32_t xvbm_queue_size(XvbmQueueHandle q_handle)
+{
+    XvbmQueue *queue = static_cast<XvbmQueue*>(q_handle);
+
+    return queue ? queue->size() : 0;
+}
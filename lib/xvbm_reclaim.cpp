@@ -0,0 +1,205 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later OR Apache-2.0 */
+
+/*
+ * Copyright (C) 2019-2021 Xilinx Inc - All rights reserved
+ * Xilinx Video Buffer Manager (Xvbm)
+ *
+ * This file is dual-licensed; you may select either the GNU
+ * Lesser General Public License version 3 or
+ * Apache License, Version 2.0.
+ *
+ */
+
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include "xvbm.h"
+#include "xvbm_private.h"
+
+// Frees pools on a worker thread so the thread dropping the last reference
+// does not wait for every BO and shadow to be released
+class XvbmReclaimer
+{
+public:
+    XvbmReclaimer()
+    {
+        const char *env = getenv("XVBM_RECLAIM_MB");
+        if (env && atoll(env) > 0)
+            config((uint64_t)atoll(env) << 20);
+    }
+
+    void config(uint64_t max_pending_bytes)
+    {
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            m_max_pending = max_pending_bytes;
+        }
+        m_cond.notify_all();
+
+        std::lock_guard<std::mutex> guard(m_thread_lock);
+        if (max_pending_bytes && !m_thread.joinable()) {
+            m_thread = std::thread(&XvbmReclaimer::run, this);
+        } else if (!max_pending_bytes && m_thread.joinable()) {
+            // The worker drains the queue before it exits
+            m_thread.join();
+        }
+    }
+
+    void release(XvbmBufferPool *pool)
+    {
+        uint64_t bytes = (uint64_t)pool->get_num_buffers() * pool->m_size;
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            if (m_max_pending && m_pending_bytes + bytes <= m_max_pending) {
+                m_queue.push_back(pool);
+                m_pending_bytes += bytes;
+                m_peak_bytes = std::max(m_peak_bytes, m_pending_bytes);
+                m_pending[pool->m_dev_handle]++;
+                m_charges.emplace(pool, std::make_pair(pool->m_dev_handle,
+                                                       XvbmCharge{pool->m_tenant, pool->m_charged}));
+                m_queued++;
+                m_cond.notify_all();
+                return;
+            }
+            // Disabled or over the cap, the caller pays
+            if (m_max_pending)
+                m_inline++;
+        }
+        teardown(pool);
+    }
+
+    int32_t wait(xclDeviceHandle d_handle, uint32_t timeout_ms)
+    {
+        std::unique_lock<std::mutex> guard(m_lock);
+        auto done = [&]() {
+            return d_handle ? m_pending.count(d_handle) == 0 : m_queue.empty() && m_pending.empty();
+        };
+        if (timeout_ms == XVBM_WAIT_FOREVER) {
+            m_done.wait(guard, done);
+            return 0;
+        }
+        return m_done.wait_for(guard, std::chrono::milliseconds(timeout_ms), done) ? 0 : (-1);
+    }
+
+    void charges(xclDeviceHandle d_handle, XvbmCharges &charges)
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        for (auto &c : m_charges) {
+            if (c.second.first == d_handle)
+                charges.push_back(c.second.second);
+        }
+    }
+
+    void get_stats(XvbmReclaimStats *stats)
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        stats->queued = m_queued;
+        stats->completed = m_completed;
+        stats->inline_frees = m_inline;
+        stats->pending_pools = m_queue.size() + m_running;
+        stats->pending_bytes = m_pending_bytes;
+        stats->peak_bytes = m_peak_bytes;
+        stats->teardown_ns = m_teardown_ns;
+        stats->max_teardown_ns = m_max_teardown_ns;
+    }
+
+private:
+    void teardown(XvbmBufferPool *pool)
+    {
+        uint64_t start = xvbm_now_ns();
+
+        pool->teardown();
+        delete pool;
+        uint64_t ns = xvbm_now_ns() - start;
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_teardown_ns += ns;
+        m_max_teardown_ns = std::max(m_max_teardown_ns, ns);
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> guard(m_lock);
+        for (;;) {
+            m_cond.wait(guard, [&]() { return !m_queue.empty() || !m_max_pending; });
+            if (m_queue.empty())
+                break;
+            XvbmBufferPool *pool = m_queue.front();
+            xclDeviceHandle d_handle = pool->m_dev_handle;
+            uint64_t bytes = (uint64_t)pool->get_num_buffers() * pool->m_size;
+            auto charge = m_charges.find(pool);
+            m_queue.pop_front();
+            m_running++;
+            guard.unlock();
+            teardown(pool);
+            guard.lock();
+            m_running--;
+            m_pending_bytes -= bytes;
+            m_completed++;
+            m_charges.erase(charge);
+            if (--m_pending[d_handle] == 0)
+                m_pending.erase(d_handle);
+            m_done.notify_all();
+        }
+    }
+
+    std::mutex                            m_lock;
+    std::condition_variable               m_cond;
+    std::condition_variable               m_done;
+    std::deque<XvbmBufferPool*>           m_queue;
+    // Pools queued or being freed per device
+    std::map<xclDeviceHandle, uint32_t>   m_pending;
+    // Budget the pools queued or being freed still hold. A freed pool's
+    // address may be queued again before its entry is erased.
+    std::multimap<XvbmBufferPool*, std::pair<xclDeviceHandle, XvbmCharge>> m_charges;
+    uint32_t                              m_running = 0;
+    uint64_t                              m_max_pending = 0;
+    uint64_t                              m_pending_bytes = 0;
+    uint64_t                              m_peak_bytes = 0;
+    uint64_t                              m_queued = 0;
+    uint64_t                              m_completed = 0;
+    uint64_t                              m_inline = 0;
+    uint64_t                              m_teardown_ns = 0;
+    uint64_t                              m_max_teardown_ns = 0;
+    std::mutex                            m_thread_lock;
+    std::thread                           m_thread;
+};
+
+// Never destroyed, the worker may still be freeing pools at exit
+static XvbmReclaimer& reclaimer()
+{
+    static XvbmReclaimer *r = new XvbmReclaimer();
+    return *r;
+}
+
+void xvbm_pool_free(XvbmBufferPool *pool)
+{
+    reclaimer().release(pool);
+}
+
+void xvbm_reclaim_charges(xclDeviceHandle d_handle, XvbmCharges &charges)
+{
+    reclaimer().charges(d_handle, charges);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int32_t xvbm_reclaim_config(uint64_t max_pending_bytes)
+{
+    reclaimer().config(max_pending_bytes);
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int32_t xvbm_reclaim_wait(xclDeviceHandle d_handle,
+                          uint32_t        timeout_ms)
+{
+    return reclaimer().wait(d_handle, timeout_ms);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int32_t xvbm_reclaim_stats_get(XvbmReclaimStats *stats)
+{
+    if (stats == nullptr)
+        return (-1);
+    reclaimer().get_stats(stats);
+    return 0;
+}
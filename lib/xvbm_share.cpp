@@ -0,0 +1,587 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later OR Apache-2.0 */
+
+/*
+ * Copyright (C) 2019-2021 Xilinx Inc - All rights reserved
+ * Xilinx Video Buffer Manager (Xvbm)
+ *
+ * This file is dual-licensed; you may select either the GNU
+ * Lesser General Public License version 3 or
+ * Apache License, Version 2.0.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include "xvbm.h"
+#include "xvbm_private.h"
+#include "xvbm_share.h"
+#include "xvbm_log.h"
+#include "xvbm_numa.h"
+
+// Buffer descriptors passed per message, well below the SCM_RIGHTS limit
+#define SHARE_FDS_PER_MSG 64
+
+//////////////////////////////////////////////////////////////////////////////
+// Shared pool state
+//////////////////////////////////////////////////////////////////////////////
+XvbmPoolShare::XvbmPoolShare(int fd, XvbmShareHeader *hdr, size_t map_size) :
+    m_fd(fd),
+    m_hdr(hdr),
+    m_map_size(map_size),
+    m_ring(reinterpret_cast<uint32_t*>(hdr + 1)),
+    m_refs(reinterpret_cast<uint16_t*>(m_ring + hdr->m_num_buffers)),
+    m_slot(XVBM_SHARE_MAX_PROCS),
+    m_live_fd(-1)
+{
+}
+
+size_t XvbmPoolShare::map_size(uint32_t num_buffers)
+{
+    return sizeof(XvbmShareHeader) + num_buffers * sizeof(uint32_t) +
+           2 * XVBM_SHARE_MAX_PROCS * num_buffers * sizeof(uint16_t);
+}
+
+XvbmPoolShare* XvbmPoolShare::create(const std::vector<uint32_t> &refs,
+                                     uint64_t                     size,
+                                     uint32_t                     flags)
+{
+    uint32_t num_buffers = refs.size();
+    size_t len = map_size(num_buffers);
+    int fd = memfd_create("xvbm_pool", MFD_CLOEXEC);
+
+    if (fd < 0 || ftruncate(fd, len) != 0) {
+        XVBM_ERROR("shared pool state alloc failed: %s", strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return nullptr;
+    }
+    void *mem = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED) {
+        XVBM_ERROR("shared pool state map failed: %s", strerror(errno));
+        close(fd);
+        return nullptr;
+    }
+
+    // The file is zero filled, only the header needs setting up
+    XvbmShareHeader *hdr = static_cast<XvbmShareHeader*>(mem);
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&hdr->m_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    hdr->m_num_buffers = num_buffers;
+    hdr->m_flags = flags;
+    hdr->m_size = size;
+
+    XvbmPoolShare *share = new XvbmPoolShare(fd, hdr, len);
+    share->take_slot_l(0);
+    for (uint32_t i = 0; i < num_buffers; i++)
+        share->refs_l(0, i) = refs[i];
+    share->rebuild_l();
+    __atomic_store_n(&hdr->m_magic, XVBM_SHARE_MAGIC, __ATOMIC_RELEASE);
+
+    return share;
+}
+
+XvbmPoolShare* XvbmPoolShare::attach(int fd)
+{
+    XvbmShareHeader probe;
+
+    if (pread(fd, &probe, sizeof(probe), 0) != sizeof(probe) ||
+        probe.m_magic != XVBM_SHARE_MAGIC) {
+        XVBM_ERROR("not a shared pool state");
+        close(fd);
+        return nullptr;
+    }
+    size_t len = map_size(probe.m_num_buffers);
+    void *mem = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED) {
+        XVBM_ERROR("shared pool state map failed: %s", strerror(errno));
+        close(fd);
+        return nullptr;
+    }
+
+    XvbmPoolShare *share = new XvbmPoolShare(fd, static_cast<XvbmShareHeader*>(mem), len);
+    XvbmShareHeader *hdr = share->m_hdr;
+    share->lock();
+    for (int pass = 0; pass < 2 && share->m_slot == XVBM_SHARE_MAX_PROCS; pass++) {
+        for (uint32_t i = 0; i < XVBM_SHARE_MAX_PROCS; i++) {
+            if (hdr->m_slots[i].m_pid == 0) {
+                share->take_slot_l(i);
+                break;
+            }
+        }
+        // Slots of processes that went away without detaching
+        if (share->m_slot == XVBM_SHARE_MAX_PROCS)
+            share->reclaim_l();
+    }
+    share->unlock();
+
+    if (share->m_slot == XVBM_SHARE_MAX_PROCS) {
+        XVBM_ERROR("shared pool already has %d processes attached", XVBM_SHARE_MAX_PROCS);
+        delete share;
+        return nullptr;
+    }
+    return share;
+}
+
+XvbmPoolShare::~XvbmPoolShare()
+{
+    if (m_slot < XVBM_SHARE_MAX_PROCS) {
+        lock();
+        // Handed off references that were never accepted go back too
+        clear_slot_l(m_slot);
+        rebuild_l();
+        unlock();
+    }
+    if (m_live_fd >= 0)
+        close(m_live_fd);
+    munmap(m_hdr, m_map_size);
+    close(m_fd);
+}
+
+void XvbmPoolShare::lock()
+{
+    int rc = pthread_mutex_lock(&m_hdr->m_lock);
+
+    // The owner died holding the lock, the free ring may be half updated
+    if (rc == EOWNERDEAD) {
+        pthread_mutex_consistent(&m_hdr->m_lock);
+        XVBM_WARNING("shared pool: process died holding the lock, recovering");
+        reclaim_l();
+        rebuild_l();
+    }
+}
+
+uint32_t XvbmPoolShare::total_l(uint32_t idx)
+{
+    uint32_t total = 0;
+
+    for (uint32_t s = 0; s < 2 * XVBM_SHARE_MAX_PROCS; s++)
+        total += refs_l(s, idx);
+    return total;
+}
+
+void XvbmPoolShare::clear_slot_l(uint32_t slot)
+{
+    for (uint32_t i = 0; i < m_hdr->m_num_buffers; i++) {
+        refs_l(slot, i) = 0;
+        handed_off_l(slot, i) = 0;
+    }
+    m_hdr->m_slots[slot].m_pid = 0;
+    m_hdr->m_slots[slot].m_locked = 0;
+}
+
+// The lock goes on a description opened here, the memfd received from the
+// exporting process shares its description, and so its locks, with it
+void XvbmPoolShare::take_slot_l(uint32_t slot)
+{
+    char path[64];
+    struct flock fl = {};
+
+    m_slot = slot;
+    m_hdr->m_slots[slot].m_pid = getpid();
+    m_hdr->m_slots[slot].m_gen++;
+    m_hdr->m_slots[slot].m_locked = 0;
+
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", m_fd);
+    m_live_fd = open(path, O_RDWR | O_CLOEXEC);
+    fl.l_type = F_WRLCK;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = slot;
+    fl.l_len = 1;
+    if (m_live_fd >= 0 && fcntl(m_live_fd, F_OFD_SETLK, &fl) == 0) {
+        m_hdr->m_slots[slot].m_locked = 1;
+        return;
+    }
+    XVBM_WARNING("shared pool: no liveness lock (%s), falling back to pid %d",
+                 strerror(errno), (int)getpid());
+    if (m_live_fd >= 0) {
+        close(m_live_fd);
+        m_live_fd = -1;
+    }
+}
+
+bool XvbmPoolShare::alive_l(uint32_t slot)
+{
+    int32_t pid = m_hdr->m_slots[slot].m_pid;
+    struct flock fl = {};
+
+    if (pid == 0)
+        return false;
+    if (slot == m_slot)
+        return true;
+    if (m_hdr->m_slots[slot].m_locked && m_live_fd >= 0) {
+        fl.l_type = F_WRLCK;
+        fl.l_whence = SEEK_SET;
+        fl.l_start = slot;
+        fl.l_len = 1;
+        if (fcntl(m_live_fd, F_OFD_GETLK, &fl) == 0)
+            return fl.l_type != F_UNLCK;
+    }
+    return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+void XvbmPoolShare::push_l(uint32_t idx)
+{
+    m_ring[(m_hdr->m_head + m_hdr->m_count) % m_hdr->m_num_buffers] = idx;
+    m_hdr->m_count++;
+}
+
+void XvbmPoolShare::rebuild_l()
+{
+    m_hdr->m_head = 0;
+    m_hdr->m_count = 0;
+    for (uint32_t i = 0; i < m_hdr->m_num_buffers; i++)
+        if (total_l(i) == 0)
+            push_l(i);
+}
+
+uint32_t XvbmPoolShare::reclaim_l()
+{
+    uint32_t before = m_hdr->m_count;
+    bool dead = false;
+
+    for (uint32_t s = 0; s < XVBM_SHARE_MAX_PROCS; s++) {
+        int32_t pid = m_hdr->m_slots[s].m_pid;
+        if (pid == 0 || alive_l(s))
+            continue;
+        XVBM_WARNING("shared pool: reclaiming buffers of dead process %d", pid);
+        clear_slot_l(s);
+        dead = true;
+    }
+    if (!dead)
+        return 0;
+    rebuild_l();
+
+    return m_hdr->m_count - before;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int32_t XvbmPoolShare::alloc()
+{
+    int32_t idx = -1;
+
+    lock();
+    if (m_hdr->m_count == 0)
+        reclaim_l();
+    if (m_hdr->m_count) {
+        idx = m_ring[m_hdr->m_head];
+        m_hdr->m_head = (m_hdr->m_head + 1) % m_hdr->m_num_buffers;
+        m_hdr->m_count--;
+        refs_l(m_slot, idx)++;
+    }
+    unlock();
+
+    return idx;
+}
+
+uint32_t XvbmPoolShare::free_count()
+{
+    lock();
+    // As for alloc, buffers of dead processes count once reclaimed
+    if (m_hdr->m_count == 0)
+        reclaim_l();
+    uint32_t count = m_hdr->m_count;
+    unlock();
+
+    return count;
+}
+
+void XvbmPoolShare::ref(uint32_t idx)
+{
+    lock();
+    refs_l(m_slot, idx)++;
+    unlock();
+}
+
+void XvbmPoolShare::unref(uint32_t idx)
+{
+    lock();
+    if (refs_l(m_slot, idx) == 0) {
+        XVBM_ERROR("shared pool: buffer #%u has no reference of this process", idx);
+    } else if (--refs_l(m_slot, idx) == 0 && total_l(idx) == 0) {
+        push_l(idx);
+    }
+    unlock();
+}
+
+uint32_t XvbmPoolShare::refs(uint32_t idx)
+{
+    lock();
+    uint32_t total = total_l(idx);
+    unlock();
+
+    return total;
+}
+
+uint64_t XvbmPoolShare::handoff(uint32_t idx)
+{
+    lock();
+    handed_off_l(m_slot, idx)++;
+    uint64_t token = ((uint64_t)(m_hdr->m_slots[m_slot].m_gen & 0xffff) << 48) |
+                     ((uint64_t)m_slot << 32) | idx;
+    unlock();
+
+    return token;
+}
+
+int32_t XvbmPoolShare::accept(uint64_t token)
+{
+    uint32_t gen = token >> 48;
+    uint32_t slot = (token >> 32) & 0xffff;
+    uint32_t idx = token & 0xffffffff;
+    int32_t ret = -1;
+
+    if (slot >= XVBM_SHARE_MAX_PROCS || idx >= m_hdr->m_num_buffers)
+        return (-1);
+    lock();
+    // The sender may have gone away meanwhile and taken the reference along
+    if (m_hdr->m_slots[slot].m_pid != 0 &&
+        (m_hdr->m_slots[slot].m_gen & 0xffff) == gen &&
+        handed_off_l(slot, idx) > 0) {
+        handed_off_l(slot, idx)--;
+        refs_l(m_slot, idx)++;
+        ret = idx;
+    }
+    unlock();
+
+    return ret;
+}
+
+uint32_t XvbmPoolShare::reclaim()
+{
+    lock();
+    uint32_t n = reclaim_l();
+    unlock();
+
+    return n;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Descriptor passing over a unix domain socket
+//////////////////////////////////////////////////////////////////////////////
+struct XvbmShareMsg
+{
+    uint64_t m_magic;
+    uint32_t m_first;           // index of the first buffer descriptor
+    uint32_t m_count;           // buffer descriptors in this message
+};
+
+static int32_t share_send(int sock, XvbmShareMsg *msg, const int *fds, uint32_t num_fds)
+{
+    char ctrl[CMSG_SPACE(sizeof(int) * (SHARE_FDS_PER_MSG + 1))];
+    struct iovec iov = { msg, sizeof(*msg) };
+    struct msghdr mh;
+
+    memset(&mh, 0, sizeof(mh));
+    memset(ctrl, 0, sizeof(ctrl));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    if (num_fds == 0)
+        return sendmsg(sock, &mh, MSG_NOSIGNAL) == sizeof(*msg) ? 0 : -1;
+    mh.msg_control = ctrl;
+    mh.msg_controllen = CMSG_SPACE(sizeof(int) * num_fds);
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(int) * num_fds);
+    memcpy(CMSG_DATA(cm), fds, sizeof(int) * num_fds);
+
+    if (sendmsg(sock, &mh, MSG_NOSIGNAL) != sizeof(*msg)) {
+        XVBM_ERROR("shared pool: send failed: %s", strerror(errno));
+        return (-1);
+    }
+    return 0;
+}
+
+static int32_t share_recv(int sock, XvbmShareMsg *msg, std::vector<int> &fds)
+{
+    char ctrl[CMSG_SPACE(sizeof(int) * (SHARE_FDS_PER_MSG + 1))];
+    struct iovec iov = { msg, sizeof(*msg) };
+    struct msghdr mh;
+
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = ctrl;
+    mh.msg_controllen = sizeof(ctrl);
+    if (recvmsg(sock, &mh, MSG_CMSG_CLOEXEC) != sizeof(*msg)) {
+        XVBM_ERROR("shared pool: receive failed: %s", strerror(errno));
+        return (-1);
+    }
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+            continue;
+        size_t n = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const int *p = reinterpret_cast<const int*>(CMSG_DATA(cm));
+        fds.insert(fds.end(), p, p + n);
+    }
+    if (msg->m_magic != XVBM_SHARE_MAGIC || (mh.msg_flags & MSG_CTRUNC)) {
+        XVBM_ERROR("shared pool: malformed message");
+        return (-1);
+    }
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int32_t xvbm_buffer_pool_export(XvbmPoolHandle p_handle, int sock)
+{
+    XvbmBufferPool *pool = static_cast<XvbmBufferPool*>(p_handle);
+    std::vector<int> fds;
+    int32_t rc = 0;
+
+    {
+        XvbmPoolGuard guard(pool);
+        if (pool->m_share == nullptr) {
+            std::vector<uint32_t> refs;
+            for (auto buf : pool->m_alloc_vector)
+                refs.push_back(buf->m_ref_cnt);
+            pool->m_share = XvbmPoolShare::create(refs, pool->m_size, pool->m_flags);
+            if (pool->m_share == nullptr)
+                return (-1);
+            // Other processes write without telling our shadows
+            pool->m_read_cache = false;
+        }
+        fds.push_back(pool->m_share->fd());
+        for (auto buf : pool->m_alloc_vector) {
+            int fd = pool->m_backend->export_bo(pool->m_dev_handle, buf->m_bo_handle);
+            if (fd < 0) {
+                XVBM_ERROR("export of buffer #%u failed", buf->m_buffer_id);
+                rc = -1;
+                break;
+            }
+            fds.push_back(fd);
+        }
+    }
+
+    // The state descriptor goes first, the buffers follow in batches
+    XvbmShareMsg msg = { XVBM_SHARE_MAGIC, 0, 0 };
+    size_t n = std::min(fds.size() - 1, (size_t)SHARE_FDS_PER_MSG);
+    msg.m_count = n;
+    if (rc == 0)
+        rc = share_send(sock, &msg, fds.data(), n + 1);
+    for (size_t sent = n + 1; rc == 0 && sent < fds.size(); sent += n) {
+        n = std::min(fds.size() - sent, (size_t)SHARE_FDS_PER_MSG);
+        msg.m_first = sent - 1;
+        msg.m_count = n;
+        rc = share_send(sock, &msg, fds.data() + sent, n);
+    }
+    for (size_t i = 1; i < fds.size(); i++)
+        close(fds[i]);
+
+    return rc;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+XvbmPoolHandle xvbm_buffer_pool_import(xclDeviceHandle d_handle, int sock)
+{
+    XvbmShareMsg msg;
+    std::vector<int> fds;
+
+    if (share_recv(sock, &msg, fds) || fds.empty()) {
+        for (int fd : fds)
+            close(fd);
+        return nullptr;
+    }
+    XvbmPoolShare *share = XvbmPoolShare::attach(fds[0]);
+    fds.erase(fds.begin());
+    if (share == nullptr) {
+        for (int fd : fds)
+            close(fd);
+        return nullptr;
+    }
+    while (fds.size() < share->num_buffers()) {
+        if (share_recv(sock, &msg, fds) || msg.m_first + msg.m_count != fds.size())
+            break;
+    }
+    if (fds.size() != share->num_buffers()) {
+        XVBM_ERROR("shared pool: expected %u buffers, received %zu",
+                   share->num_buffers(), fds.size());
+        for (int fd : fds)
+            close(fd);
+        delete share;
+        return nullptr;
+    }
+
+    XvbmBufferPool *pool = new XvbmBufferPool(d_handle, share->num_buffers(),
+                                              share->size(), share->flags());
+    bool ok = pool->m_backend != nullptr;
+    {
+        XvbmPoolGuard guard(pool);
+        pool->m_share = share;
+        // Other processes write without telling our shadows
+        pool->m_read_cache = false;
+        if (ok && xvbm_numa_num_nodes() > 1)
+            pool->m_numa_node = pool->m_backend->get_numa_node(d_handle);
+        for (uint32_t i = 0; ok && i < fds.size(); i++) {
+            uint32_t bo = pool->m_backend->import_bo(d_handle, fds[i]);
+            if (bo == NULLBO) {
+                XVBM_ERROR("import of buffer #%u failed", i);
+                ok = false;
+                break;
+            }
+            try {
+                pool->add_buffer(i, bo, false);
+            } catch (const std::bad_alloc&) {
+                ok = false;
+            }
+        }
+    }
+    for (int fd : fds)
+        close(fd);
+    if (!ok) {
+        // Releases the buffers imported so far and detaches
+        pool->destroy();
+        return nullptr;
+    }
+    xvbm_pool_register(pool);
+
+    return pool;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+uint64_t xvbm_buffer_handoff(XvbmBufferHandle b_handle)
+{
+    XvbmBuffer *buffer = static_cast<XvbmBuffer*>(b_handle);
+    XvbmBufferPool *pool = static_cast<XvbmBufferPool*>(buffer->get_pool_handle());
+
+    if (buffer->is_view())
+        buffer = buffer->m_parent;
+    XvbmPoolGuard guard(pool);
+    if (pool->m_share == nullptr || buffer->m_ref_cnt == 0) {
+        XVBM_ERROR("handoff of %p needs a referenced buffer of a shared pool", buffer);
+        return 0;
+    }
+    return pool->m_share->handoff(buffer->m_buffer_id);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+XvbmBufferHandle xvbm_buffer_pool_accept(XvbmPoolHandle p_handle,
+                                         uint64_t       token)
+{
+    XvbmBufferPool *pool = static_cast<XvbmBufferPool*>(p_handle);
+    XvbmBuffer *buffer = pool->accept(token);
+
+    if (buffer == nullptr)
+        XVBM_ERROR("stale or invalid handoff token %#" PRIx64, token);
+    return buffer;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int32_t xvbm_buffer_pool_reclaim(XvbmPoolHandle p_handle)
+{
+    XvbmBufferPool *pool = static_cast<XvbmBufferPool*>(p_handle);
+
+    XvbmPoolGuard guard(pool);
+    if (pool->m_share == nullptr)
+        return (-1);
+    return pool->m_share->reclaim();
+}
@@ -0,0 +1,117 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later OR Apache-2.0 */
+
+/*
+ * Copyright (C) 2019-2021 Xilinx Inc - All rights reserved
+ * Xilinx Video Buffer Manager (Xvbm)
+ *
+ * This file is dual-licensed; you may select either the GNU
+ * Lesser General Public License version 3 or
+ * Apache License, Version 2.0.
+ *
+ */
+
+#ifndef _XVBM_SHARE_H_
+#define _XVBM_SHARE_H_
+
+#include <pthread.h>
+#include <cstdint>
+#include <vector>
+
+// Pool state shared between processes. A memfd holds a header, a ring of
+// free buffer indices and tables of references per attached process. The
+// reference tables is authoritative: the free ring can always be rebuilt
+// from it, which is how state left behind by a crashed process is
+// repaired. References held by processes that no longer exist are dropped.
+//
+// An attached process holds a write lock on byte <slot> of the memfd
+// through an open file description of its own. The kernel drops the lock
+// when the process exits, so liveness is seen from any pid namespace and a
+// reused pid is not mistaken for the old process. Slots without such a
+// lock fall back to probing the pid, which needs a shared pid namespace.
+
+#define XVBM_SHARE_MAGIC     0x325248534d425658ull   // "XVBMSHR2"
+#define XVBM_SHARE_MAX_PROCS 16
+
+struct XvbmShareSlot
+{
+    int32_t  m_pid;             // 0 when free
+    uint32_t m_gen;             // bumped on every attach, part of handoff tokens
+    uint32_t m_locked;          // the process holds the lock of the slot
+};
+
+struct XvbmShareHeader
+{
+    uint64_t        m_magic;
+    uint32_t        m_num_buffers;
+    uint32_t        m_flags;
+    uint64_t        m_size;
+    pthread_mutex_t m_lock;     // robust and process shared
+    uint32_t        m_head;     // free ring, oldest entry first
+    uint32_t        m_count;
+    XvbmShareSlot   m_slots[XVBM_SHARE_MAX_PROCS];
+    // uint32_t     ring[m_num_buffers];
+    // uint16_t     refs[XVBM_SHARE_MAX_PROCS][m_num_buffers];
+    // uint16_t     handed_off[XVBM_SHARE_MAX_PROCS][m_num_buffers];
+};
+
+class XvbmPoolShare
+{
+public:
+    // New shared state for a pool whose buffer i currently has refs[i]
+    // references in the calling process
+    static XvbmPoolShare* create(const std::vector<uint32_t> &refs,
+                                 uint64_t                     size,
+                                 uint32_t                     flags);
+    // Attach to shared state received from another process, takes fd
+    static XvbmPoolShare* attach(int fd);
+    ~XvbmPoolShare();
+
+    int fd() const { return m_fd; }
+    uint32_t num_buffers() const { return m_hdr->m_num_buffers; }
+    uint64_t size() const { return m_hdr->m_size; }
+    uint32_t flags() const { return m_hdr->m_flags; }
+
+    // Buffer index with one reference for this process, -1 when none free
+    int32_t alloc();
+    // Buffers free in all processes
+    uint32_t free_count();
+    void ref(uint32_t idx);
+    // Drops one reference of this process
+    void unref(uint32_t idx);
+    // References of all processes
+    uint32_t refs(uint32_t idx);
+    // Token passing one reference of this process to another one
+    uint64_t handoff(uint32_t idx);
+    // Buffer index of a token, whose reference now belongs to this process
+    int32_t accept(uint64_t token);
+    // Drop references of dead processes, returns buffers freed
+    uint32_t reclaim();
+
+private:
+    XvbmPoolShare(int fd, XvbmShareHeader *hdr, size_t map_size);
+    static size_t map_size(uint32_t num_buffers);
+
+    void lock();
+    void unlock() { pthread_mutex_unlock(&m_hdr->m_lock); }
+    uint32_t reclaim_l();
+    void rebuild_l();
+    uint32_t total_l(uint32_t idx);
+    uint16_t& refs_l(uint32_t slot, uint32_t idx) { return m_refs[slot * m_hdr->m_num_buffers + idx]; }
+    // References handed off by slot and not accepted yet
+    uint16_t& handed_off_l(uint32_t slot, uint32_t idx) { return refs_l(XVBM_SHARE_MAX_PROCS + slot, idx); }
+    void clear_slot_l(uint32_t slot);
+    void push_l(uint32_t idx);
+    void take_slot_l(uint32_t slot);
+    bool alive_l(uint32_t slot);
+
+    int              m_fd;
+    XvbmShareHeader *m_hdr;
+    size_t           m_map_size;
+    uint32_t        *m_ring;
+    uint16_t        *m_refs;
+    uint32_t         m_slot;
+    // Open file description holding the lock of m_slot, -1 if none
+    int              m_live_fd;
+};
+
+#endif
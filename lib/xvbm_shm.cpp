@@ -0,0 +1,208 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later OR Apache-2.0 */
+
+/*
+ * Copyright (C) 2019-2021 Xilinx Inc - All rights reserved
+ * Xilinx Video Buffer Manager (Xvbm)
+ *
+ * This file is dual-licensed; you may select either the GNU
+ * Lesser General Public License version 3 or
+ * Apache License, Version 2.0.
+ *
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <thread>
+#include <condition_variable>
+#include "xvbm.h"
+#include "xvbm_private.h"
+#include "xvbm_shm.h"
+#include "xvbm_log.h"
+
+//////////////////////////////////////////////////////////////////////////////
+// Background thread publishing the pool statistics in shared memory
+//////////////////////////////////////////////////////////////////////////////
+class XvbmShmPublisher
+{
+public:
+    ~XvbmShmPublisher() { stop(); }
+
+    int32_t start(uint32_t interval_ms);
+    void stop();
+
+private:
+    void run();
+    void publish();
+    void fill(XvbmShmPool *slot, XvbmBufferPool *pool);
+
+    std::mutex                        m_lock;
+    std::condition_variable           m_cond;
+    std::thread                       m_thread;
+    uint32_t                          m_interval_ms = 0;
+    std::string                       m_name;
+    XvbmShmHeader                    *m_hdr = nullptr;
+    std::map<XvbmBufferPool*, int>    m_slots;
+};
+
+int32_t XvbmShmPublisher::start(uint32_t interval_ms)
+{
+    if (m_hdr == nullptr) {
+        m_name = "/" XVBM_SHM_NAME_PREFIX + std::to_string(getpid());
+        int fd = shm_open(m_name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+        if (fd < 0) {
+            XVBM_ERROR("shm_open %s failed: %s", m_name.c_str(), strerror(errno));
+            return (-1);
+        }
+        void *ptr = MAP_FAILED;
+        if (ftruncate(fd, sizeof(XvbmShmHeader)) == 0)
+            ptr = mmap(nullptr, sizeof(XvbmShmHeader), PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd, 0);
+        close(fd);
+        if (ptr == MAP_FAILED) {
+            XVBM_ERROR("mapping %s failed: %s", m_name.c_str(), strerror(errno));
+            shm_unlink(m_name.c_str());
+            return (-1);
+        }
+        // Fresh pages are zero, every slot starts out unused
+        m_hdr = static_cast<XvbmShmHeader*>(ptr);
+        m_hdr->m_version = XVBM_SHM_VERSION;
+        m_hdr->m_max_pools = XVBM_SHM_MAX_POOLS;
+        m_hdr->m_pid = getpid();
+        std::atomic_thread_fence(std::memory_order_release);
+        m_hdr->m_magic = XVBM_SHM_MAGIC;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_interval_ms = interval_ms;
+        m_hdr->m_interval_ms = interval_ms;
+    }
+    if (!m_thread.joinable())
+        m_thread = std::thread(&XvbmShmPublisher::run, this);
+
+    return 0;
+}
+
+void XvbmShmPublisher::stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_interval_ms = 0;
+    }
+    m_cond.notify_all();
+    if (m_thread.joinable())
+        m_thread.join();
+    if (m_hdr) {
+        munmap(m_hdr, sizeof(XvbmShmHeader));
+        shm_unlink(m_name.c_str());
+        m_hdr = nullptr;
+        m_slots.clear();
+    }
+}
+
+void XvbmShmPublisher::run()
+{
+    std::unique_lock<std::mutex> guard(m_lock);
+    while (m_interval_ms) {
+        guard.unlock();
+        publish();
+        guard.lock();
+        m_cond.wait_for(guard, std::chrono::milliseconds(m_interval_ms));
+    }
+}
+
+void XvbmShmPublisher::fill(XvbmShmPool *slot, XvbmBufferPool *pool)
+{
+    XvbmPoolStats st;
+    uint64_t refcnt_hist[XVBM_SHM_REFCNT_BUCKETS] = {0};
+    uint32_t free_count;
+
+    // Plain lock, the publisher's own waits are no contention of the pool
+    {
+        std::lock_guard<std::mutex> guard(pool->m_lock);
+        free_count = pool->m_free_list.size();
+        for (auto buffer : pool->m_inuse_list) {
+            uint32_t ref = buffer->m_ref_cnt;
+            int idx = (ref <= 4) ? (ref ? ref - 1 : 0) : (ref <= 8 ? 4 : 5);
+            refcnt_hist[idx]++;
+        }
+    }
+    pool->m_stats.get(&st);
+
+    slot->m_seq.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->m_valid = 1;
+    slot->m_pool_id = (uint64_t)pool;
+    slot->m_size = pool->m_size;
+    slot->m_num_buffers = pool->get_num_buffers();
+    slot->m_free = free_count;
+    slot->m_inuse = st.inuse;
+    slot->m_inuse_high_water = st.inuse_high_water;
+    memcpy(slot->m_refcnt_hist, refcnt_hist, sizeof(refcnt_hist));
+    slot->m_extends = st.extends;
+    slot->m_allocs = st.allocs;
+    slot->m_failed_allocs = st.failed_allocs;
+    slot->m_lock_contentions = st.lock_contentions;
+    for (int dir = 0; dir < XVBM_SHM_XFER_DIRS; dir++) {
+        XvbmXferCounters &xfer = pool->m_xfer[dir];
+        slot->m_xfer_calls[dir] = xfer.m_calls.load(std::memory_order_relaxed);
+        slot->m_xfer_bytes[dir] = xfer.m_bytes.load(std::memory_order_relaxed);
+        slot->m_xfer_dma_ns[dir] = xfer.m_dma_ns.load(std::memory_order_relaxed);
+        slot->m_xfer_cached[dir] = xfer.m_cached.load(std::memory_order_relaxed);
+    }
+    slot->m_seq.fetch_add(1, std::memory_order_release);
+}
+
+void XvbmShmPublisher::publish()
+{
+    std::map<XvbmBufferPool*, int> slots;
+
+    xvbm_pool_foreach([&](XvbmBufferPool *pool) {
+        auto it = m_slots.find(pool);
+        int idx = -1;
+        if (it != m_slots.end()) {
+            idx = it->second;
+            m_slots.erase(it);
+        } else {
+            // First slot neither used by a live pool nor taken this round
+            for (int i = 0; i < XVBM_SHM_MAX_POOLS && idx < 0; i++) {
+                if (!m_hdr->m_pools[i].m_valid)
+                    idx = i;
+            }
+        }
+        if (idx < 0)
+            return;
+        fill(&m_hdr->m_pools[idx], pool);
+        slots[pool] = idx;
+    });
+
+    // Whatever is left belongs to destroyed pools
+    for (auto &it : m_slots) {
+        XvbmShmPool *slot = &m_hdr->m_pools[it.second];
+        slot->m_seq.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot->m_valid = 0;
+        slot->m_seq.fetch_add(1, std::memory_order_release);
+    }
+    m_slots.swap(slots);
+
+    m_hdr->m_timestamp_ns.store(xvbm_now_ns(), std::memory_order_relaxed);
+    m_hdr->m_updates.fetch_add(1, std::memory_order_release);
+}
+
+static XvbmShmPublisher g_publisher;
+static std::mutex       g_publisher_lock;
+
+//////////////////////////////////////////////////////////////////////////////
+int32_t xvbm_shm_stats_enable(uint32_t interval_ms)
+{
+    std::lock_guard<std::mutex> guard(g_publisher_lock);
+
+    if (interval_ms == 0) {
+        g_publisher.stop();
+        return 0;
+    }
+    return g_publisher.start(interval_ms);
+}
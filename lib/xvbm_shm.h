@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later OR Apache-2.0 */
+
+/*
+ * Copyright (C) 2019-2021 Xilinx Inc - All rights reserved
+ * Xilinx Video Buffer Manager (Xvbm)
+ *
+ * This file is dual-licensed; you may select either the GNU
+ * Lesser General Public License version 3 or
+ * Apache License, Version 2.0.
+ *
+ */
+
+#ifndef _XVBM_SHM_H_
+#define _XVBM_SHM_H_
+
+#include <atomic>
+#include <cstdint>
+#include <sched.h>
+
+// Layout of the live statistics segment published by a process using XVBM
+// and read by xvbm-top. Shared between the library and the tool, so it must
+// not depend on XRT headers.
+
+#define XVBM_SHM_NAME_PREFIX    "xvbm-stats-"
+#define XVBM_SHM_MAGIC          0x314d48534d425658ull   // "XVBMSHM1"
+#define XVBM_SHM_VERSION        1
+#define XVBM_SHM_MAX_POOLS      64
+#define XVBM_SHM_XFER_DIRS      3
+// Reference count distribution of in-use buffers: 1, 2, 3, 4, 5-8, >8
+#define XVBM_SHM_REFCNT_BUCKETS 6
+// Times a reader finds a slot mid-update before giving up on it
+#define XVBM_SHM_READ_RETRIES   1000
+
+// One pool, protected by a seqlock: m_seq is odd while the writer updates
+// the slot, readers retry until they see the same even value around a copy
+struct XvbmShmPool
+{
+    std::atomic<uint32_t> m_seq;
+    uint32_t              m_valid;
+    uint64_t              m_pool_id;
+    uint64_t              m_size;
+    int32_t               m_num_buffers;
+    uint32_t              m_free;
+    uint32_t              m_inuse;
+    uint32_t              m_inuse_high_water;
+    uint64_t              m_refcnt_hist[XVBM_SHM_REFCNT_BUCKETS];
+    uint64_t              m_extends;
+    uint64_t              m_allocs;
+    uint64_t              m_failed_allocs;
+    uint64_t              m_lock_contentions;
+    uint64_t              m_xfer_calls[XVBM_SHM_XFER_DIRS];
+    uint64_t              m_xfer_bytes[XVBM_SHM_XFER_DIRS];
+    uint64_t              m_xfer_dma_ns[XVBM_SHM_XFER_DIRS];
+    uint64_t              m_xfer_cached[XVBM_SHM_XFER_DIRS];
+};
+
+struct XvbmShmHeader
+{
+    uint64_t              m_magic;
+    uint32_t              m_version;
+    uint32_t              m_max_pools;
+    int32_t               m_pid;
+    uint32_t              m_interval_ms;
+    std::atomic<uint64_t> m_updates;
+    std::atomic<uint64_t> m_timestamp_ns;
+    XvbmShmPool           m_pools[XVBM_SHM_MAX_POOLS];
+};
+
+// Consistent copy of a slot, returns false if the slot is not in use or
+// stays mid-update, as it does when the publisher died while writing it
+static inline bool xvbm_shm_pool_read(const XvbmShmPool *slot, XvbmShmPool *copy)
+{
+    uint32_t seq;
+    int retries = XVBM_SHM_READ_RETRIES;
+
+    do {
+        while ((seq = slot->m_seq.load(std::memory_order_acquire)) & 1) {
+            if (--retries < 0)
+                return false;
+            sched_yield();
+        }
+        // Field by field copy, the seq check below discards torn reads
+        copy->m_valid = slot->m_valid;
+        copy->m_pool_id = slot->m_pool_id;
+        copy->m_size = slot->m_size;
+        copy->m_num_buffers = slot->m_num_buffers;
+        copy->m_free = slot->m_free;
+        copy->m_inuse = slot->m_inuse;
+        copy->m_inuse_high_water = slot->m_inuse_high_water;
+        for (int i = 0; i < XVBM_SHM_REFCNT_BUCKETS; i++)
+            copy->m_refcnt_hist[i] = slot->m_refcnt_hist[i];
+        copy->m_extends = slot->m_extends;
+        copy->m_allocs = slot->m_allocs;
+        copy->m_failed_allocs = slot->m_failed_allocs;
+        copy->m_lock_contentions = slot->m_lock_contentions;
+        for (int i = 0; i < XVBM_SHM_XFER_DIRS; i++) {
+            copy->m_xfer_calls[i] = slot->m_xfer_calls[i];
+            copy->m_xfer_bytes[i] = slot->m_xfer_bytes[i];
+            copy->m_xfer_dma_ns[i] = slot->m_xfer_dma_ns[i];
+            copy->m_xfer_cached[i] = slot->m_xfer_cached[i];
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while (slot->m_seq.load(std::memory_order_relaxed) != seq);
+
+    return copy->m_valid != 0;
+}
+
+#endif
@@ -0,0 +1,434 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later OR Apache-2.0 */
+
+/*
+ * Copyright (C) 2019-2021 Xilinx Inc - All rights reserved
+ * Xilinx Video Buffer Manager (Xvbm)
+ *
+ * This file is dual-licensed; you may select either the GNU
+ * Lesser General Public License version 3 or
+ * Apache License, Version 2.0.
+ *
+ */
+
+#include <set>
+#include <map>
+#include <thread>
+#include <condition_variable>
+#include <sstream>
+#include "xvbm.h"
+#include "xvbm_private.h"
+#include "xvbm_log.h"
+#include "xvbm_alloc_trace.h"
+
+//////////////////////////////////////////////////////////////////////////////
+// Latency histogram
+//////////////////////////////////////////////////////////////////////////////
+void XvbmHistogram::record(uint64_t ns)
+{
+    uint32_t idx = ns ? 63 - __builtin_clzll(ns) : 0;
+
+    if (idx >= XVBM_STATS_HIST_BUCKETS)
+        idx = XVBM_STATS_HIST_BUCKETS - 1;
+    m_bucket[idx].fetch_add(1, std::memory_order_relaxed);
+}
+
+void XvbmHistogram::get(uint64_t *buckets)
+{
+    for (int i = 0; i < XVBM_STATS_HIST_BUCKETS; i++)
+        buckets[i] = m_bucket[i].load(std::memory_order_relaxed);
+}
+
+void XvbmHistogram::reset()
+{
+    for (auto &bucket : m_bucket)
+        bucket.store(0, std::memory_order_relaxed);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Pool counters
+//////////////////////////////////////////////////////////////////////////////
+void XvbmPoolCounters::reset()
+{
+    m_allocs.store(0, std::memory_order_relaxed);
+    m_frees.store(0, std::memory_order_relaxed);
+    m_failed_allocs.store(0, std::memory_order_relaxed);
+    // In-use count is state, not a counter, the high-water restarts from it
+    m_inuse_high_water.store(m_inuse.load(std::memory_order_relaxed),
+                             std::memory_order_relaxed);
+    m_extends.store(0, std::memory_order_relaxed);
+    m_lock_contentions.store(0, std::memory_order_relaxed);
+    m_lock_wait_ns.store(0, std::memory_order_relaxed);
+    m_alloc_latency.reset();
+    m_free_latency.reset();
+}
+
+void XvbmPoolCounters::get(XvbmPoolStats *stats)
+{
+    stats->allocs = m_allocs.load(std::memory_order_relaxed);
+    stats->frees = m_frees.load(std::memory_order_relaxed);
+    stats->failed_allocs = m_failed_allocs.load(std::memory_order_relaxed);
+    stats->inuse = m_inuse.load(std::memory_order_relaxed);
+    stats->inuse_high_water = m_inuse_high_water.load(std::memory_order_relaxed);
+    stats->touched = m_touched.load(std::memory_order_relaxed);
+    stats->extends = m_extends.load(std::memory_order_relaxed);
+    stats->lock_contentions = m_lock_contentions.load(std::memory_order_relaxed);
+    stats->lock_wait_ns = m_lock_wait_ns.load(std::memory_order_relaxed);
+    m_alloc_latency.get(stats->alloc_latency_hist);
+    m_free_latency.get(stats->free_latency_hist);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Priority class counters
+//////////////////////////////////////////////////////////////////////////////
+void XvbmPrioCounters::record_wait(uint64_t ns, bool timed_out)
+{
+    uint64_t max = m_max_wait_ns.load(std::memory_order_relaxed);
+
+    m_waits.fetch_add(1, std::memory_order_relaxed);
+    if (timed_out)
+        m_wait_timeouts.fetch_add(1, std::memory_order_relaxed);
+    m_wait_ns.fetch_add(ns, std::memory_order_relaxed);
+    while (ns > max && !m_max_wait_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed))
+        ;
+}
+
+void XvbmPrioCounters::reset()
+{
+    m_inuse_high_water.store(m_inuse.load(std::memory_order_relaxed),
+                             std::memory_order_relaxed);
+    m_allocs.store(0, std::memory_order_relaxed);
+    m_failed_allocs.store(0, std::memory_order_relaxed);
+    m_denied.store(0, std::memory_order_relaxed);
+    m_waits.store(0, std::memory_order_relaxed);
+    m_wait_timeouts.store(0, std::memory_order_relaxed);
+    m_wait_ns.store(0, std::memory_order_relaxed);
+    m_max_wait_ns.store(0, std::memory_order_relaxed);
+}
+
+void XvbmPrioCounters::get(XvbmPrioStats *stats)
+{
+    stats->inuse = m_inuse.load(std::memory_order_relaxed);
+    stats->inuse_high_water = m_inuse_high_water.load(std::memory_order_relaxed);
+    stats->allocs = m_allocs.load(std::memory_order_relaxed);
+    stats->failed_allocs = m_failed_allocs.load(std::memory_order_relaxed);
+    stats->denied = m_denied.load(std::memory_order_relaxed);
+    stats->waits = m_waits.load(std::memory_order_relaxed);
+    stats->wait_timeouts = m_wait_timeouts.load(std::memory_order_relaxed);
+    stats->wait_ns = m_wait_ns.load(std::memory_order_relaxed);
+    stats->max_wait_ns = m_max_wait_ns.load(std::memory_order_relaxed);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Transfer counters
+//////////////////////////////////////////////////////////////////////////////
+void XvbmXferCounters::record(size_t   size,
+                              bool     staged,
+                              uint64_t memcpy_ns,
+                              uint64_t dma_ns,
+                              int32_t  rc)
+{
+    if (rc != 0) {
+        m_errors.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    m_calls.fetch_add(1, std::memory_order_relaxed);
+    m_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (staged)
+        m_staged.fetch_add(1, std::memory_order_relaxed);
+    else
+        m_direct.fetch_add(1, std::memory_order_relaxed);
+    m_dma_ns.fetch_add(dma_ns, std::memory_order_relaxed);
+    m_dma_latency.record(dma_ns);
+    if (memcpy_ns) {
+        m_memcpy_ns.fetch_add(memcpy_ns, std::memory_order_relaxed);
+        m_memcpy_latency.record(memcpy_ns);
+    }
+}
+
+void XvbmXferCounters::record_cached(size_t size, uint64_t memcpy_ns)
+{
+    m_cached.fetch_add(1, std::memory_order_relaxed);
+    m_cached_bytes.fetch_add(size, std::memory_order_relaxed);
+    m_memcpy_ns.fetch_add(memcpy_ns, std::memory_order_relaxed);
+    m_memcpy_latency.record(memcpy_ns);
+}
+
+void XvbmXferCounters::reset()
+{
+    m_calls.store(0, std::memory_order_relaxed);
+    m_bytes.store(0, std::memory_order_relaxed);
+    m_staged.store(0, std::memory_order_relaxed);
+    m_direct.store(0, std::memory_order_relaxed);
+    m_cached.store(0, std::memory_order_relaxed);
+    m_cached_bytes.store(0, std::memory_order_relaxed);
+    m_errors.store(0, std::memory_order_relaxed);
+    m_remote.store(0, std::memory_order_relaxed);
+    m_dma_ns.store(0, std::memory_order_relaxed);
+    m_memcpy_ns.store(0, std::memory_order_relaxed);
+    m_dma_latency.reset();
+    m_memcpy_latency.reset();
+}
+
+void XvbmXferCounters::get(XvbmXferStats *stats)
+{
+    stats->calls = m_calls.load(std::memory_order_relaxed);
+    stats->bytes = m_bytes.load(std::memory_order_relaxed);
+    stats->staged = m_staged.load(std::memory_order_relaxed);
+    stats->direct = m_direct.load(std::memory_order_relaxed);
+    stats->cached = m_cached.load(std::memory_order_relaxed);
+    stats->cached_bytes = m_cached_bytes.load(std::memory_order_relaxed);
+    stats->errors = m_errors.load(std::memory_order_relaxed);
+    stats->remote = m_remote.load(std::memory_order_relaxed);
+    stats->dma_ns = m_dma_ns.load(std::memory_order_relaxed);
+    stats->memcpy_ns = m_memcpy_ns.load(std::memory_order_relaxed);
+    m_dma_latency.get(stats->dma_latency_hist);
+    m_memcpy_latency.get(stats->memcpy_latency_hist);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Pool lock, only reached when try_lock failed
+//////////////////////////////////////////////////////////////////////////////
+void XvbmPoolGuard::lock_slow()
+{
+    uint64_t start = xvbm_now_ns();
+
+    m_pool->m_lock.lock();
+    m_pool->m_stats.m_lock_contentions.fetch_add(1, std::memory_order_relaxed);
+    m_pool->m_stats.m_lock_wait_ns.fetch_add(xvbm_now_ns() - start,
+                                             std::memory_order_relaxed);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int32_t xvbm_buffer_pool_stats_get(XvbmPoolHandle  p_handle,
+                                   XvbmPoolStats  *stats)
+{
+    XvbmBufferPool *pool = static_cast<XvbmBufferPool*>(p_handle);
+
+    if ((pool == nullptr) || (stats == nullptr))
+        return (-1);
+    pool->m_stats.get(stats);
+    stats->num_buffers = pool->get_num_buffers();
+
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Per bank usage, taken with the pool lock but without counting contention
+static std::map<uint32_t, XvbmBankUsage> pool_bank_usage(XvbmBufferPool *pool)
+{
+    std::map<uint32_t, XvbmBankUsage> banks;
+    std::lock_guard<std::mutex> guard(pool->m_lock);
+
+    for (auto buf : pool->m_alloc_vector) {
+        XvbmBankUsage &u = banks[buf->m_bank];
+        u.bank = buf->m_bank;
+        u.num_buffers++;
+        u.inuse++;
+        u.bytes += buf->m_size;
+    }
+    for (auto buf : pool->m_free_list)
+        banks[buf->m_bank].inuse--;
+
+    return banks;
+}
+
+int32_t xvbm_buffer_pool_bank_usage_get(XvbmPoolHandle  p_handle,
+                                        XvbmBankUsage  *usage,
+                                        uint32_t        max_banks)
+{
+    XvbmBufferPool *pool = static_cast<XvbmBufferPool*>(p_handle);
+    int32_t n = 0;
+
+    if ((pool == nullptr) || (usage == nullptr))
+        return (-1);
+    for (auto &it : pool_bank_usage(pool)) {
+        if ((uint32_t)n == max_banks)
+            break;
+        usage[n++] = it.second;
+    }
+
+    return n;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void xvbm_buffer_pool_stats_reset(XvbmPoolHandle p_handle)
+{
+    XvbmBufferPool *pool = static_cast<XvbmBufferPool*>(p_handle);
+    pool->m_stats.reset();
+    for (auto &prio : pool->m_prio)
+        prio.reset();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int32_t xvbm_buffer_pool_xfer_stats_get(XvbmPoolHandle  p_handle,
+                                        XvbmXferDir     dir,
+                                        XvbmXferStats  *stats)
+{
+    XvbmBufferPool *pool = static_cast<XvbmBufferPool*>(p_handle);
+
+    if ((pool == nullptr) || (stats == nullptr) ||
+        (dir < XVBM_XFER_TO_DEVICE) || (dir >= XVBM_XFER_DIRS))
+        return (-1);
+    pool->m_xfer[dir].get(stats);
+
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int32_t xvbm_buffer_pool_prio_stats_get(XvbmPoolHandle  p_handle,
+                                        XvbmPriority    prio,
+                                        XvbmPrioStats  *stats)
+{
+    XvbmBufferPool *pool = static_cast<XvbmBufferPool*>(p_handle);
+
+    if ((pool == nullptr) || (stats == nullptr) ||
+        (prio < XVBM_PRIO_CRITICAL) || (prio >= XVBM_PRIO_CLASSES))
+        return (-1);
+    pool->m_prio[prio].get(stats);
+    {
+        std::lock_guard<std::mutex> guard(pool->m_lock);
+        stats->reserved = pool->m_prio_reserved[prio];
+        stats->max_inuse = pool->m_prio_max[prio];
+    }
+
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Registry of live pools
+//////////////////////////////////////////////////////////////////////////////
+// Never destroyed, background threads of other modules may still walk the
+// registry while static objects are torn down at exit
+static std::mutex                &g_pools_lock = *new std::mutex;
+static std::set<XvbmBufferPool*>  &g_pools = *new std::set<XvbmBufferPool*>;
+
+//////////////////////////////////////////////////////////////////////////////
+// Background thread printing the statistics periodically
+//////////////////////////////////////////////////////////////////////////////
+class XvbmStatsDumper
+{
+public:
+    ~XvbmStatsDumper() { set_interval(0); }
+
+    void set_interval(uint32_t interval_ms)
+    {
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            m_interval_ms = interval_ms;
+        }
+        m_cond.notify_all();
+        if (interval_ms && !m_thread.joinable()) {
+            m_thread = std::thread(&XvbmStatsDumper::run, this);
+        } else if (!interval_ms && m_thread.joinable()) {
+            m_thread.join();
+        }
+    }
+
+private:
+    void run()
+    {
+        std::unique_lock<std::mutex> guard(m_lock);
+        while (m_interval_ms) {
+            m_cond.wait_for(guard, std::chrono::milliseconds(m_interval_ms));
+            if (m_interval_ms) {
+                guard.unlock();
+                xvbm_stats_dump();
+                guard.lock();
+            }
+        }
+    }
+
+    std::mutex              m_lock;
+    std::condition_variable m_cond;
+    std::thread             m_thread;
+    uint32_t                m_interval_ms = 0;
+};
+
+static XvbmStatsDumper g_dumper;
+static std::mutex      g_dumper_lock;
+
+void xvbm_pool_register(XvbmBufferPool *pool)
+{
+    static std::once_flag env_once;
+
+    std::call_once(env_once, []() {
+        const char *env = getenv("XVBM_STATS_DUMP_MS");
+        if (env && atoi(env) > 0)
+            xvbm_stats_dump_interval_set(atoi(env));
+        env = getenv("XVBM_SHM_STATS_MS");
+        if (env && atoi(env) > 0)
+            xvbm_shm_stats_enable(atoi(env));
+        env = getenv("XVBM_ALLOC_TRACE");
+        if (env && *env)
+            xvbm_alloc_trace_start(env);
+    });
+
+    std::lock_guard<std::mutex> guard(g_pools_lock);
+    g_pools.insert(pool);
+    XVBM_ALLOC_TRACE(XVBM_ATRACE_POOL_CREATE, pool, pool->get_num_buffers(), 0, pool->m_size);
+}
+
+void xvbm_pool_unregister(XvbmBufferPool *pool)
+{
+    std::lock_guard<std::mutex> guard(g_pools_lock);
+    if (g_pools.erase(pool))
+        XVBM_ALLOC_TRACE(XVBM_ATRACE_POOL_DESTROY, pool, 0, 0, 0);
+}
+
+// fn runs with the registry locked, pools can not be deleted meanwhile
+void xvbm_pool_foreach(const std::function<void(XvbmBufferPool*)> &fn)
+{
+    std::lock_guard<std::mutex> guard(g_pools_lock);
+    for (auto pool : g_pools)
+        fn(pool);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+static void dump_xfer(std::ostream &os, const char *name, XvbmXferCounters &xfer)
+{
+    XvbmXferStats st;
+
+    xfer.get(&st);
+    os << " | " << name << " calls=" << st.calls
+       << " MB=" << (st.bytes >> 20)
+       << " staged=" << st.staged
+       << " cached=" << st.cached
+       << " err=" << st.errors
+       << " remote=" << st.remote
+       << " dma_ms=" << st.dma_ns / 1000000
+       << " memcpy_ms=" << st.memcpy_ns / 1000000;
+    if (st.dma_ns)
+        os << " MB/s=" << (uint64_t)((double)st.bytes / st.dma_ns * 1e9 / (1 << 20));
+}
+
+void xvbm_stats_dump(void)
+{
+    xvbm_pool_foreach([](XvbmBufferPool *pool) {
+        XvbmPoolStats st;
+        std::ostringstream os;
+
+        pool->m_stats.get(&st);
+        os << "pool " << pool
+           << " size=" << pool->m_size
+           << " buffers=" << pool->get_num_buffers()
+           << " inuse=" << st.inuse
+           << " hw=" << st.inuse_high_water
+           << " touched=" << st.touched
+           << " allocs=" << st.allocs
+           << " failed=" << st.failed_allocs
+           << " contended=" << st.lock_contentions;
+        for (auto &it : pool_bank_usage(pool))
+            os << " bank" << it.first << "=" << it.second.inuse
+               << "/" << it.second.num_buffers;
+        dump_xfer(os, "wr", pool->m_xfer[XVBM_XFER_TO_DEVICE]);
+        dump_xfer(os, "rd", pool->m_xfer[XVBM_XFER_FROM_DEVICE]);
+        dump_xfer(os, "cp", pool->m_xfer[XVBM_XFER_DEVICE_COPY]);
+        xvbm_log_write(XVBM_LOG_INFO, nullptr, "%s", os.str().c_str());
+    });
+}
+
+void xvbm_stats_dump_interval_set(uint32_t interval_ms)
+{
+    std::lock_guard<std::mutex> guard(g_dumper_lock);
+    g_dumper.set_interval(interval_ms);
+}
@@ -0,0 +1,193 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later OR Apache-2.0 */
+
+/*
+ * Copyright (C) 2019-2021 Xilinx Inc - All rights reserved
+ * Xilinx Video Buffer Manager (Xvbm)
+ *
+ * This file is dual-licensed; you may select either the GNU
+ * Lesser General Public License version 3 or
+ * Apache License, Version 2.0.
+ *
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <memory>
+#include "xvbm.h"
+#include "xvbm_private.h"
+#include "xvbm_trace.h"
+#include "xvbm_log.h"
+
+#define TRACE_RING_EVENTS (64 * 1024)
+
+std::atomic<bool> g_xvbm_trace_enabled(false);
+
+//////////////////////////////////////////////////////////////////////////////
+// Single producer (the owning thread), single consumer (the flush) ring.
+// Events are dropped, not overwritten, when the ring is full.
+//////////////////////////////////////////////////////////////////////////////
+struct XvbmTraceRing
+{
+    std::vector<XvbmTraceEvent> m_events;
+    std::atomic<uint64_t>       m_head;
+    std::atomic<uint64_t>       m_tail;
+    std::atomic<uint64_t>       m_dropped;
+    std::atomic<bool>           m_exited;
+    pid_t                       m_tid;
+
+    explicit XvbmTraceRing(size_t events) :
+        m_events(events), m_head(0), m_tail(0), m_dropped(0),
+        m_exited(false), m_tid(syscall(SYS_gettid)) {}
+};
+
+// Never destroyed, threads may still record while statics are torn down
+static std::mutex                                  &g_rings_lock = *new std::mutex;
+static std::vector<std::shared_ptr<XvbmTraceRing>> &g_rings =
+    *new std::vector<std::shared_ptr<XvbmTraceRing>>;
+static size_t                                       g_ring_events = TRACE_RING_EVENTS;
+static std::string                                  g_trace_path;
+
+static const char *g_trace_names[XVBM_TRACE_TYPES] = {
+    "alloc", "alloc_failed", "free", "refcnt_inc", "write", "read"
+};
+
+// Marks the ring of an exiting thread so the next flush can drop it
+struct XvbmTraceThread
+{
+    std::shared_ptr<XvbmTraceRing> m_ring;
+
+    ~XvbmTraceThread() { if (m_ring) m_ring->m_exited = true; }
+
+    XvbmTraceRing *get()
+    {
+        if (!m_ring) {
+            m_ring = std::make_shared<XvbmTraceRing>(g_ring_events);
+            std::lock_guard<std::mutex> guard(g_rings_lock);
+            g_rings.push_back(m_ring);
+        }
+        return m_ring.get();
+    }
+};
+
+void xvbm_trace_record(XvbmTraceType  type,
+                       const void    *pool,
+                       const void    *buffer,
+                       uint32_t       buffer_id,
+                       uint32_t       ref_cnt,
+                       uint64_t       size,
+                       uint64_t       offset,
+                       uint64_t       start_ns)
+{
+    static thread_local XvbmTraceThread thread;
+    XvbmTraceRing *ring = thread.get();
+    uint64_t head = ring->m_head.load(std::memory_order_relaxed);
+    uint64_t now = xvbm_now_ns();
+
+    if (head - ring->m_tail.load(std::memory_order_acquire) >= ring->m_events.size()) {
+        ring->m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    XvbmTraceEvent &ev = ring->m_events[head % ring->m_events.size()];
+    ev.m_ts_ns = start_ns ? start_ns : now;
+    ev.m_dur_ns = start_ns ? now - start_ns : 0;
+    ev.m_pool = pool;
+    ev.m_buffer = buffer;
+    ev.m_size = size;
+    ev.m_offset = offset;
+    ev.m_buffer_id = buffer_id;
+    ev.m_ref_cnt = ref_cnt;
+    ev.m_type = type;
+    ring->m_head.store(head + 1, std::memory_order_release);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+static void write_event(FILE *fp, const XvbmTraceEvent &ev, pid_t pid, pid_t tid, bool first)
+{
+    bool xfer = (ev.m_type == XVBM_TRACE_WRITE) || (ev.m_type == XVBM_TRACE_READ);
+
+    fprintf(fp, "%s\n{\"name\":\"%s\",\"cat\":\"xvbm\",\"ph\":\"%s\",\"ts\":%.3f,",
+            first ? "" : ",", g_trace_names[ev.m_type], xfer ? "X" : "i",
+            ev.m_ts_ns / 1000.0);
+    if (xfer)
+        fprintf(fp, "\"dur\":%.3f,", ev.m_dur_ns / 1000.0);
+    else
+        fprintf(fp, "\"s\":\"t\",");
+    fprintf(fp, "\"pid\":%d,\"tid\":%d,\"args\":{\"pool\":\"%p\",\"buffer\":\"%p\",\"id\":%u",
+            pid, tid, ev.m_pool, ev.m_buffer, ev.m_buffer_id);
+    if (xfer)
+        fprintf(fp, ",\"size\":%llu,\"offset\":%llu}}",
+                (unsigned long long)ev.m_size, (unsigned long long)ev.m_offset);
+    else
+        fprintf(fp, ",\"refcnt\":%u}}", ev.m_ref_cnt);
+}
+
+int32_t xvbm_trace_flush(const char *path)
+{
+    std::lock_guard<std::mutex> guard(g_rings_lock);
+    uint64_t dropped = 0;
+    bool first = true;
+    pid_t pid = getpid();
+
+    if (path == nullptr || *path == '\0')
+        path = g_trace_path.c_str();
+    FILE *fp = fopen(path, "w");
+    if (fp == nullptr) {
+        XVBM_ERROR("can not open trace file %s", path);
+        return (-1);
+    }
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (auto it = g_rings.begin(); it != g_rings.end();) {
+        XvbmTraceRing *ring = it->get();
+        // Check before draining, an exited thread can not add events later
+        bool exited = ring->m_exited.load(std::memory_order_acquire);
+        uint64_t tail = ring->m_tail.load(std::memory_order_relaxed);
+        uint64_t head = ring->m_head.load(std::memory_order_acquire);
+
+        for (; tail != head; tail++) {
+            write_event(fp, ring->m_events[tail % ring->m_events.size()], pid, ring->m_tid, first);
+            first = false;
+        }
+        ring->m_tail.store(tail, std::memory_order_release);
+        dropped += ring->m_dropped.exchange(0, std::memory_order_relaxed);
+        it = exited ? g_rings.erase(it) : it + 1;
+    }
+    fprintf(fp, "\n],\"otherData\":{\"dropped_events\":%llu}}\n", (unsigned long long)dropped);
+    fclose(fp);
+
+    return 0;
+}
+
+void xvbm_trace_enable(bool enable)
+{
+    g_xvbm_trace_enabled.store(enable, std::memory_order_relaxed);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// XVBM_TRACE=<file> turns tracing on at load time and writes the trace at
+// exit, XVBM_TRACE_EVENTS sets the per-thread ring size
+//////////////////////////////////////////////////////////////////////////////
+static struct XvbmTraceEnv
+{
+    XvbmTraceEnv()
+    {
+        const char *env = getenv("XVBM_TRACE_EVENTS");
+        if (env && atoi(env) > 0)
+            g_ring_events = atoi(env);
+        env = getenv("XVBM_TRACE");
+        if (env && *env) {
+            g_trace_path = env;
+            xvbm_trace_enable(true);
+        }
+    }
+
+    ~XvbmTraceEnv()
+    {
+        if (!g_trace_path.empty()) {
+            xvbm_trace_enable(false);
+            xvbm_trace_flush(g_trace_path.c_str());
+        }
+    }
+} g_trace_env;
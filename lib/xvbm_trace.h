@@ -0,0 +1,81 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later OR Apache-2.0 */
+
+/*
+ * Copyright (C) 2019-2021 Xilinx Inc - All rights reserved
+ * Xilinx Video Buffer Manager (Xvbm)
+ *
+ * This file is dual-licensed; you may select either the GNU
+ * Lesser General Public License version 3 or
+ * Apache License, Version 2.0.
+ *
+ */
+
+#ifndef _XVBM_TRACE_H_
+#define _XVBM_TRACE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// Buffer lifecycle tracing. Events go to a lock-free per-thread ring and
+// are written out as Chrome trace JSON by xvbm_trace_flush. When tracing is
+// off every hook is a single relaxed load and a not-taken branch.
+
+enum XvbmTraceType : uint8_t
+{
+    XVBM_TRACE_ALLOC = 0,
+    XVBM_TRACE_ALLOC_FAILED,
+    XVBM_TRACE_FREE,
+    XVBM_TRACE_REF_INC,
+    XVBM_TRACE_WRITE,
+    XVBM_TRACE_READ,
+    XVBM_TRACE_TYPES
+};
+
+struct XvbmTraceEvent
+{
+    uint64_t      m_ts_ns;
+    uint64_t      m_dur_ns;
+    const void   *m_pool;
+    const void   *m_buffer;
+    uint64_t      m_size;
+    uint64_t      m_offset;
+    uint32_t      m_buffer_id;
+    uint32_t      m_ref_cnt;
+    XvbmTraceType m_type;
+};
+
+extern std::atomic<bool> g_xvbm_trace_enabled;
+
+void xvbm_trace_record(XvbmTraceType  type,
+                       const void    *pool,
+                       const void    *buffer,
+                       uint32_t       buffer_id,
+                       uint32_t       ref_cnt,
+                       uint64_t       size,
+                       uint64_t       offset,
+                       uint64_t       start_ns);
+
+static inline bool xvbm_trace_on()
+{
+    return __builtin_expect(g_xvbm_trace_enabled.load(std::memory_order_relaxed), 0);
+}
+
+#define XVBM_TRACE(type, pool, buf, id, ref)                                  \
+    do {                                                                      \
+        if (xvbm_trace_on())                                                  \
+            xvbm_trace_record((type), (pool), (buf), (id), (ref), 0, 0, 0);   \
+    } while (0)
+
+// Transfers are traced as complete events, begin returns 0 when tracing is
+// off so the end hook records nothing
+#define XVBM_TRACE_BEGIN() (xvbm_trace_on() ? xvbm_now_ns() : 0)
+
+#define XVBM_TRACE_END(type, start, pool, buf, id, size, offset)                   \
+    do {                                                                           \
+        if (start)                                                                 \
+            xvbm_trace_record((type), (pool), (buf), (id), 0, (size), (offset),    \
+                              (start));                                            \
+    } while (0)
+
+#endif
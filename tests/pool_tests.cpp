@@ -11,10 +11,25 @@
  */
 
 #include "xvbm.h"
+#include "xvbm.hpp"
+#include "xvbm_shm.h"
+#include "xvbm_alloc_trace.h"
+#include "xvbm_private.h"
 #include <list>
 #include <gtest/gtest.h>
 #include <iostream>
 #include <thread>
+#include <vector>
+#include <cstring>
+#include <chrono>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <fstream>
+#include <sstream>
 
 class PoolTest : public ::testing::Test
 {
@@ -25,6 +40,37 @@ protected:
     virtual void TearDown() { xclClose(d_handle); }
 };
 
+// Tests on an emulated device without allocation or transfer latencies.
+// Tests needing another device model change cfg and call reopen.
+class EmuPoolTest : public ::testing::Test
+{
+protected:
+    XvbmEmuConfig   cfg;
+    xclDeviceHandle emu = NULL;
+
+    virtual void SetUp()
+    {
+        xvbm_emu_config_init(&cfg);
+        cfg.alloc_latency_ns = 0;
+        cfg.xfer_latency_ns = 0;
+        ASSERT_TRUE(reopen());
+    }
+
+    virtual void TearDown()
+    {
+        if (emu)
+            xvbm_emu_device_close(emu);
+    }
+
+    bool reopen()
+    {
+        if (emu)
+            xvbm_emu_device_close(emu);
+        emu = xvbm_emu_device_open(&cfg);
+        return emu != NULL;
+    }
+};
+
 void alloc_multiple_buffers(XvbmPoolHandle p_handle, 
                            int32_t         num_entries,
                            size_t          size)
@@ -364,3 +410,1485 @@ TEST_F(PoolTest, GetHandleByPaddr)
     // Destroy the pool
     xvbm_buffer_pool_destroy(p_handle);
 }
+
+TEST_F(PoolTest, ReadCache)
+{
+    XvbmPoolHandle   p_handle;
+    XvbmBufferHandle b_handle;
+    size_t size = 1920*1080*1.5;
+    uint32_t num_entries = 1;
+    uint32_t flags = 0;
+    std::vector<uint8_t> w_buff(size + 1);
+    std::vector<uint8_t> r_buff(size + 1);
+
+    // Create the buffers
+    p_handle = xvbm_buffer_pool_create(d_handle, 
+                                       num_entries,
+                                       size,
+                                       flags);
+    ASSERT_TRUE(p_handle != NULL);
+    xvbm_buffer_pool_read_cache_set(p_handle, true);
+
+    b_handle = xvbm_buffer_pool_entry_alloc(p_handle);
+    ASSERT_TRUE(b_handle != NULL);
+
+    // Write an unaligned buffer, this goes through the host shadow
+    for (int i = 0; i < size; i++)
+        w_buff[i+1] = i & 0xff;
+    EXPECT_EQ(xvbm_buffer_write(b_handle, &w_buff[1], size, 0), 0);
+    uint64_t gen = xvbm_buffer_get_generation(b_handle);
+
+    // Repeated reads do not change the generation and return the data
+    for (int n = 0; n < 2; n++) {
+        memset(r_buff.data(), 0, r_buff.size());
+        EXPECT_EQ(xvbm_buffer_read(b_handle, &r_buff[1], size, 0), 0);
+        EXPECT_EQ(memcmp(&r_buff[1], &w_buff[1], size), 0);
+        EXPECT_EQ(xvbm_buffer_get_generation(b_handle), gen);
+    }
+
+    // A device side modification moves the generation forward
+    xvbm_buffer_invalidate(b_handle);
+    EXPECT_NE(xvbm_buffer_get_generation(b_handle), gen);
+    EXPECT_EQ(xvbm_buffer_read(b_handle, &r_buff[1], 4096, 4096), 0);
+    EXPECT_EQ(memcmp(&r_buff[1], &w_buff[4097], 4096), 0);
+
+    // Fetching the host pointer disables the cache for the current owner
+    // only, the next allocation of the buffer caches again
+    XvbmXferStats st_before, st_after;
+    xvbm_buffer_get_host_ptr(b_handle);
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(b_handle), true);
+    b_handle = xvbm_buffer_pool_entry_alloc(p_handle);
+    ASSERT_TRUE(b_handle != NULL);
+    EXPECT_EQ(xvbm_buffer_write(b_handle, &w_buff[1], size, 0), 0);
+    xvbm_buffer_pool_xfer_stats_get(p_handle, XVBM_XFER_FROM_DEVICE, &st_before);
+    EXPECT_EQ(xvbm_buffer_read(b_handle, &r_buff[1], size, 0), 0);
+    xvbm_buffer_pool_xfer_stats_get(p_handle, XVBM_XFER_FROM_DEVICE, &st_after);
+    EXPECT_EQ(st_after.cached, st_before.cached + 1);
+
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(b_handle), true);
+
+    // Destroy the pool
+    xvbm_buffer_pool_destroy(p_handle);
+}
+
+TEST_F(PoolTest, CopyBuffer)
+{
+    XvbmPoolHandle   p_handle;
+    XvbmPoolHandle   p2_handle;
+    XvbmBufferHandle src_handle;
+    XvbmBufferHandle dst_handle;
+    XvbmBufferHandle dst2_handle;
+    size_t size = 1920*1080*1.5;
+    uint32_t num_entries = 2;
+    uint32_t flags = 0;
+    std::vector<uint8_t> w_buff(size);
+    std::vector<uint8_t> r_buff(size);
+
+    // Create a pool on this device and one on a second device handle
+    p_handle = xvbm_buffer_pool_create(d_handle, num_entries, size, flags);
+    ASSERT_TRUE(p_handle != NULL);
+    xclDeviceHandle d2_handle = xclOpen(0, NULL, XCL_QUIET);
+    p2_handle = xvbm_buffer_pool_create(d2_handle, num_entries, size, flags);
+    ASSERT_TRUE(p2_handle != NULL);
+
+    src_handle = xvbm_buffer_pool_entry_alloc(p_handle);
+    dst_handle = xvbm_buffer_pool_entry_alloc(p_handle);
+    dst2_handle = xvbm_buffer_pool_entry_alloc(p2_handle);
+    ASSERT_TRUE(src_handle != NULL);
+    ASSERT_TRUE(dst_handle != NULL);
+    ASSERT_TRUE(dst2_handle != NULL);
+
+    for (int i = 0; i < size; i++)
+        w_buff[i] = (i * 7) & 0xff;
+    EXPECT_EQ(xvbm_buffer_write(src_handle, w_buff.data(), size, 0), 0);
+
+    // Device side copy of part of the buffer
+    EXPECT_EQ(xvbm_buffer_copy(dst_handle, 4096, src_handle, 8192, 1920*1080), 0);
+    EXPECT_EQ(xvbm_buffer_read(dst_handle, r_buff.data(), 1920*1080, 4096), 0);
+    EXPECT_EQ(memcmp(r_buff.data(), &w_buff[8192], 1920*1080), 0);
+
+    // Copy across devices goes through the host
+    EXPECT_EQ(xvbm_buffer_copy(dst2_handle, 0, src_handle, 0, size), 0);
+    EXPECT_EQ(xvbm_buffer_read(dst2_handle, r_buff.data(), size, 0), 0);
+    EXPECT_EQ(memcmp(r_buff.data(), w_buff.data(), size), 0);
+
+    // Out of range and overlapping copies are rejected
+    EXPECT_NE(xvbm_buffer_copy(dst_handle, 1, src_handle, 0, size), 0);
+    EXPECT_NE(xvbm_buffer_copy(src_handle, 0, src_handle, 4096, 8192), 0);
+
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(src_handle), true);
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(dst_handle), true);
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(dst2_handle), true);
+
+    // Destroy the pools
+    xvbm_buffer_pool_destroy(p_handle);
+    xvbm_buffer_pool_destroy(p2_handle);
+    xclClose(d2_handle);
+}
+
+void read_plane(XvbmBufferHandle b_handle,
+                const uint8_t   *expected,
+                size_t           size,
+                size_t           offset)
+{
+    // Read into an unaligned destination so the staging path is used
+    std::vector<uint8_t> r_buff(size + 1);
+
+    for (int n = 0; n < 16; n++) {
+        ASSERT_EQ(xvbm_buffer_read(b_handle, &r_buff[1], size, offset), 0);
+        ASSERT_EQ(memcmp(&r_buff[1], expected + offset, size), 0);
+    }
+}
+
+TEST_F(PoolTest, ConcurrentReads)
+{
+    XvbmPoolHandle   p_handle;
+    XvbmBufferHandle b_handle;
+    size_t size = 1920*1080*1.5;
+    size_t luma = 1920*1080;
+    uint32_t num_entries = 1;
+    uint32_t flags = 0;
+    std::vector<uint8_t> w_buff(size);
+
+    // Create the buffers
+    p_handle = xvbm_buffer_pool_create(d_handle, 
+                                       num_entries,
+                                       size,
+                                       flags);
+    ASSERT_TRUE(p_handle != NULL);
+
+    b_handle = xvbm_buffer_pool_entry_alloc(p_handle);
+    ASSERT_TRUE(b_handle != NULL);
+
+    for (int i = 0; i < size; i++)
+        w_buff[i] = (i * 3) & 0xff;
+    EXPECT_EQ(xvbm_buffer_write(b_handle, w_buff.data(), size, 0), 0);
+
+    // Fan-out consumers reading disjoint planes of the same frame
+    std::thread t1(read_plane, b_handle, w_buff.data(), luma, 0);
+    std::thread t2(read_plane, b_handle, w_buff.data(), size - luma, luma);
+    t1.join();
+    t2.join();
+
+    // Same again served from the read cache
+    xvbm_buffer_pool_read_cache_set(p_handle, true);
+    std::thread t3(read_plane, b_handle, w_buff.data(), luma, 0);
+    std::thread t4(read_plane, b_handle, w_buff.data(), size - luma, luma);
+    t3.join();
+    t4.join();
+
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(b_handle), true);
+
+    // Destroy the pool
+    xvbm_buffer_pool_destroy(p_handle);
+}
+
+TEST_F(PoolTest, LargeStagedTransfer)
+{
+    XvbmPoolHandle   p_handle;
+    XvbmBufferHandle b_handle;
+    // 4K 10 bit 4:2:0, above the size kept as per thread staging memory
+    size_t size = 3840*2160*3;
+    std::vector<uint8_t> w_buff(size + 1);
+    std::vector<uint8_t> r_buff(size + 1);
+
+    p_handle = xvbm_buffer_pool_create(d_handle, 1, size, 0);
+    ASSERT_TRUE(p_handle != NULL);
+    b_handle = xvbm_buffer_pool_entry_alloc(p_handle);
+    ASSERT_TRUE(b_handle != NULL);
+
+    // Unaligned on both sides so each transfer is staged
+    for (int i = 0; i < size; i++)
+        w_buff[i+1] = (i * 5) & 0xff;
+    EXPECT_EQ(xvbm_buffer_write(b_handle, &w_buff[1], size, 0), 0);
+    EXPECT_EQ(xvbm_buffer_read(b_handle, &r_buff[1], size, 0), 0);
+    EXPECT_EQ(memcmp(&r_buff[1], &w_buff[1], size), 0);
+
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(b_handle), true);
+    xvbm_buffer_pool_destroy(p_handle);
+}
+
+TEST_F(PoolTest, CopyOnWrite)
+{
+    XvbmPoolHandle   p_handle;
+    XvbmBufferHandle b_handle;
+    XvbmBufferHandle w_handle;
+    size_t size = 1920*1080*1.5;
+    uint32_t num_entries = 2;
+    uint32_t flags = 0;
+    std::vector<uint8_t> w_buff(size);
+    std::vector<uint8_t> r_buff(size);
+
+    // Create the buffers
+    p_handle = xvbm_buffer_pool_create(d_handle, 
+                                       num_entries,
+                                       size,
+                                       flags);
+    ASSERT_TRUE(p_handle != NULL);
+
+    b_handle = xvbm_buffer_pool_entry_alloc(p_handle);
+    ASSERT_TRUE(b_handle != NULL);
+    for (int i = 0; i < size; i++)
+        w_buff[i] = (i * 5) & 0xff;
+    EXPECT_EQ(xvbm_buffer_write(b_handle, w_buff.data(), size, 0), 0);
+
+    // A sole owner gets the same buffer back
+    EXPECT_EQ(xvbm_buffer_make_writable(b_handle), b_handle);
+    EXPECT_EQ(xvbm_buffer_get_refcnt(b_handle), 1);
+
+    // A shared buffer is copied and one reference is dropped
+    xvbm_buffer_refcnt_inc(b_handle);
+    w_handle = xvbm_buffer_make_writable(b_handle);
+    ASSERT_TRUE(w_handle != NULL);
+    EXPECT_NE(w_handle, b_handle);
+    EXPECT_EQ(xvbm_buffer_get_refcnt(b_handle), 1);
+    EXPECT_EQ(xvbm_buffer_get_refcnt(w_handle), 1);
+    EXPECT_EQ(xvbm_buffer_read(w_handle, r_buff.data(), size, 0), 0);
+    EXPECT_EQ(memcmp(r_buff.data(), w_buff.data(), size), 0);
+
+    // No buffer left for another copy, the reference is kept
+    xvbm_buffer_refcnt_inc(b_handle);
+    EXPECT_TRUE(xvbm_buffer_make_writable(b_handle) == NULL);
+    EXPECT_EQ(xvbm_buffer_get_refcnt(b_handle), 2);
+
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(b_handle), false);
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(b_handle), true);
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(w_handle), true);
+
+    // Destroy the pool
+    xvbm_buffer_pool_destroy(p_handle);
+}
+
+TEST_F(PoolTest, BufferViews)
+{
+    XvbmPoolHandle   p_handle;
+    XvbmBufferHandle b_handle;
+    XvbmBufferHandle uv_handle;
+    XvbmBufferHandle tile_handle;
+    size_t size = 1920*1080*1.5;
+    size_t luma = 1920*1080;
+    uint32_t num_entries = 1;
+    uint32_t flags = 0;
+    std::vector<uint8_t> w_buff(size);
+    std::vector<uint8_t> r_buff(size);
+
+    // Create the buffers
+    p_handle = xvbm_buffer_pool_create(d_handle, 
+                                       num_entries,
+                                       size,
+                                       flags);
+    ASSERT_TRUE(p_handle != NULL);
+
+    b_handle = xvbm_buffer_pool_entry_alloc(p_handle);
+    ASSERT_TRUE(b_handle != NULL);
+    for (int i = 0; i < size; i++)
+        w_buff[i] = (i * 11) & 0xff;
+    EXPECT_EQ(xvbm_buffer_write(b_handle, w_buff.data(), size, 0), 0);
+
+    // A view on the chroma plane and a view of a tile within it
+    uv_handle = xvbm_buffer_view_create(b_handle, luma, size - luma, 1920);
+    ASSERT_TRUE(uv_handle != NULL);
+    tile_handle = xvbm_buffer_view_create(uv_handle, 4096, 4096, 0);
+    ASSERT_TRUE(tile_handle != NULL);
+    EXPECT_TRUE(xvbm_buffer_view_create(b_handle, luma, size, 0) == NULL);
+
+    // The parent is referenced by both views, the pool is untouched
+    EXPECT_EQ(xvbm_buffer_get_refcnt(b_handle), 3);
+    EXPECT_EQ(xvbm_get_freelist_count(p_handle), 0);
+    EXPECT_EQ(xvbm_buffer_get_size(uv_handle), size - luma);
+    EXPECT_EQ(xvbm_buffer_get_pitch(uv_handle), 1920);
+    EXPECT_EQ(xvbm_buffer_get_view_offset(tile_handle), luma + 4096);
+    EXPECT_EQ(xvbm_buffer_get_paddr(uv_handle), xvbm_buffer_get_paddr(b_handle) + luma);
+    EXPECT_EQ(xvbm_get_pool_handle(tile_handle), p_handle);
+
+    // Transfers are relative to the view
+    EXPECT_EQ(xvbm_buffer_read(uv_handle, r_buff.data(), 8192, 0), 0);
+    EXPECT_EQ(memcmp(r_buff.data(), &w_buff[luma], 8192), 0);
+    memset(r_buff.data(), 0x5a, 4096);
+    EXPECT_EQ(xvbm_buffer_write(tile_handle, r_buff.data(), 4096, 0), 0);
+    EXPECT_EQ(xvbm_buffer_read(b_handle, r_buff.data() + 4096, 4096, luma + 4096), 0);
+    EXPECT_EQ(memcmp(r_buff.data(), r_buff.data() + 4096, 4096), 0);
+    EXPECT_NE(xvbm_buffer_read(tile_handle, r_buff.data(), 4097, 0), 0);
+
+    // Views outlive the owner's reference on the parent
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(b_handle), false);
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(uv_handle), false);
+    EXPECT_EQ(xvbm_get_freelist_count(p_handle), 0);
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(tile_handle), true);
+    EXPECT_EQ(xvbm_get_freelist_count(p_handle), 1);
+
+    // Destroy the pool
+    xvbm_buffer_pool_destroy(p_handle);
+}
+
+TEST_F(PoolTest, PoolStats)
+{
+    XvbmPoolHandle   p_handle;
+    XvbmBufferHandle b_handle[2];
+    XvbmPoolStats    stats;
+    size_t size = 1920*1080*1.5;
+    uint32_t num_entries = 2;
+    uint32_t flags = 0;
+
+    // Create the buffers
+    p_handle = xvbm_buffer_pool_create(d_handle, 
+                                       num_entries,
+                                       size,
+                                       flags);
+    ASSERT_TRUE(p_handle != NULL);
+
+    // Exhaust the pool
+    b_handle[0] = xvbm_buffer_pool_entry_alloc(p_handle);
+    b_handle[1] = xvbm_buffer_pool_entry_alloc(p_handle);
+    EXPECT_TRUE(xvbm_buffer_pool_entry_alloc(p_handle) == NULL);
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(b_handle[0]), true);
+
+    ASSERT_EQ(xvbm_buffer_pool_stats_get(p_handle, &stats), 0);
+    EXPECT_EQ(stats.allocs, 2);
+    EXPECT_EQ(stats.failed_allocs, 1);
+    EXPECT_EQ(stats.frees, 1);
+    EXPECT_EQ(stats.num_buffers, num_entries);
+    EXPECT_EQ(stats.inuse, 1);
+    EXPECT_EQ(stats.inuse_high_water, 2);
+
+    uint64_t alloc_samples = 0, free_samples = 0;
+    for (int i = 0; i < XVBM_STATS_HIST_BUCKETS; i++) {
+        alloc_samples += stats.alloc_latency_hist[i];
+        free_samples += stats.free_latency_hist[i];
+    }
+    EXPECT_EQ(alloc_samples, 3);
+    EXPECT_EQ(free_samples, 1);
+
+    // Reset keeps the in-use state
+    xvbm_buffer_pool_stats_reset(p_handle);
+    ASSERT_EQ(xvbm_buffer_pool_stats_get(p_handle, &stats), 0);
+    EXPECT_EQ(stats.allocs, 0);
+    EXPECT_EQ(stats.inuse, 1);
+    EXPECT_EQ(stats.inuse_high_water, 1);
+
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(b_handle[1]), true);
+
+    // Destroy the pool
+    xvbm_buffer_pool_destroy(p_handle);
+}
+
+TEST_F(PoolTest, XferStats)
+{
+    XvbmPoolHandle   p_handle;
+    XvbmBufferHandle b_handle[2];
+    XvbmXferStats    stats;
+    size_t size = 1920*1080*1.5;
+    uint32_t num_entries = 2;
+    uint32_t flags = 0;
+    std::vector<uint8_t> buff(size + 1);
+
+    // Create the buffers
+    p_handle = xvbm_buffer_pool_create(d_handle, 
+                                       num_entries,
+                                       size,
+                                       flags);
+    ASSERT_TRUE(p_handle != NULL);
+    xvbm_buffer_pool_read_cache_set(p_handle, true);
+
+    b_handle[0] = xvbm_buffer_pool_entry_alloc(p_handle);
+    b_handle[1] = xvbm_buffer_pool_entry_alloc(p_handle);
+    ASSERT_TRUE(b_handle[0] != NULL);
+    ASSERT_TRUE(b_handle[1] != NULL);
+    uint8_t *host = (uint8_t *)xvbm_buffer_get_host_ptr(b_handle[1]);
+
+    // Pool creation zero fills every buffer on the device
+    ASSERT_EQ(xvbm_buffer_pool_xfer_stats_get(p_handle, XVBM_XFER_TO_DEVICE, &stats), 0);
+    EXPECT_EQ(stats.calls, num_entries);
+    EXPECT_EQ(stats.bytes, num_entries * size);
+
+    // One direct and one staged write
+    EXPECT_EQ(xvbm_buffer_write(b_handle[1], host, size, 0), 0);
+    EXPECT_EQ(xvbm_buffer_write(b_handle[0], &buff[1], size, 0), 0);
+    ASSERT_EQ(xvbm_buffer_pool_xfer_stats_get(p_handle, XVBM_XFER_TO_DEVICE, &stats), 0);
+    EXPECT_EQ(stats.calls, num_entries + 2);
+    EXPECT_EQ(stats.staged, 1);
+    EXPECT_EQ(stats.direct, num_entries + 1);
+    EXPECT_EQ(stats.errors, 0);
+
+    // The read after the staged write is served from the shadow
+    EXPECT_EQ(xvbm_buffer_read(b_handle[0], &buff[1], size, 0), 0);
+    EXPECT_NE(xvbm_buffer_read(b_handle[0], &buff[1], size * 2, 0), 0);
+    ASSERT_EQ(xvbm_buffer_pool_xfer_stats_get(p_handle, XVBM_XFER_FROM_DEVICE, &stats), 0);
+    EXPECT_EQ(stats.calls, 0);
+    EXPECT_EQ(stats.cached, 1);
+    EXPECT_EQ(stats.cached_bytes, size);
+
+    EXPECT_EQ(xvbm_buffer_copy(b_handle[1], 0, b_handle[0], 0, 4096), 0);
+    ASSERT_EQ(xvbm_buffer_pool_xfer_stats_get(p_handle, XVBM_XFER_DEVICE_COPY, &stats), 0);
+    EXPECT_EQ(stats.calls, 1);
+    EXPECT_EQ(stats.bytes, 4096);
+
+    EXPECT_NE(xvbm_buffer_pool_xfer_stats_get(p_handle, XVBM_XFER_DIRS, &stats), 0);
+    xvbm_stats_dump();
+
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(b_handle[0]), true);
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(b_handle[1]), true);
+
+    // Destroy the pool
+    xvbm_buffer_pool_destroy(p_handle);
+}
+
+TEST_F(PoolTest, ShmStats)
+{
+    XvbmPoolHandle   p_handle;
+    XvbmBufferHandle b_handle;
+    size_t size = 1920*1080*1.5;
+    uint32_t num_entries = 3;
+    uint32_t flags = 0;
+
+    // Create the buffers
+    p_handle = xvbm_buffer_pool_create(d_handle, 
+                                       num_entries,
+                                       size,
+                                       flags);
+    ASSERT_TRUE(p_handle != NULL);
+    b_handle = xvbm_buffer_pool_entry_alloc(p_handle);
+    ASSERT_TRUE(b_handle != NULL);
+    xvbm_buffer_refcnt_inc(b_handle);
+
+    ASSERT_EQ(xvbm_shm_stats_enable(10), 0);
+
+    std::string name = "/" XVBM_SHM_NAME_PREFIX + std::to_string(getpid());
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    ASSERT_GE(fd, 0);
+    void *ptr = mmap(NULL, sizeof(XvbmShmHeader), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    ASSERT_NE(ptr, MAP_FAILED);
+    const XvbmShmHeader *hdr = (const XvbmShmHeader *)ptr;
+    EXPECT_EQ(hdr->m_magic, XVBM_SHM_MAGIC);
+    EXPECT_EQ(hdr->m_pid, getpid());
+
+    // Wait for two publications so this pool is in the segment
+    uint64_t updates = hdr->m_updates.load();
+    while (hdr->m_updates.load() < updates + 2)
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+    bool found = false;
+    for (int i = 0; i < XVBM_SHM_MAX_POOLS; i++) {
+        XvbmShmPool pool;
+        if (!xvbm_shm_pool_read(&hdr->m_pools[i], &pool) ||
+            pool.m_pool_id != (uint64_t)p_handle)
+            continue;
+        found = true;
+        EXPECT_EQ(pool.m_size, size);
+        EXPECT_EQ(pool.m_num_buffers, num_entries);
+        EXPECT_EQ(pool.m_free, num_entries - 1);
+        EXPECT_EQ(pool.m_inuse, 1);
+        EXPECT_EQ(pool.m_refcnt_hist[1], 1);
+    }
+    EXPECT_TRUE(found);
+
+    // A slot left mid-update by a dead publisher is skipped, not waited on
+    XvbmShmPool torn, copy;
+    memcpy((void*)&torn, (const void*)&hdr->m_pools[0], sizeof(torn));
+    torn.m_seq.store(1);
+    torn.m_valid = 1;
+    EXPECT_FALSE(xvbm_shm_pool_read(&torn, &copy));
+    munmap(ptr, sizeof(XvbmShmHeader));
+
+    // Disabling removes the segment
+    EXPECT_EQ(xvbm_shm_stats_enable(0), 0);
+    EXPECT_LT(shm_open(name.c_str(), O_RDONLY, 0), 0);
+
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(b_handle), false);
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(b_handle), true);
+
+    // Destroy the pool
+    xvbm_buffer_pool_destroy(p_handle);
+}
+
+TEST_F(PoolTest, Trace)
+{
+    XvbmPoolHandle   p_handle;
+    XvbmBufferHandle b_handle;
+    size_t size = 4096;
+    uint32_t num_entries = 2;
+    uint32_t flags = 0;
+    std::string path = "/tmp/xvbm_trace_" + std::to_string(getpid()) + ".json";
+    std::vector<uint8_t> data(size, 0x5a);
+
+    p_handle = xvbm_buffer_pool_create(d_handle,
+                                       num_entries,
+                                       size,
+                                       flags);
+    ASSERT_TRUE(p_handle != NULL);
+
+    // Drop anything recorded before
+    xvbm_trace_enable(true);
+    ASSERT_EQ(xvbm_trace_flush(path.c_str()), 0);
+
+    b_handle = xvbm_buffer_pool_entry_alloc(p_handle);
+    ASSERT_TRUE(b_handle != NULL);
+    xvbm_buffer_refcnt_inc(b_handle);
+    EXPECT_EQ(xvbm_buffer_write(b_handle, data.data(), size, 0), 0);
+    EXPECT_EQ(xvbm_buffer_read(b_handle, data.data(), size, 0), 0);
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(b_handle), false);
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(b_handle), true);
+    xvbm_trace_enable(false);
+
+    // Not recorded
+    b_handle = xvbm_buffer_pool_entry_alloc(p_handle);
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(b_handle), true);
+
+    ASSERT_EQ(xvbm_trace_flush(path.c_str()), 0);
+    std::ifstream in(path);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    std::string json = ss.str();
+    unlink(path.c_str());
+
+    auto count = [&json](const std::string &name) {
+        size_t n = 0;
+        for (size_t pos = json.find(name); pos != std::string::npos; pos = json.find(name, pos + 1))
+            n++;
+        return n;
+    };
+    EXPECT_EQ(json.find("{\"displayTimeUnit\""), 0u);
+    EXPECT_EQ(count("\"name\":\"alloc\""), 1u);
+    EXPECT_EQ(count("\"name\":\"refcnt_inc\""), 1u);
+    EXPECT_EQ(count("\"name\":\"free\""), 2u);
+    EXPECT_EQ(count("\"name\":\"write\",\"cat\":\"xvbm\",\"ph\":\"X\""), 1u);
+    EXPECT_EQ(count("\"name\":\"read\",\"cat\":\"xvbm\",\"ph\":\"X\""), 1u);
+    EXPECT_EQ(count("\"dropped_events\":0"), 1u);
+
+    xvbm_buffer_pool_destroy(p_handle);
+}
+
+static void log_collect(XvbmLogLevel level, const char *msg, void *user_data)
+{
+    auto msgs = static_cast<std::vector<std::pair<XvbmLogLevel, std::string>>*>(user_data);
+    msgs->emplace_back(level, msg);
+}
+
+TEST_F(PoolTest, Logging)
+{
+    XvbmPoolHandle   p_handle;
+    XvbmBufferHandle b_handle;
+    size_t size = 4096;
+    uint32_t num_entries = 1;
+    uint32_t flags = 0;
+    std::vector<std::pair<XvbmLogLevel, std::string>> msgs;
+    uint8_t data[16];
+
+    p_handle = xvbm_buffer_pool_create(d_handle,
+                                       num_entries,
+                                       size,
+                                       flags);
+    ASSERT_TRUE(p_handle != NULL);
+    b_handle = xvbm_buffer_pool_entry_alloc(p_handle);
+    ASSERT_TRUE(b_handle != NULL);
+
+    EXPECT_EQ(xvbm_log_set_sink(XVBM_LOG_SINK_CALLBACK, NULL, NULL), -1);
+    ASSERT_EQ(xvbm_log_set_sink(XVBM_LOG_SINK_CALLBACK, log_collect, &msgs), 0);
+
+    // A storm from one call site is rate limited
+    for (int i = 0; i < 100; i++)
+        EXPECT_EQ(xvbm_buffer_write(b_handle, data, sizeof(data), size), -1);
+    xvbm_log_flush();
+    ASSERT_GT(msgs.size(), 0u);
+    EXPECT_LT(msgs.size(), 100u);
+    EXPECT_EQ(msgs[0].first, XVBM_LOG_ERROR);
+    EXPECT_NE(msgs[0].second.find("write_buffer with invalid size"), std::string::npos);
+
+    // Below the level nothing is queued
+    msgs.clear();
+    xvbm_log_set_level(XVBM_LOG_INFO);
+    xvbm_stats_dump();
+    xvbm_log_flush();
+    EXPECT_GE(msgs.size(), 1u);
+    msgs.clear();
+    xvbm_log_set_level(XVBM_LOG_WARNING);
+    xvbm_stats_dump();
+    xvbm_log_flush();
+    EXPECT_EQ(msgs.size(), 0u);
+
+    xvbm_log_set_level(XVBM_LOG_INFO);
+    xvbm_log_set_sink(XVBM_LOG_SINK_STDERR, NULL, NULL);
+
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(b_handle), true);
+    xvbm_buffer_pool_destroy(p_handle);
+}
+
+TEST_F(EmuPoolTest, EmulatedDevice)
+{
+    size_t size = 1024 * 1024;
+    uint32_t flags = 0;
+    std::vector<uint8_t> wr(size), rd(size);
+
+    cfg.num_banks = 1;
+    cfg.bank_size = 4 * size;
+    cfg.h2d_bytes_per_sec = 100 * size;
+    ASSERT_TRUE(reopen());
+
+    // The bank holds four buffers
+    XvbmPoolHandle p_handle = xvbm_buffer_pool_create(emu, 4, size, flags);
+    ASSERT_TRUE(p_handle != NULL);
+    EXPECT_TRUE(xvbm_buffer_pool_create(emu, 1, size, flags) == NULL);
+
+    XvbmBufferHandle a = xvbm_buffer_pool_entry_alloc(p_handle);
+    XvbmBufferHandle b = xvbm_buffer_pool_entry_alloc(p_handle);
+    ASSERT_TRUE(a != NULL && b != NULL);
+    EXPECT_NE(xvbm_buffer_get_paddr(a), xvbm_buffer_get_paddr(b));
+
+    // 1MB at 100MB/s takes 10ms
+    for (size_t i = 0; i < size; i++)
+        wr[i] = i * 7;
+    auto start = std::chrono::steady_clock::now();
+    ASSERT_EQ(xvbm_buffer_write(a, wr.data(), size, 0), 0);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    EXPECT_GE(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count(), 9);
+
+    ASSERT_EQ(xvbm_buffer_copy(b, 0, a, 0, size), 0);
+    ASSERT_EQ(xvbm_buffer_read(b, rd.data(), size, 0), 0);
+    EXPECT_EQ(memcmp(wr.data(), rd.data(), size), 0);
+
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(a), true);
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(b), true);
+    xvbm_buffer_pool_destroy(p_handle);
+
+    // The space is back once the pool is gone
+    p_handle = xvbm_buffer_pool_create(emu, 4, size, flags);
+    EXPECT_TRUE(p_handle != NULL);
+    xvbm_buffer_pool_destroy(p_handle);
+}
+
+TEST_F(PoolTest, AllocTrace)
+{
+    XvbmPoolHandle   p_handle;
+    XvbmBufferHandle a, b;
+    size_t size = 4096;
+    uint32_t num_entries = 4;
+    uint32_t flags = 0;
+    std::string path = "/tmp/xvbm_alloc_trace_" + std::to_string(getpid()) + ".bin";
+
+    ASSERT_EQ(xvbm_alloc_trace_start(path.c_str()), 0);
+    EXPECT_EQ(xvbm_alloc_trace_start(path.c_str()), -1);
+    p_handle = xvbm_buffer_pool_create(d_handle,
+                                       num_entries,
+                                       size,
+                                       flags);
+    ASSERT_TRUE(p_handle != NULL);
+    a = xvbm_buffer_pool_entry_alloc(p_handle);
+    b = xvbm_buffer_pool_entry_alloc(p_handle);
+    ASSERT_TRUE(a != NULL && b != NULL);
+    xvbm_buffer_refcnt_inc(a);
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(a), false);
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(a), true);
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(b), true);
+    xvbm_buffer_pool_destroy(p_handle);
+    xvbm_alloc_trace_stop();
+
+    FILE *fp = fopen(path.c_str(), "rb");
+    ASSERT_TRUE(fp != NULL);
+    XvbmAllocTraceHeader hdr;
+    ASSERT_EQ(fread(&hdr, sizeof(hdr), 1, fp), 1u);
+    EXPECT_EQ(hdr.m_magic, XVBM_ALLOC_TRACE_MAGIC);
+    EXPECT_EQ(hdr.m_pid, (uint32_t)getpid());
+
+    std::vector<uint8_t> types;
+    XvbmAllocTraceRecord rec;
+    while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+        // Only this pool, others may still exist from earlier tests
+        if (rec.m_pool_id != (uint64_t)p_handle)
+            continue;
+        types.push_back(rec.m_type);
+        if (rec.m_type == XVBM_ATRACE_POOL_CREATE) {
+            EXPECT_EQ(rec.m_buffer, num_entries);
+            EXPECT_EQ(rec.m_arg, size);
+        }
+    }
+    fclose(fp);
+    unlink(path.c_str());
+
+    std::vector<uint8_t> expected = {
+        XVBM_ATRACE_POOL_CREATE, XVBM_ATRACE_ALLOC, XVBM_ATRACE_ALLOC, XVBM_ATRACE_REF_INC,
+        XVBM_ATRACE_FREE, XVBM_ATRACE_FREE, XVBM_ATRACE_FREE, XVBM_ATRACE_POOL_DESTROY
+    };
+    EXPECT_EQ(types, expected);
+}
+
+TEST_F(EmuPoolTest, ReusePolicy)
+{
+    size_t size = 4096;
+    uint32_t num_entries = 4;
+    uint32_t flags = XVBM_POOL_STRIPE | 0x3;
+    XvbmPoolStats st;
+
+    // Two banks holding two buffers each
+    cfg.num_banks = 2;
+    cfg.bank_size = 2 * size;
+    ASSERT_TRUE(reopen());
+    XvbmPoolHandle p_handle = xvbm_buffer_pool_create(emu, num_entries, size, flags);
+    ASSERT_TRUE(p_handle != NULL);
+
+    // FIFO, the default, hands out the least recently freed buffer
+    XvbmBufferHandle a = xvbm_buffer_pool_entry_alloc(p_handle);
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(a), true);
+    XvbmBufferHandle b = xvbm_buffer_pool_entry_alloc(p_handle);
+    EXPECT_NE(a, b);
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(b), true);
+
+    // LIFO keeps reusing the same buffer
+    EXPECT_EQ(xvbm_buffer_pool_reuse_policy_set(p_handle, (XvbmReusePolicy)7), -1);
+    ASSERT_EQ(xvbm_buffer_pool_reuse_policy_set(p_handle, XVBM_REUSE_LIFO), 0);
+    a = xvbm_buffer_pool_entry_alloc(p_handle);
+    for (int i = 0; i < 10; i++) {
+        EXPECT_EQ(xvbm_buffer_pool_entry_free(a), true);
+        EXPECT_EQ(xvbm_buffer_pool_entry_alloc(p_handle), a);
+    }
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(a), true);
+    ASSERT_EQ(xvbm_buffer_pool_stats_get(p_handle, &st), 0);
+    EXPECT_EQ(st.touched, 3u);
+
+    // Bank round-robin alternates between the banks
+    ASSERT_EQ(xvbm_buffer_pool_reuse_policy_set(p_handle, XVBM_REUSE_BANK_RR), 0);
+    std::vector<XvbmBufferHandle> held;
+    for (uint32_t i = 0; i < num_entries; i++)
+        held.push_back(xvbm_buffer_pool_entry_alloc(p_handle));
+    for (uint32_t i = 1; i < num_entries; i++)
+        EXPECT_NE(xvbm_buffer_get_bank(held[i]), xvbm_buffer_get_bank(held[i - 1]));
+    for (auto h : held)
+        EXPECT_EQ(xvbm_buffer_pool_entry_free(h), true);
+
+    xvbm_buffer_pool_destroy(p_handle);
+}
+
+TEST_F(EmuPoolTest, BankPlacement)
+{
+    size_t size = 4096;
+    XvbmBankUsage usage[4];
+
+    cfg.num_banks = 3;
+    cfg.bank_size = 4 * size;
+    ASSERT_TRUE(reopen());
+
+    // A single bank, which then has no room for a fifth buffer
+    XvbmPoolHandle p_handle = xvbm_buffer_pool_create(emu, 4, size, 1);
+    ASSERT_TRUE(p_handle != NULL);
+    XvbmBufferHandle a = xvbm_buffer_pool_entry_alloc(p_handle);
+    EXPECT_EQ(xvbm_buffer_get_bank(a), 1u);
+    EXPECT_TRUE(xvbm_buffer_pool_create(emu, 1, size, 1) == NULL);
+    EXPECT_TRUE(xvbm_buffer_pool_create(emu, 1, size, 3) == NULL);
+    ASSERT_EQ(xvbm_buffer_pool_bank_usage_get(p_handle, usage, 4), 1);
+    EXPECT_EQ(usage[0].bank, 1u);
+    EXPECT_EQ(usage[0].num_buffers, 4u);
+    EXPECT_EQ(usage[0].inuse, 1u);
+    EXPECT_EQ(usage[0].bytes, 4 * size);
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(a), true);
+    xvbm_buffer_pool_destroy(p_handle);
+
+    // Striped over banks 0 and 2, consecutive buffers alternate
+    EXPECT_TRUE(xvbm_buffer_pool_create(emu, 4, size, XVBM_POOL_STRIPE) == NULL);
+    p_handle = xvbm_buffer_pool_create(emu, 6, size, XVBM_POOL_STRIPE | 0x5);
+    ASSERT_TRUE(p_handle != NULL);
+    for (uint32_t i = 0; i < 6; i++) {
+        XvbmBufferHandle b = xvbm_get_buffer_handle(p_handle, i);
+        EXPECT_EQ(xvbm_buffer_get_bank(b), i % 2 ? 2u : 0u);
+    }
+    ASSERT_EQ(xvbm_buffer_pool_bank_usage_get(p_handle, usage, 4), 2);
+    EXPECT_EQ(usage[0].bank, 0u);
+    EXPECT_EQ(usage[1].bank, 2u);
+    EXPECT_EQ(usage[1].num_buffers, 3u);
+    EXPECT_EQ(xvbm_buffer_pool_bank_usage_get(p_handle, usage, 1), 1);
+
+    xvbm_buffer_pool_destroy(p_handle);
+}
+
+TEST_F(EmuPoolTest, NumaNode)
+{
+    XvbmXferStats xs;
+    cpu_set_t saved;
+    size_t size = 4096;
+    std::vector<uint8_t> data(size);
+
+    EXPECT_EQ(xvbm_device_numa_node_get(emu), -1);
+    EXPECT_EQ(xvbm_thread_numa_bind(emu), -1);
+
+    cfg.numa_node = 0;
+    ASSERT_TRUE(reopen());
+    EXPECT_EQ(xvbm_device_numa_node_get(emu), 0);
+
+    // Transfers from the device's node are local
+    ASSERT_EQ(sched_getaffinity(0, sizeof(saved), &saved), 0);
+    ASSERT_EQ(xvbm_thread_numa_bind(emu), 0);
+    XvbmPoolHandle p_handle = xvbm_buffer_pool_create(emu, 1, size, 0);
+    ASSERT_TRUE(p_handle != NULL);
+    XvbmBufferHandle b_handle = xvbm_buffer_pool_entry_alloc(p_handle);
+    ASSERT_EQ(xvbm_buffer_write(b_handle, data.data(), size, 0), 0);
+    ASSERT_EQ(xvbm_buffer_pool_xfer_stats_get(p_handle, XVBM_XFER_TO_DEVICE, &xs), 0);
+    EXPECT_EQ(xs.remote, 0u);
+    sched_setaffinity(0, sizeof(saved), &saved);
+
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(b_handle), true);
+    xvbm_buffer_pool_destroy(p_handle);
+}
+
+TEST_F(EmuPoolTest, PoolGroup)
+{
+    size_t size = 4096;
+    xclDeviceHandle devs[2];
+    std::vector<XvbmBufferHandle> held;
+
+    // Transfers on the first device stay in flight long enough to be seen
+    cfg.xfer_latency_ns = 100000000;
+    devs[0] = xvbm_emu_device_open(&cfg);
+    devs[1] = emu;
+    ASSERT_TRUE(devs[0] != NULL);
+
+    XvbmPoolGroupHandle g_handle = xvbm_pool_group_create(devs, 2, 4, size, 0);
+    ASSERT_TRUE(g_handle != NULL);
+    EXPECT_EQ(xvbm_pool_group_num_devices(g_handle), 2u);
+    EXPECT_TRUE(xvbm_pool_group_pool_get(g_handle, 2) == NULL);
+
+    // Most free spreads evenly, the hint wins while its device has room
+    for (int i = 0; i < 4; i++)
+        held.push_back(xvbm_pool_group_entry_alloc(g_handle, -1));
+    int on_first = 0;
+    for (auto h : held)
+        on_first += xvbm_buffer_get_device(h) == devs[0];
+    EXPECT_EQ(on_first, 2);
+    held.push_back(xvbm_pool_group_entry_alloc(g_handle, 1));
+    EXPECT_EQ(xvbm_buffer_get_device(held.back()), devs[1]);
+    held.push_back(xvbm_pool_group_entry_alloc(g_handle, 1));
+    held.push_back(xvbm_pool_group_entry_alloc(g_handle, 1));
+    EXPECT_EQ(xvbm_buffer_get_device(held.back()), devs[0]);
+    held.push_back(xvbm_pool_group_entry_alloc(g_handle, -1));
+    ASSERT_TRUE(held.back() != NULL);
+    EXPECT_TRUE(xvbm_pool_group_entry_alloc(g_handle, -1) == NULL);
+    for (auto h : held)
+        EXPECT_EQ(xvbm_buffer_pool_entry_free(h), true);
+
+    // Least loaded avoids the device with a transfer in flight even though
+    // it has the most free buffers, and returns to it once the write is done
+    ASSERT_EQ(xvbm_pool_group_policy_set(g_handle, XVBM_GROUP_LEAST_LOADED), 0);
+    XvbmBufferHandle busy = xvbm_buffer_pool_entry_alloc(xvbm_pool_group_pool_get(g_handle, 0));
+    XvbmBufferHandle other[2];
+    for (auto &h : other)
+        h = xvbm_buffer_pool_entry_alloc(xvbm_pool_group_pool_get(g_handle, 1));
+    std::vector<uint8_t> frame(size);
+    std::atomic<bool> written(false);
+    std::thread writer([&]() {
+        EXPECT_EQ(xvbm_buffer_write(busy, frame.data(), size, 0), 0);
+        written = true;
+    });
+    int away = 0;
+    while (!written && away < 3) {
+        XvbmBufferHandle h = xvbm_pool_group_entry_alloc(g_handle, -1);
+        away += xvbm_buffer_get_device(h) == devs[1];
+        EXPECT_EQ(xvbm_buffer_pool_entry_free(h), true);
+    }
+    writer.join();
+    EXPECT_EQ(away, 3);
+    XvbmBufferHandle h = xvbm_pool_group_entry_alloc(g_handle, -1);
+    EXPECT_EQ(xvbm_buffer_get_device(h), devs[0]);
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(h), true);
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(busy), true);
+    for (auto h : other)
+        EXPECT_EQ(xvbm_buffer_pool_entry_free(h), true);
+
+    xvbm_pool_group_destroy(g_handle);
+    xvbm_emu_device_close(devs[0]);
+}
+
+TEST_F(EmuPoolTest, SharedPool)
+{
+    size_t size = 4096;
+    int sv[2];
+
+    XvbmPoolHandle p1 = xvbm_buffer_pool_create(emu, 4, size, 0);
+    ASSERT_TRUE(p1 != NULL);
+    XvbmBufferHandle a = xvbm_buffer_pool_entry_alloc(p1);
+
+    // Both ends in this process stand in for two processes
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+    ASSERT_EQ(xvbm_buffer_pool_export(p1, sv[0]), 0);
+    XvbmPoolHandle p2 = xvbm_buffer_pool_import(emu, sv[1]);
+    ASSERT_TRUE(p2 != NULL);
+    EXPECT_EQ(xvbm_buffer_get_paddr(xvbm_get_buffer_handle(p2, 0)),
+              xvbm_buffer_get_paddr(xvbm_get_buffer_handle(p1, 0)));
+
+    // One free list for both
+    XvbmBufferHandle b = xvbm_buffer_pool_entry_alloc(p2);
+    XvbmBufferHandle c = xvbm_buffer_pool_entry_alloc(p2);
+    XvbmBufferHandle d = xvbm_buffer_pool_entry_alloc(p1);
+    ASSERT_TRUE(b != NULL && c != NULL && d != NULL);
+    EXPECT_TRUE(xvbm_buffer_pool_entry_alloc(p1) == NULL);
+    EXPECT_TRUE(xvbm_buffer_pool_entry_alloc(p2) == NULL);
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(b), true);
+    XvbmBufferHandle e = xvbm_buffer_pool_entry_alloc(p1);
+    ASSERT_TRUE(e != NULL);
+    EXPECT_EQ(xvbm_buffer_get_id(e), xvbm_buffer_get_id(b));
+
+    // A handed off reference outlives the sender's own
+    uint64_t token = xvbm_buffer_handoff(a);
+    ASSERT_NE(token, 0u);
+    XvbmBufferHandle a2 = xvbm_buffer_pool_accept(p2, token);
+    ASSERT_TRUE(a2 != NULL);
+    EXPECT_EQ(xvbm_buffer_get_id(a2), xvbm_buffer_get_id(a));
+    EXPECT_TRUE(xvbm_buffer_pool_accept(p2, token) == NULL);
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(a), true);
+    EXPECT_TRUE(xvbm_buffer_pool_entry_alloc(p1) == NULL);
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(a2), true);
+    a = xvbm_buffer_pool_entry_alloc(p1);
+    ASSERT_TRUE(a != NULL);
+
+    // Extra references on a view hold no extra shared reference, the
+    // buffer goes back to the shared free list once all are dropped
+    XvbmBufferHandle v = xvbm_buffer_view_create(a, 0, size / 2, 0);
+    ASSERT_TRUE(v != NULL);
+    xvbm_buffer_refcnt_inc(v);
+    xvbm_buffer_pool_entry_free(v);
+    xvbm_buffer_pool_entry_free(v);
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(a), true);
+    a = xvbm_buffer_pool_entry_alloc(p2);
+    ASSERT_TRUE(a != NULL);
+
+    // Reservations keep the last buffer free in any process, even though
+    // this process holds only half of the pool
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(a), true);
+    ASSERT_EQ(xvbm_buffer_pool_prio_set(p1, XVBM_PRIO_CRITICAL, 1, 0), 0);
+    EXPECT_TRUE(xvbm_buffer_pool_entry_alloc(p1) == NULL);
+    a = xvbm_buffer_pool_entry_alloc_prio(p1, XVBM_PRIO_CRITICAL);
+    ASSERT_TRUE(a != NULL);
+    ASSERT_EQ(xvbm_buffer_pool_prio_set(p1, XVBM_PRIO_CRITICAL, 0, 0), 0);
+
+    // Buffers of a process that died holding them come back
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(a), true);
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(c), true);
+    pid_t pid = fork();
+    if (pid == 0) {
+        XvbmPoolHandle p3 = xvbm_buffer_pool_import(emu, sv[1]);
+        bool ok = p3 && xvbm_buffer_pool_entry_alloc(p3) && xvbm_buffer_pool_entry_alloc(p3);
+        _exit(ok ? 0 : 1);
+    }
+    ASSERT_EQ(xvbm_buffer_pool_export(p1, sv[0]), 0);
+    int status;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    EXPECT_EQ(xvbm_buffer_pool_reclaim(p2), 2);
+    EXPECT_EQ(xvbm_buffer_pool_reclaim(p2), 0);
+    a = xvbm_buffer_pool_entry_alloc(p1);
+    c = xvbm_buffer_pool_entry_alloc(p2);
+    ASSERT_TRUE(a != NULL && c != NULL);
+
+    for (auto h : {a, c, d, e})
+        EXPECT_EQ(xvbm_buffer_pool_entry_free(h), true);
+    xvbm_buffer_pool_destroy(p2);
+    xvbm_buffer_pool_destroy(p1);
+    close(sv[0]);
+    close(sv[1]);
+}
+
+TEST_F(EmuPoolTest, PoolCache)
+{
+    XvbmPoolCacheStats st;
+    size_t size = 4096;
+    uint8_t byte = 0x6b;
+
+    ASSERT_EQ(xvbm_pool_cache_config(1 << 20, 0), 0);
+
+    // A matching create revives the pool with its contents
+    XvbmPoolHandle p_handle = xvbm_buffer_pool_create(emu, 4, size, 0);
+    ASSERT_TRUE(p_handle != NULL);
+    XvbmBufferHandle b_handle = xvbm_buffer_pool_entry_alloc(p_handle);
+    int32_t id = xvbm_buffer_get_id(b_handle);
+    ASSERT_EQ(xvbm_buffer_write(b_handle, &byte, 1, 0), 0);
+    xvbm_buffer_pool_read_cache_set(p_handle, true);
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(b_handle), true);
+    xvbm_buffer_pool_destroy(p_handle);
+    ASSERT_EQ(xvbm_pool_cache_stats_get(&st), 0);
+    EXPECT_EQ(st.dormant_pools, 1u);
+    EXPECT_EQ(st.dormant_bytes, 4 * size);
+
+    XvbmPoolHandle larger = xvbm_buffer_pool_create(emu, 4, size * 2, 0);
+    EXPECT_TRUE(larger != p_handle);
+    xvbm_buffer_pool_destroy(larger);
+    XvbmPoolHandle other = xvbm_buffer_pool_create(emu, 8, size, 0);
+    XvbmPoolHandle again = xvbm_buffer_pool_create(emu, 4, size, 0);
+    EXPECT_EQ(again, p_handle);
+    XvbmPoolStats ps;
+    xvbm_buffer_pool_stats_get(again, &ps);
+    EXPECT_EQ(ps.allocs, 0u);
+    EXPECT_EQ(ps.touched, 0u);
+    std::vector<XvbmBufferHandle> held;
+    for (int i = 0; i < 4; i++) {
+        held.push_back(xvbm_buffer_pool_entry_alloc(again));
+        if (xvbm_buffer_get_id(held.back()) == id) {
+            uint8_t out = 0;
+            ASSERT_EQ(xvbm_buffer_read(held.back(), &out, 1, 0), 0);
+            EXPECT_EQ(out, byte);
+        }
+    }
+    for (auto h : held)
+        EXPECT_EQ(xvbm_buffer_pool_entry_free(h), true);
+    xvbm_pool_cache_stats_get(&st);
+    EXPECT_EQ(st.hits, 1u);
+    EXPECT_EQ(st.dormant_pools, 1u);
+
+    // Over budget the oldest dormant pool goes first
+    xvbm_pool_cache_config(10 * size, 0);
+    xvbm_pool_cache_stats_get(&st);
+    EXPECT_EQ(st.evictions, 0u);
+    xvbm_buffer_pool_destroy(other);
+    xvbm_buffer_pool_destroy(again);
+    xvbm_pool_cache_stats_get(&st);
+    EXPECT_EQ(st.dormant_pools, 1u);
+    EXPECT_EQ(st.dormant_bytes, 4 * size);
+    EXPECT_EQ(st.evictions, 2u);
+
+    // Dormant pools expire
+    xvbm_pool_cache_config(1 << 20, 20);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    xvbm_pool_cache_stats_get(&st);
+    EXPECT_EQ(st.dormant_pools, 0u);
+
+    // Closing the device frees what is left
+    xvbm_pool_cache_config(1 << 20, 0);
+    xvbm_buffer_pool_destroy(xvbm_buffer_pool_create(emu, 4, size, 0));
+    xvbm_emu_device_close(emu);
+    emu = NULL;
+    xvbm_pool_cache_stats_get(&st);
+    EXPECT_EQ(st.dormant_pools, 0u);
+    xvbm_pool_cache_config(0, 0);
+}
+
+TEST_F(PoolTest, PoolCacheConcurrentConfig)
+{
+    // One thread keeps stopping the reaper while the other restarts it
+    auto toggle = [](uint32_t first_age_ms) {
+        for (int i = 0; i < 1000; i++)
+            xvbm_pool_cache_config(1 << 20, (i & 1) ? first_age_ms : 20 - first_age_ms);
+    };
+    std::thread t1(toggle, 0);
+    std::thread t2(toggle, 20);
+    t1.join();
+    t2.join();
+
+    XvbmPoolCacheStats st;
+    xvbm_pool_cache_config(0, 0);
+    xvbm_pool_cache_stats_get(&st);
+    EXPECT_EQ(st.dormant_pools, 0u);
+}
+
+TEST_F(EmuPoolTest, DeviceBudget)
+{
+    size_t size = 4096;
+    uint64_t headroom;
+    XvbmPoolAttr a = {}, b = {};
+
+    a.tenant = 1;
+    b.tenant = 2;
+
+    ASSERT_EQ(xvbm_device_headroom_get(emu, 1, XVBM_BUDGET_DEVICE, &headroom), 0);
+    EXPECT_EQ(headroom, UINT64_MAX);
+    ASSERT_EQ(xvbm_device_budget_set(emu, XVBM_BUDGET_DEVICE, 16 * size), 0);
+    ASSERT_EQ(xvbm_device_budget_set(emu, 1, 4 * size), 0);
+    EXPECT_EQ(xvbm_device_reserve(emu, 2, XVBM_BUDGET_DEVICE, 32 * size), -1);
+    ASSERT_EQ(xvbm_device_reserve(emu, 2, XVBM_BUDGET_DEVICE, 6 * size), 0);
+
+    // Tenant 1 gets what tenant 2 did not reserve
+    xvbm_device_headroom_get(emu, 1, XVBM_BUDGET_DEVICE, &headroom);
+    EXPECT_EQ(headroom, 10 * size);
+    xvbm_device_headroom_get(emu, 1, 1, &headroom);
+    EXPECT_EQ(headroom, 4 * size);
+    EXPECT_EQ(xvbm_buffer_pool_admit(emu, 12, size, 0, &a), XVBM_STATUS_OVER_BUDGET);
+    EXPECT_TRUE(xvbm_buffer_pool_create_ex(emu, 12, size, 0, &a) == NULL);
+    EXPECT_EQ(xvbm_last_status(), XVBM_STATUS_OVER_BUDGET);
+    XvbmPoolHandle pa = xvbm_buffer_pool_create_ex(emu, 8, size, 0, &a);
+    ASSERT_TRUE(pa != NULL);
+    EXPECT_EQ(xvbm_last_status(), XVBM_STATUS_OK);
+
+    // Bank budgets apply to the buffers placed on the bank
+    EXPECT_EQ(xvbm_buffer_pool_admit(emu, 2, size, XVBM_POOL_STRIPE | 0x3, &a), XVBM_STATUS_OK);
+    EXPECT_EQ(xvbm_buffer_pool_admit(emu, 2, size, 1, &a), XVBM_STATUS_OK);
+    EXPECT_EQ(xvbm_buffer_pool_admit(emu, 2, size * 3, 1, &a), XVBM_STATUS_OVER_BUDGET);
+
+    // Extending past the budget fails up front
+    XvbmBufferHandle h = xvbm_buffer_pool_entry_alloc(pa);
+    EXPECT_EQ(xvbm_buffer_pool_extend(h, 4), 0);
+    EXPECT_EQ(xvbm_last_status(), XVBM_STATUS_OVER_BUDGET);
+    EXPECT_EQ(xvbm_buffer_pool_num_buffers_get(h), 8);
+    EXPECT_EQ(xvbm_buffer_pool_extend(h, 2), 10);
+
+    // Tenant 2 still has its reservation, beyond it the budget is full
+    XvbmPoolHandle pb = xvbm_buffer_pool_create_ex(emu, 6, size, 0, &b);
+    ASSERT_TRUE(pb != NULL);
+    EXPECT_TRUE(xvbm_buffer_pool_create_ex(emu, 1, size, 0, &b) == NULL);
+    xvbm_device_headroom_get(emu, 2, XVBM_BUDGET_DEVICE, &headroom);
+    EXPECT_EQ(headroom, 0u);
+
+    // Destroying returns the memory
+    xvbm_buffer_pool_entry_free(h);
+    xvbm_buffer_pool_destroy(pa);
+    xvbm_device_headroom_get(emu, 2, XVBM_BUDGET_DEVICE, &headroom);
+    EXPECT_EQ(headroom, 10 * size);
+
+    // A dormant pool counts as headroom for a check, and is only freed by
+    // a create it makes room for
+    XvbmPoolCacheStats st;
+    ASSERT_EQ(xvbm_pool_cache_config(1 << 20, 0), 0);
+    xvbm_buffer_pool_destroy(xvbm_buffer_pool_create_ex(emu, 8, size, 0, &a));
+    xvbm_device_headroom_get(emu, 1, XVBM_BUDGET_DEVICE, &headroom);
+    EXPECT_EQ(headroom, 2 * size);
+    EXPECT_EQ(xvbm_buffer_pool_admit(emu, 10, size, 0, &a), XVBM_STATUS_OK);
+    EXPECT_EQ(xvbm_buffer_pool_admit(emu, 11, size, 0, &a), XVBM_STATUS_OVER_BUDGET);
+    EXPECT_TRUE(xvbm_buffer_pool_create_ex(emu, 11, size, 0, &a) == NULL);
+    xvbm_pool_cache_stats_get(&st);
+    EXPECT_EQ(st.dormant_pools, 1u);
+    XvbmPoolHandle pc = xvbm_buffer_pool_create_ex(emu, 9, size, 0, &a);
+    EXPECT_TRUE(pc != NULL);
+    xvbm_pool_cache_stats_get(&st);
+    EXPECT_EQ(st.dormant_pools, 0u);
+    xvbm_buffer_pool_destroy(pc);
+    xvbm_pool_cache_config(0, 0);
+
+    xvbm_buffer_pool_destroy(pb);
+}
+
+TEST_F(EmuPoolTest, DeferredTeardown)
+{
+    XvbmReclaimStats before, st;
+    size_t size = 4096;
+
+    ASSERT_EQ(xvbm_reclaim_config(8 * size), 0);
+    ASSERT_EQ(xvbm_reclaim_stats_get(&before), 0);
+
+    // The last entry_free queues the pool instead of freeing it
+    XvbmPoolHandle p_handle = xvbm_buffer_pool_create(emu, 4, size, 0);
+    ASSERT_TRUE(p_handle != NULL);
+    XvbmBufferHandle b_handle = xvbm_buffer_pool_entry_alloc(p_handle);
+    xvbm_buffer_pool_destroy(p_handle);
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(b_handle), true);
+    EXPECT_EQ(xvbm_reclaim_wait(emu, 1000), 0);
+    xvbm_reclaim_stats_get(&st);
+    EXPECT_EQ(st.queued - before.queued, 1u);
+    EXPECT_EQ(st.completed - before.completed, 1u);
+    EXPECT_EQ(st.pending_pools, 0u);
+    EXPECT_EQ(st.pending_bytes, 0u);
+    EXPECT_GE(st.peak_bytes, 4 * size);
+
+    // Beyond the cap the caller frees the pool
+    xvbm_buffer_pool_destroy(xvbm_buffer_pool_create(emu, 16, size, 0));
+    xvbm_reclaim_stats_get(&st);
+    EXPECT_EQ(st.inline_frees - before.inline_frees, 1u);
+    EXPECT_EQ(st.queued - before.queued, 1u);
+
+    // Queued memory counts against the budget until it is freed
+    ASSERT_EQ(xvbm_device_budget_set(emu, XVBM_BUDGET_DEVICE, 4 * size), 0);
+    xvbm_buffer_pool_destroy(xvbm_buffer_pool_create(emu, 4, size, 0));
+    p_handle = xvbm_buffer_pool_create(emu, 4, size, 0);
+    EXPECT_TRUE(p_handle != NULL);
+    xvbm_buffer_pool_destroy(p_handle);
+
+    xvbm_reclaim_config(0);
+    xvbm_reclaim_stats_get(&st);
+    EXPECT_EQ(st.queued, st.completed);
+}
+
+TEST_F(EmuPoolTest, BufferQueues)
+{
+    size_t size = 4096;
+    const uint32_t frames = 2000;
+
+    XvbmPoolHandle p_handle = xvbm_buffer_pool_create(emu, 4, size, 0);
+    ASSERT_TRUE(p_handle != NULL);
+
+    // Blocking allocation times out, and is woken by a free
+    std::vector<XvbmBufferHandle> held;
+    for (int i = 0; i < 4; i++)
+        held.push_back(xvbm_buffer_pool_entry_alloc(p_handle));
+    EXPECT_TRUE(xvbm_buffer_pool_entry_alloc_wait(p_handle, 10) == NULL);
+    std::thread freer([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        xvbm_buffer_pool_entry_free(held.back());
+    });
+    XvbmBufferHandle b_handle = xvbm_buffer_pool_entry_alloc_wait(p_handle, XVBM_WAIT_FOREVER);
+    EXPECT_EQ(b_handle, held.back());
+    freer.join();
+    held.back() = b_handle;
+
+    // Capacity rounds up, a full queue refuses and the caller keeps its
+    // reference, destroy frees what is still queued
+    XvbmQueueHandle q_handle = xvbm_queue_create(XVBM_QUEUE_SPSC, 3);
+    ASSERT_TRUE(q_handle != NULL);
+    for (auto h : held)
+        EXPECT_EQ(xvbm_queue_push(q_handle, h, 0), 0);
+    EXPECT_EQ(xvbm_queue_size(q_handle), 4u);
+    EXPECT_EQ(xvbm_queue_push(q_handle, held[0], 10), -1);
+    EXPECT_EQ(xvbm_queue_pop(q_handle, 0), held[0]);
+    EXPECT_EQ(xvbm_buffer_pool_entry_free(held[0]), true);
+    xvbm_queue_destroy(q_handle);
+    XvbmPoolStats st;
+    xvbm_buffer_pool_stats_get(p_handle, &st);
+    EXPECT_EQ(st.inuse, 0u);
+
+    // A pipeline limited by the pool, frames arrive in order
+    q_handle = xvbm_queue_create(XVBM_QUEUE_SPSC, 2);
+    std::thread producer([&]() {
+        for (uint32_t i = 0; i < frames; i++) {
+            XvbmBufferHandle h = xvbm_buffer_pool_entry_alloc_wait(p_handle, XVBM_WAIT_FOREVER);
+            *(uint32_t*)xvbm_buffer_get_host_ptr(h) = i;
+            xvbm_queue_push(q_handle, h, XVBM_WAIT_FOREVER);
+        }
+        xvbm_queue_close(q_handle);
+    });
+    uint32_t expect = 0;
+    while ((b_handle = xvbm_queue_pop(q_handle, XVBM_WAIT_FOREVER)) != NULL) {
+        EXPECT_EQ(*(uint32_t*)xvbm_buffer_get_host_ptr(b_handle), expect++);
+        xvbm_buffer_pool_entry_free(b_handle);
+    }
+    producer.join();
+    EXPECT_EQ(expect, frames);
+    EXPECT_EQ(xvbm_queue_push(q_handle, held[0], 0), -1);
+    xvbm_queue_destroy(q_handle);
+
+    // Several producers and consumers, every frame is seen once
+    q_handle = xvbm_queue_create(XVBM_QUEUE_MPMC, 2);
+    std::atomic<uint32_t> next(0), seen(0);
+    std::vector<std::thread> threads;
+    std::atomic<int> producers(2);
+    for (int t = 0; t < 2; t++) {
+        threads.emplace_back([&]() {
+            uint32_t i;
+            while ((i = next++) < frames) {
+                XvbmBufferHandle h = xvbm_buffer_pool_entry_alloc_wait(p_handle, XVBM_WAIT_FOREVER);
+                xvbm_queue_push(q_handle, h, XVBM_WAIT_FOREVER);
+            }
+            if (--producers == 0)
+                xvbm_queue_close(q_handle);
+        });
+        threads.emplace_back([&]() {
+            XvbmBufferHandle h;
+            while ((h = xvbm_queue_pop(q_handle, XVBM_WAIT_FOREVER)) != NULL) {
+                seen++;
+                xvbm_buffer_pool_entry_free(h);
+            }
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+    EXPECT_EQ(seen.load(), frames);
+    xvbm_queue_destroy(q_handle);
+
+    xvbm_buffer_pool_destroy(p_handle);
+}
+
+TEST_F(EmuPoolTest, BufferMetadata)
+{
+    XvbmPoolAttr attr = {};
+    size_t size = 4096;
+
+    XvbmPoolHandle plain = xvbm_buffer_pool_create(emu, 1, size, 0);
+    XvbmBufferHandle b_handle = xvbm_buffer_pool_entry_alloc(plain);
+    EXPECT_TRUE(xvbm_buffer_get_meta(b_handle) == NULL);
+    EXPECT_EQ(xvbm_buffer_get_meta_size(b_handle), 0u);
+    xvbm_buffer_pool_entry_free(b_handle);
+    xvbm_buffer_pool_destroy(plain);
+
+    attr.meta_size = XVBM_META_MAX_SIZE + 1;
+    EXPECT_TRUE(xvbm_buffer_pool_create_ex(emu, 2, size, 0, &attr) == NULL);
+    EXPECT_EQ(xvbm_last_status(), XVBM_STATUS_INVALID);
+    attr.meta_size = 20;
+    XvbmPoolHandle p_handle = xvbm_buffer_pool_create_ex(emu, 2, size, 0, &attr);
+    ASSERT_TRUE(p_handle != NULL);
+
+    // Cache line sized and aligned, kept while referenced
+    b_handle = xvbm_buffer_pool_entry_alloc(p_handle);
+    uint64_t *meta = (uint64_t*)xvbm_buffer_get_meta(b_handle);
+    ASSERT_TRUE(meta != NULL);
+    EXPECT_EQ(xvbm_buffer_get_meta_size(b_handle), 64u);
+    EXPECT_EQ((uintptr_t)meta % 64, 0u);
+    EXPECT_EQ(meta[0], 0u);
+    meta[0] = 90000;
+    XvbmBufferHandle view = xvbm_buffer_view_create(b_handle, 0, size / 2, 0);
+    EXPECT_EQ(xvbm_buffer_get_meta(view), meta);
+    xvbm_buffer_pool_entry_free(view);
+    EXPECT_EQ(meta[0], 90000u);
+
+    // Copy-on-write carries the metadata along
+    xvbm_buffer_refcnt_inc(b_handle);
+    XvbmBufferHandle copy = xvbm_buffer_make_writable(b_handle);
+    ASSERT_TRUE(copy != NULL && copy != b_handle);
+    EXPECT_EQ(((uint64_t*)xvbm_buffer_get_meta(copy))[0], 90000u);
+
+    // The final free clears it
+    xvbm_buffer_pool_entry_free(b_handle);
+    EXPECT_EQ(meta[0], 0u);
+    xvbm_buffer_pool_entry_free(copy);
+    xvbm_buffer_pool_destroy(p_handle);
+}
+
+TEST_F(EmuPoolTest, CppWrapper)
+{
+    XvbmPoolAttr attr = {};
+    size_t size = 4096;
+
+    attr.meta_size = sizeof(int64_t);
+    xvbm::Pool pool = xvbm::Pool::create(emu, 2, size, 0, &attr);
+    ASSERT_TRUE(pool);
+    XvbmPoolHandle p_handle = pool.get();
+
+    // Moves hand the reference over, share takes another one
+    xvbm::BufferRef a = pool.alloc();
+    ASSERT_TRUE(a);
+    XvbmBufferHandle b_handle = a.get();
+    xvbm::BufferRef b = std::move(a);
+    EXPECT_FALSE(a);
+    EXPECT_EQ(b.get(), b_handle);
+    EXPECT_EQ(b.refcnt(), 1u);
+    xvbm::BufferRef c = b.share();
+    EXPECT_EQ(b.refcnt(), 2u);
+    c.reset();
+    EXPECT_EQ(b.refcnt(), 1u);
+    *b.meta<int64_t>() = 42;
+    EXPECT_TRUE(b.meta<char[128]>() == NULL);
+
+    // Container overloads
+    std::vector<uint32_t> out(size / sizeof(uint32_t), 7), in(out.size());
+    EXPECT_EQ(b.write(out), 0);
+    EXPECT_EQ(b.read(in), 0);
+    EXPECT_EQ(in, out);
+    std::string tag("frame");
+    EXPECT_EQ(b.write(tag, 16), 0);
+    char back[5];
+    EXPECT_EQ(b.read(back, sizeof(back), 16), 0);
+    EXPECT_EQ(std::string(back, 5), tag);
+
+    // Lookups by address take their own reference, free buffers are not
+    // found
+    {
+        xvbm::BufferRef found = pool.find(b.paddr());
+        EXPECT_EQ(found.get(), b.get());
+        EXPECT_EQ(b.refcnt(), 2u);
+    }
+    EXPECT_EQ(b.refcnt(), 1u);
+    xvbm::BufferRef spare = pool.alloc();
+    uint64_t spare_paddr = spare.paddr();
+    spare.reset();
+    EXPECT_FALSE(pool.find(spare_paddr));
+    EXPECT_FALSE(pool.find(spare_paddr + 1));
+
+    // A view keeps its buffer, a shared buffer is copied on write
+    xvbm::BufferRef v = b.view(0, size / 2);
+    ASSERT_TRUE(v);
+    EXPECT_EQ(b.refcnt(), 2u);
+    v = xvbm::BufferRef();
+    c = b.share();
+    EXPECT_TRUE(c.make_writable());
+    EXPECT_NE(c.get(), b.get());
+    EXPECT_EQ(*c.meta<int64_t>(), 42);
+    EXPECT_EQ(b.refcnt(), 1u);
+    EXPECT_FALSE(pool.alloc());
+    c.reset();
+
+    // Queues take the reference only when the push succeeds
+    xvbm::Queue q(XVBM_QUEUE_SPSC, 1);
+    EXPECT_TRUE(q.push(std::move(b)));
+    EXPECT_FALSE(b);
+    xvbm::BufferRef d = pool.alloc();
+    EXPECT_FALSE(q.push(std::move(d), 0));
+    EXPECT_TRUE(d);
+    xvbm::BufferRef e = q.pop(0);
+    EXPECT_EQ(e.get(), b_handle);
+    q.close();
+    EXPECT_FALSE(q.pop());
+
+    // The pool outlives its owner until the last buffer is freed
+    pool.reset();
+    EXPECT_EQ(xvbm_get_pool_handle(e.get()), p_handle);
+    EXPECT_EQ(e.write(out), 0);
+    d.reset();
+    e.reset();
+}
+
+TEST_F(EmuPoolTest, PriorityClasses)
+{
+    XvbmPrioStats st;
+    size_t size = 4096;
+
+    XvbmPoolHandle p_handle = xvbm_buffer_pool_create(emu, 6, size, 0);
+    ASSERT_TRUE(p_handle != NULL);
+
+    EXPECT_EQ(xvbm_buffer_pool_prio_set(p_handle, XVBM_PRIO_BACKGROUND, 3, 2), -1);
+    EXPECT_EQ(xvbm_buffer_pool_prio_set(p_handle, XVBM_PRIO_CRITICAL, 7, 0), -1);
+    EXPECT_EQ(xvbm_buffer_pool_prio_set(p_handle, XVBM_PRIO_CLASSES, 0, 0), -1);
+    EXPECT_EQ(xvbm_buffer_pool_prio_set(p_handle, XVBM_PRIO_CRITICAL, 2, 0), 0);
+    EXPECT_EQ(xvbm_buffer_pool_prio_set(p_handle, XVBM_PRIO_BACKGROUND, 0, 3), 0);
+
+    // Background stops at its cap, normal stops at the critical reservation
+    std::vector<XvbmBufferHandle> bg, normal, critical;
+    XvbmBufferHandle b_handle;
+    while ((b_handle = xvbm_buffer_pool_entry_alloc_prio(p_handle, XVBM_PRIO_BACKGROUND)) != NULL)
+        bg.push_back(b_handle);
+    EXPECT_EQ(bg.size(), 3u);
+    while ((b_handle = xvbm_buffer_pool_entry_alloc(p_handle)) != NULL)
+        normal.push_back(b_handle);
+    EXPECT_EQ(normal.size(), 1u);
+    while ((b_handle = xvbm_buffer_pool_entry_alloc_prio(p_handle, XVBM_PRIO_CRITICAL)) != NULL)
+        critical.push_back(b_handle);
+    EXPECT_EQ(critical.size(), 2u);
+
+    xvbm_buffer_pool_prio_stats_get(p_handle, XVBM_PRIO_BACKGROUND, &st);
+    EXPECT_EQ(st.max_inuse, 3u);
+    EXPECT_EQ(st.inuse, 3u);
+    EXPECT_EQ(st.allocs, 3u);
+    EXPECT_EQ(st.failed_allocs, 1u);
+    EXPECT_EQ(st.denied, 1u);
+    xvbm_buffer_pool_prio_stats_get(p_handle, XVBM_PRIO_NORMAL, &st);
+    EXPECT_EQ(st.denied, 1u);
+    xvbm_buffer_pool_prio_stats_get(p_handle, XVBM_PRIO_CRITICAL, &st);
+    EXPECT_EQ(st.reserved, 2u);
+    EXPECT_EQ(st.inuse_high_water, 2u);
+    EXPECT_EQ(st.failed_allocs, 1u);
+    EXPECT_EQ(st.denied, 0u);
+
+    // A free buffer held back from a capped class does not wake it
+    xvbm_buffer_pool_entry_free(critical.back());
+    critical.pop_back();
+    EXPECT_TRUE(xvbm_buffer_pool_entry_alloc_prio_wait(p_handle, XVBM_PRIO_BACKGROUND, 10) == NULL);
+    std::thread freer([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        xvbm_buffer_pool_entry_free(bg.back());
+    });
+    b_handle = xvbm_buffer_pool_entry_alloc_prio_wait(p_handle, XVBM_PRIO_BACKGROUND, XVBM_WAIT_FOREVER);
+    freer.join();
+    ASSERT_TRUE(b_handle != NULL);
+    bg.back() = b_handle;
+    xvbm_buffer_pool_prio_stats_get(p_handle, XVBM_PRIO_BACKGROUND, &st);
+    EXPECT_EQ(st.waits, 2u);
+    EXPECT_EQ(st.wait_timeouts, 1u);
+    EXPECT_GE(st.max_wait_ns, 10000000u);
+    EXPECT_EQ(st.inuse, 3u);
+
+    // Classes follow the buffer through copy-on-write and views
+    xvbm_buffer_refcnt_inc(critical[0]);
+    XvbmBufferHandle copy = xvbm_buffer_make_writable(critical[0]);
+    ASSERT_TRUE(copy != NULL && copy != critical[0]);
+    xvbm_buffer_pool_prio_stats_get(p_handle, XVBM_PRIO_CRITICAL, &st);
+    EXPECT_EQ(st.inuse, 2u);
+    XvbmBufferHandle view = xvbm_buffer_view_create(copy, 0, size / 2, 0);
+    xvbm_buffer_pool_entry_free(copy);
+    xvbm_buffer_pool_prio_stats_get(p_handle, XVBM_PRIO_CRITICAL, &st);
+    EXPECT_EQ(st.inuse, 2u);
+    xvbm_buffer_pool_entry_free(view);
+
+    for (auto h : bg)
+        xvbm_buffer_pool_entry_free(h);
+    for (auto h : normal)
+        xvbm_buffer_pool_entry_free(h);
+    for (auto h : critical)
+        xvbm_buffer_pool_entry_free(h);
+    xvbm_buffer_pool_stats_reset(p_handle);
+    for (int c = 0; c < XVBM_PRIO_CLASSES; c++) {
+        xvbm_buffer_pool_prio_stats_get(p_handle, (XvbmPriority)c, &st);
+        EXPECT_EQ(st.inuse, 0u);
+        EXPECT_EQ(st.allocs, 0u);
+        EXPECT_EQ(st.waits, 0u);
+    }
+    xvbm_buffer_pool_destroy(p_handle);
+}
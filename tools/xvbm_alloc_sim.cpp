@@ -0,0 +1,321 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later OR Apache-2.0 */
+
+/*
+ * Copyright (C) 2019-2021 Xilinx Inc - All rights reserved
+ * Xilinx Video Buffer Manager (Xvbm)
+ *
+ * This file is dual-licensed; you may select either the GNU
+ * Lesser General Public License version 3 or
+ * Apache License, Version 2.0.
+ *
+ */
+
+// xvbm-alloc-sim : replay an allocation trace recorded with XVBM_ALLOC_TRACE
+// (or xvbm_alloc_trace_start) against pools of different sizes, growth
+// policies and reuse orders
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "xvbm_alloc_trace.h"
+
+enum Growth { GROW_NONE, GROW_ADD, GROW_DOUBLE };
+enum Reuse { REUSE_LIFO, REUSE_FIFO };
+
+struct Policy
+{
+    Growth   m_growth;
+    uint32_t m_value;    // pool size for GROW_NONE, step for GROW_ADD
+};
+
+struct Result
+{
+    uint32_t m_buffers = 0;
+    uint32_t m_grows = 0;
+    uint64_t m_failures = 0;
+    uint32_t m_touched = 0;
+};
+
+// One lifetime of a pool, a pool address can be reused after a destroy
+struct PoolTrace
+{
+    uint64_t                          m_pool_id = 0;
+    uint64_t                          m_size = 0;
+    uint32_t                          m_recorded_buffers = 0;
+    uint64_t                          m_allocs = 0;
+    uint64_t                          m_recorded_failures = 0;
+    uint32_t                          m_peak = 0;
+    std::vector<XvbmAllocTraceRecord> m_events;
+};
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-n buffers]... [-g add:K|double]... [-i initial] [-p pool] trace\n"
+                    "  -n buffers        simulate a fixed pool of this many buffers\n"
+                    "  -g add:K|double   simulate a pool growing by K buffers or doubling when empty\n"
+                    "  -i initial        initial buffers of growing pools (default 1)\n"
+                    "  -p pool           only report this pool (address as printed)\n"
+                    "Without -n or -g the recorded and minimum sizes and a few growth\n"
+                    "policies are simulated, each with LIFO and FIFO reuse.\n",
+            prog);
+}
+
+static bool load(const char *path, std::vector<XvbmAllocTraceRecord> &records)
+{
+    XvbmAllocTraceHeader hdr;
+    XvbmAllocTraceRecord rec;
+    FILE *fp = fopen(path, "rb");
+
+    if (fp == nullptr) {
+        fprintf(stderr, "can not open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.m_magic != XVBM_ALLOC_TRACE_MAGIC ||
+        hdr.m_version != XVBM_ALLOC_TRACE_VERSION) {
+        fprintf(stderr, "%s is not an XVBM allocation trace\n", path);
+        fclose(fp);
+        return false;
+    }
+    while (fread(&rec, sizeof(rec), 1, fp) == 1)
+        records.push_back(rec);
+    fclose(fp);
+
+    // Batches of different threads interleave, events of one pool were
+    // recorded under its lock and keep their order among equal stamps
+    std::stable_sort(records.begin(), records.end(),
+                     [](const XvbmAllocTraceRecord &a, const XvbmAllocTraceRecord &b) {
+                         return a.m_ts_ns < b.m_ts_ns;
+                     });
+    printf("trace of pid %u, %zu events\n", hdr.m_pid, records.size());
+    return true;
+}
+
+static std::vector<PoolTrace> split_pools(const std::vector<XvbmAllocTraceRecord> &records)
+{
+    std::vector<PoolTrace> pools;
+    std::map<uint64_t, size_t> active;
+    std::map<uint64_t, std::map<uint32_t, bool>> live;
+
+    for (auto &rec : records) {
+        auto it = active.find(rec.m_pool_id);
+        if (it == active.end() || rec.m_type == XVBM_ATRACE_POOL_CREATE) {
+            // A create for an active pool repeats the one seen at trace start
+            if (it != active.end())
+                continue;
+            PoolTrace pool;
+            pool.m_pool_id = rec.m_pool_id;
+            if (rec.m_type == XVBM_ATRACE_POOL_CREATE) {
+                pool.m_size = rec.m_arg;
+                pool.m_recorded_buffers = rec.m_buffer;
+            }
+            active[rec.m_pool_id] = pools.size();
+            live[rec.m_pool_id].clear();
+            pools.push_back(pool);
+            if (rec.m_type == XVBM_ATRACE_POOL_CREATE)
+                continue;
+            it = active.find(rec.m_pool_id);
+        }
+
+        PoolTrace &pool = pools[it->second];
+        auto &in_use = live[rec.m_pool_id];
+        switch (rec.m_type) {
+        case XVBM_ATRACE_POOL_EXTEND:
+            pool.m_recorded_buffers = std::max(pool.m_recorded_buffers, rec.m_buffer);
+            break;
+        case XVBM_ATRACE_POOL_DESTROY:
+            active.erase(it);
+            break;
+        case XVBM_ATRACE_ALLOC:
+            pool.m_allocs++;
+            pool.m_events.push_back(rec);
+            in_use[rec.m_buffer] = true;
+            pool.m_peak = std::max<uint32_t>(pool.m_peak, in_use.size());
+            pool.m_recorded_buffers = std::max(pool.m_recorded_buffers, rec.m_buffer + 1);
+            break;
+        case XVBM_ATRACE_ALLOC_FAILED:
+            pool.m_recorded_failures++;
+            break;
+        case XVBM_ATRACE_FREE:
+            if (rec.m_ref_cnt == 0 && in_use.erase(rec.m_buffer))
+                pool.m_events.push_back(rec);
+            break;
+        default:
+            break;
+        }
+    }
+    return pools;
+}
+
+static Result simulate(const PoolTrace &pool, const Policy &policy, uint32_t initial, Reuse reuse)
+{
+    Result res;
+    std::deque<uint32_t> free_list;
+    std::map<uint32_t, uint32_t> live;
+    std::set<uint32_t> touched;
+
+    res.m_buffers = (policy.m_growth == GROW_NONE) ? policy.m_value : initial;
+    for (uint32_t i = 0; i < res.m_buffers; i++)
+        free_list.push_back(i);
+
+    for (auto &ev : pool.m_events) {
+        if (ev.m_type == XVBM_ATRACE_FREE) {
+            auto it = live.find(ev.m_buffer);
+            // Frees of allocations that failed in the simulation are dropped
+            if (it == live.end())
+                continue;
+            if (reuse == REUSE_LIFO)
+                free_list.push_front(it->second);
+            else
+                free_list.push_back(it->second);
+            live.erase(it);
+            continue;
+        }
+
+        if (free_list.empty()) {
+            uint32_t add = 0;
+            if (policy.m_growth == GROW_ADD)
+                add = policy.m_value;
+            else if (policy.m_growth == GROW_DOUBLE)
+                add = std::max<uint32_t>(res.m_buffers, 1);
+            if (add == 0) {
+                res.m_failures++;
+                continue;
+            }
+            for (uint32_t i = 0; i < add; i++)
+                free_list.push_back(res.m_buffers + i);
+            res.m_buffers += add;
+            res.m_grows++;
+        }
+        uint32_t buf = free_list.front();
+        free_list.pop_front();
+        live[ev.m_buffer] = buf;
+        touched.insert(buf);
+    }
+    res.m_touched = touched.size();
+    return res;
+}
+
+static double mb(uint64_t bytes)
+{
+    return (double)bytes / (1 << 20);
+}
+
+static std::string policy_name(const Policy &policy, uint32_t initial)
+{
+    char name[64];
+
+    if (policy.m_growth == GROW_NONE)
+        snprintf(name, sizeof(name), "fixed:%u", policy.m_value);
+    else if (policy.m_growth == GROW_ADD)
+        snprintf(name, sizeof(name), "%u+%u", initial, policy.m_value);
+    else
+        snprintf(name, sizeof(name), "%u*2", initial);
+    return name;
+}
+
+static void report(const PoolTrace &pool, std::vector<Policy> policies, uint32_t initial)
+{
+    uint64_t recorded = (uint64_t)pool.m_recorded_buffers * pool.m_size;
+    uint64_t minimum = (uint64_t)pool.m_peak * pool.m_size;
+
+    printf("\npool 0x%llx  size %.1f MB  recorded %u buffers (%.1f MB)  allocs %llu",
+           (unsigned long long)pool.m_pool_id, mb(pool.m_size), pool.m_recorded_buffers,
+           mb(recorded), (unsigned long long)pool.m_allocs);
+    if (pool.m_recorded_failures)
+        printf("  failed %llu (their demand is not in the trace)",
+               (unsigned long long)pool.m_recorded_failures);
+    if (pool.m_allocs == 0) {
+        printf("\n  never allocated from, saving %.1f MB\n", mb(recorded));
+        return;
+    }
+    printf("\n  minimum for zero failures: %u buffers (%.1f MB), saving %.1f MB",
+           pool.m_peak, mb(minimum), mb(recorded - std::min(recorded, minimum)));
+    if (recorded)
+        printf(" (%.0f%%)", 100.0 * (recorded - std::min(recorded, minimum)) / recorded);
+    printf("\n");
+
+    if (policies.empty()) {
+        policies.push_back({GROW_NONE, pool.m_recorded_buffers});
+        if (pool.m_peak != pool.m_recorded_buffers)
+            policies.push_back({GROW_NONE, pool.m_peak});
+        policies.push_back({GROW_ADD, 1});
+        policies.push_back({GROW_ADD, 4});
+        policies.push_back({GROW_DOUBLE, 0});
+    }
+
+    printf("  %-14s %-5s %8s %6s %9s %8s %10s\n",
+           "policy", "reuse", "buffers", "grows", "failures", "touched", "memory MB");
+    for (auto &policy : policies) {
+        for (Reuse reuse : {REUSE_LIFO, REUSE_FIFO}) {
+            Result res = simulate(pool, policy, initial, reuse);
+            printf("  %-14s %-5s %8u %6u %9llu %8u %10.1f\n",
+                   policy_name(policy, initial).c_str(), reuse == REUSE_LIFO ? "lifo" : "fifo",
+                   res.m_buffers, res.m_grows, (unsigned long long)res.m_failures,
+                   res.m_touched, mb((uint64_t)res.m_buffers * pool.m_size));
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<XvbmAllocTraceRecord> records;
+    std::vector<Policy> policies;
+    uint32_t initial = 1;
+    uint64_t only_pool = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:g:i:p:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            policies.push_back({GROW_NONE, (uint32_t)atoi(optarg)});
+            break;
+        case 'g':
+            if (strcmp(optarg, "double") == 0) {
+                policies.push_back({GROW_DOUBLE, 0});
+            } else if (strncmp(optarg, "add:", 4) == 0 && atoi(optarg + 4) > 0) {
+                policies.push_back({GROW_ADD, (uint32_t)atoi(optarg + 4)});
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'i':
+            initial = atoi(optarg);
+            break;
+        case 'p':
+            only_pool = strtoull(optarg, nullptr, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!load(argv[optind], records))
+        return 1;
+
+    uint64_t recorded = 0;
+    uint64_t minimum = 0;
+    for (auto &pool : split_pools(records)) {
+        if (only_pool && pool.m_pool_id != only_pool)
+            continue;
+        report(pool, policies, initial);
+        recorded += (uint64_t)pool.m_recorded_buffers * pool.m_size;
+        minimum += (uint64_t)pool.m_peak * pool.m_size;
+    }
+    printf("\ntotal: recorded %.1f MB, minimum %.1f MB, saving %.1f MB\n",
+           mb(recorded), mb(minimum), mb(recorded - std::min(recorded, minimum)));
+
+    return 0;
+}
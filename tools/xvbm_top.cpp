@@ -0,0 +1,177 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later OR Apache-2.0 */
+
+/*
+ * Copyright (C) 2019-2021 Xilinx Inc - All rights reserved
+ * Xilinx Video Buffer Manager (Xvbm)
+ *
+ * This file is dual-licensed; you may select either the GNU
+ * Lesser General Public License version 3 or
+ * Apache License, Version 2.0.
+ *
+ */
+
+// xvbm-top : show the live buffer pool statistics published by processes
+// running with XVBM_SHM_STATS_MS set (or xvbm_shm_stats_enable)
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "xvbm_shm.h"
+
+struct Sample
+{
+    uint64_t m_ts_ns;
+    uint64_t m_bytes[XVBM_SHM_XFER_DIRS];
+};
+
+static uint64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-p pid] [-d delay_ms] [-n iterations]\n"
+                    "  -p pid         only show this process\n"
+                    "  -d delay_ms    refresh interval (default 1000)\n"
+                    "  -n iterations  exit after n refreshes (default: run forever)\n",
+            prog);
+}
+
+static std::vector<int> find_processes(int only_pid)
+{
+    std::vector<int> pids;
+    DIR *dir = opendir("/dev/shm");
+    struct dirent *ent;
+
+    if (dir == nullptr)
+        return pids;
+    while ((ent = readdir(dir)) != nullptr) {
+        if (strncmp(ent->d_name, XVBM_SHM_NAME_PREFIX, strlen(XVBM_SHM_NAME_PREFIX)))
+            continue;
+        int pid = atoi(ent->d_name + strlen(XVBM_SHM_NAME_PREFIX));
+        if (pid > 0 && (only_pid == 0 || pid == only_pid))
+            pids.push_back(pid);
+    }
+    closedir(dir);
+
+    return pids;
+}
+
+static const XvbmShmHeader *map_process(int pid)
+{
+    std::string name = "/" XVBM_SHM_NAME_PREFIX + std::to_string(pid);
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    void *ptr;
+
+    if (fd < 0)
+        return nullptr;
+    ptr = mmap(nullptr, sizeof(XvbmShmHeader), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED)
+        return nullptr;
+
+    const XvbmShmHeader *hdr = static_cast<const XvbmShmHeader*>(ptr);
+    if ((hdr->m_magic != XVBM_SHM_MAGIC) || (hdr->m_version != XVBM_SHM_VERSION)) {
+        munmap(ptr, sizeof(XvbmShmHeader));
+        return nullptr;
+    }
+
+    return hdr;
+}
+
+int main(int argc, char *argv[])
+{
+    std::map<std::pair<int, uint64_t>, Sample> prev;
+    int only_pid = 0;
+    int delay_ms = 1000;
+    int iterations = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:d:n:h")) != -1) {
+        switch (opt) {
+        case 'p': only_pid = atoi(optarg); break;
+        case 'd': delay_ms = atoi(optarg); break;
+        case 'n': iterations = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return (opt == 'h') ? 0 : 1;
+        }
+    }
+    if (delay_ms <= 0)
+        delay_ms = 1000;
+
+    bool interactive = isatty(STDOUT_FILENO) && (iterations != 1);
+
+    for (int n = 0; iterations < 0 || n < iterations; n++) {
+        std::map<std::pair<int, uint64_t>, Sample> cur;
+        std::vector<int> pids = find_processes(only_pid);
+
+        if (interactive)
+            printf("\033[H\033[2J");
+        printf("%-7s %-14s %10s %5s %5s %5s %5s %-22s %4s %6s %8s %8s %8s\n",
+               "PID", "POOL", "SIZE", "BUFS", "FREE", "INUSE", "HW",
+               "REFS 1/2/3/4/5-8/>8", "EXT", "FAIL", "WR MB/s", "RD MB/s", "CP MB/s");
+
+        for (int pid : pids) {
+            const XvbmShmHeader *hdr = map_process(pid);
+            if (hdr == nullptr)
+                continue;
+            bool alive = (kill(pid, 0) == 0) || (errno == EPERM);
+            uint64_t ts = now_ns();
+
+            for (uint32_t i = 0; i < XVBM_SHM_MAX_POOLS; i++) {
+                XvbmShmPool pool;
+                if (!xvbm_shm_pool_read(&hdr->m_pools[i], &pool))
+                    continue;
+
+                auto key = std::make_pair(pid, pool.m_pool_id);
+                Sample &s = cur[key];
+                double rate[XVBM_SHM_XFER_DIRS] = {0};
+                s.m_ts_ns = ts;
+                for (int dir = 0; dir < XVBM_SHM_XFER_DIRS; dir++)
+                    s.m_bytes[dir] = pool.m_xfer_bytes[dir];
+                auto it = prev.find(key);
+                if (it != prev.end() && ts > it->second.m_ts_ns) {
+                    double secs = (ts - it->second.m_ts_ns) / 1e9;
+                    for (int dir = 0; dir < XVBM_SHM_XFER_DIRS; dir++)
+                        rate[dir] = (s.m_bytes[dir] - it->second.m_bytes[dir]) / secs / (1 << 20);
+                }
+
+                char refs[64];
+                snprintf(refs, sizeof(refs), "%lu/%lu/%lu/%lu/%lu/%lu",
+                         (unsigned long)pool.m_refcnt_hist[0], (unsigned long)pool.m_refcnt_hist[1],
+                         (unsigned long)pool.m_refcnt_hist[2], (unsigned long)pool.m_refcnt_hist[3],
+                         (unsigned long)pool.m_refcnt_hist[4], (unsigned long)pool.m_refcnt_hist[5]);
+                printf("%-7d %-14llx %10llu %5d %5u %5u %5u %-22s %4llu %6llu %8.1f %8.1f %8.1f%s\n",
+                       pid, (unsigned long long)pool.m_pool_id,
+                       (unsigned long long)pool.m_size, pool.m_num_buffers,
+                       pool.m_free, pool.m_inuse, pool.m_inuse_high_water, refs,
+                       (unsigned long long)pool.m_extends,
+                       (unsigned long long)pool.m_failed_allocs,
+                       rate[0], rate[1], rate[2], alive ? "" : " (exited)");
+            }
+            munmap((void*)hdr, sizeof(XvbmShmHeader));
+        }
+        fflush(stdout);
+        prev.swap(cur);
+
+        if (iterations < 0 || n + 1 < iterations)
+            std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+    }
+
+    return 0;
+}